@@ -3,5 +3,5 @@ CONFIG += ordered
 
 SUBDIRS += \
     SuWidgetsLib.pro \
-    SuWidgetsPlugin.pro
-
+    SuWidgetsPlugin.pro \
+    tests
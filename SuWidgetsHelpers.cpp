@@ -436,6 +436,120 @@ SuWidgetsHelpers::findParentLayout(
   return nullptr;
 }
 
+static inline void
+kahanAdd(SUFLOAT &sum, SUFLOAT &c, SUFLOAT value)
+{
+  SUFLOAT y = value - c;
+  SUFLOAT t = sum + y;
+
+  c   = (t - sum) - y;
+  sum = t;
+}
+
+//
+// Compensated sums over interleaved real / imaginary parts. Every lane keeps
+// its own sum and compensation, so that the compiler can vectorize the
+// inner loop. This does reorder the sum: each lane adds every
+// SUWIDGETS_KAHAN_LANES-th value, and lanes are folded into state at the
+// end (also with compensation). Results may then differ from a sequential
+// compensated sum in the last bits.
+//
+void
+SuWidgetsHelpers::kahanAccumulate(
+    const SUCOMPLEX *data,
+    SUSCOUNT length,
+    KahanState *state)
+{
+  const SUFLOAT *x = RCAST(const SUFLOAT *, data);
+  SUSCOUNT n = 2 * length;
+  SUSCOUNT blocked = n - n % SUWIDGETS_KAHAN_LANES;
+  SUFLOAT sum[SUWIDGETS_KAHAN_LANES]  = {0};
+  SUFLOAT sumC[SUWIDGETS_KAHAN_LANES] = {0};
+  SUFLOAT pwr[SUWIDGETS_KAHAN_LANES]  = {0};
+  SUFLOAT pwrC[SUWIDGETS_KAHAN_LANES] = {0};
+  SUFLOAT reSum = SU_C_REAL(state->meanSum);
+  SUFLOAT imSum = SU_C_IMAG(state->meanSum);
+  SUFLOAT reC   = SU_C_REAL(state->meanC);
+  SUFLOAT imC   = SU_C_IMAG(state->meanC);
+  SUFLOAT y, t;
+
+  for (SUSCOUNT i = 0; i < blocked; i += SUWIDGETS_KAHAN_LANES) {
+    for (int j = 0; j < SUWIDGETS_KAHAN_LANES; ++j) {
+      y       = x[i + j] - sumC[j];
+      t       = sum[j] + y;
+      sumC[j] = (t - sum[j]) - y;
+      sum[j]  = t;
+
+      y       = x[i + j] * x[i + j] - pwrC[j];
+      t       = pwr[j] + y;
+      pwrC[j] = (t - pwr[j]) - y;
+      pwr[j]  = t;
+    }
+  }
+
+  // Even lanes hold real parts, odd lanes imaginary parts
+  for (int j = 0; j < SUWIDGETS_KAHAN_LANES; ++j) {
+    if (j & 1) {
+      kahanAdd(imSum, imC, sum[j]);
+      kahanAdd(imSum, imC, -sumC[j]);
+    } else {
+      kahanAdd(reSum, reC, sum[j]);
+      kahanAdd(reSum, reC, -sumC[j]);
+    }
+
+    kahanAdd(state->rmsSum, state->rmsC, pwr[j]);
+    kahanAdd(state->rmsSum, state->rmsC, -pwrC[j]);
+  }
+
+  for (SUSCOUNT i = blocked; i < n; ++i) {
+    if (i & 1)
+      kahanAdd(imSum, imC, x[i]);
+    else
+      kahanAdd(reSum, reC, x[i]);
+
+    kahanAdd(state->rmsSum, state->rmsC, x[i] * x[i]);
+  }
+
+  state->meanSum = reSum + imSum * SU_I;
+  state->meanC   = reC + imC * SU_I;
+  state->count  += length;
+}
+
+//
+// Adds the samples summarized by partial (which must come right after
+// those in state, if the order of the sum is to be kept)
+//
+void
+SuWidgetsHelpers::kahanMerge(KahanState *state, KahanState const &partial)
+{
+  SUFLOAT reSum = SU_C_REAL(state->meanSum);
+  SUFLOAT imSum = SU_C_IMAG(state->meanSum);
+  SUFLOAT reC   = SU_C_REAL(state->meanC);
+  SUFLOAT imC   = SU_C_IMAG(state->meanC);
+
+  kahanAdd(reSum, reC, SU_C_REAL(partial.meanSum));
+  kahanAdd(reSum, reC, -SU_C_REAL(partial.meanC));
+  kahanAdd(imSum, imC, SU_C_IMAG(partial.meanSum));
+  kahanAdd(imSum, imC, -SU_C_IMAG(partial.meanC));
+
+  kahanAdd(state->rmsSum, state->rmsC, partial.rmsSum);
+  kahanAdd(state->rmsSum, state->rmsC, -partial.rmsC);
+
+  state->meanSum = reSum + imSum * SU_I;
+  state->meanC   = reC + imC * SU_I;
+  state->count  += partial.count;
+}
+
+void
+SuWidgetsHelpers::kahanResult(
+    SUCOMPLEX *mean,
+    SUFLOAT *rms,
+    KahanState const &state)
+{
+  *mean = state.meanSum / SU_ASFLOAT(state.count);
+  *rms  = SU_SQRT(state.rmsSum / state.count);
+}
+
 void
 SuWidgetsHelpers::kahanMeanAndRms(
     SUCOMPLEX *mean,
@@ -449,13 +563,35 @@ SuWidgetsHelpers::kahanMeanAndRms(
   if (state == nullptr)
     state = &currState;
 
-  SUCOMPLEX meanY, meanT;
+  kahanAccumulate(data, length, state);
+  kahanResult(mean, rms, *state);
+}
 
+//
+// Removes the contribution of samples that were previously accumulated
+// into state (e.g. samples leaving a sliding window).
+//
+void
+SuWidgetsHelpers::kahanDiscard(
+    SUCOMPLEX *mean,
+    SUFLOAT *rms,
+    const SUCOMPLEX *data,
+    SUSCOUNT length,
+    KahanState *state)
+{
+  SUCOMPLEX meanY, meanT;
   SUFLOAT   rmsY, rmsT;
 
+  if (length >= state->count) {
+    *state = KahanState();
+    *mean  = 0;
+    *rms   = 0;
+    return;
+  }
+
   for (SUSCOUNT i = 0; i < length; ++i) {
-    meanY = data[i] - state->meanC;
-    rmsY  = SU_C_REAL(data[i] * SU_C_CONJ(data[i])) - state->rmsC;
+    meanY = -data[i] - state->meanC;
+    rmsY  = -SU_C_REAL(data[i] * SU_C_CONJ(data[i])) - state->rmsC;
 
     meanT = state->meanSum + meanY;
     rmsT  = state->rmsSum  + rmsY;
@@ -467,7 +603,11 @@ SuWidgetsHelpers::kahanMeanAndRms(
     state->rmsSum  = rmsT;
   }
 
-  state->count += length;
+  state->count -= length;
+
+  // Cancellation may leave a tiny negative residue
+  if (state->rmsSum < 0)
+    state->rmsSum = 0;
 
   *mean = state->meanSum / SU_ASFLOAT(state->count);
   *rms  = SU_SQRT(state->rmsSum / state->count);
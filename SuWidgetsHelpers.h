@@ -35,6 +35,9 @@ class QWidget;
 class QLayout;
 
 #define SUWIDGETS_DEFAULT_PRECISION 3
+
+// Independent compensated sums per call (must be even: real / imag pairs)
+#define SUWIDGETS_KAHAN_LANES         8
 #define SCAST(type, value) static_cast<type>(value)
 #define RCAST(type, value) reinterpret_cast<type>(value)
 
@@ -100,6 +103,25 @@ class SuWidgetsHelpers {
         SUSCOUNT length,
         KahanState *prevState = nullptr);
 
+    static void kahanAccumulate(
+        const SUCOMPLEX *data,
+        SUSCOUNT length,
+        KahanState *state);
+
+    static void kahanMerge(KahanState *state, KahanState const &partial);
+
+    static void kahanResult(
+        SUCOMPLEX *mean,
+        SUFLOAT *rms,
+        KahanState const &state);
+
+    static void kahanDiscard(
+        SUCOMPLEX *mean,
+        SUFLOAT *rms,
+        const SUCOMPLEX *data,
+        SUSCOUNT length,
+        KahanState *state);
+
     static void calcLimits(
         SUCOMPLEX *oMin,
         SUCOMPLEX *oMax,
@@ -26,7 +26,7 @@
 #define SUWIDGETS_VERSION_MINOR 3
 #define SUWIDGETS_VERSION_PATCH 0
 
-#define SUWIDGETS_ABI_VERSION   2
+#define SUWIDGETS_ABI_VERSION   3
 
 #define SUWIDGETS_VERSION \
   SU_VER(SUWIDGETS_VERSION_MAJOR, SUWIDGETS_VERSION_MINOR, SUWIDGETS_VERSION_PATCH)
@@ -0,0 +1,520 @@
+//
+//    WaveEyeDiagram.cpp: Persistence accumulation of periodic waveforms
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#include "WaveEyeDiagram.h"
+#include "WaveRasterizer.h"
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <cmath>
+#include <memory>
+#include <sigutils/util/compat-time.h>
+
+#define WAVE_EYE_PIECE_LENGTH    65536
+#define WAVE_EYE_FEEDBACK_MS     40  // Partial diagrams are drawn
+#define WAVE_EYE_BAND_MIN_WIDTH  128 // Narrower bands are not worth a thread
+
+//
+// Pieces are folded in parallel, each thread taking care of a band of
+// columns of the raster. Bands never share bins, and most segments span
+// several columns (the raster is much finer than the sampling), so work
+// is evenly spread without the need of merging partial rasters.
+//
+class WaveEyeBandTask : public QRunnable {
+  WaveEyeDiagram *m_owner;
+  SUSCOUNT        m_start;
+  SUSCOUNT        m_end;
+  int             m_c0;
+  int             m_c1;
+  QSemaphore     *m_done;
+
+public:
+  quint32         maxCount = 0;
+
+  WaveEyeBandTask(
+      WaveEyeDiagram *owner,
+      SUSCOUNT start,
+      SUSCOUNT end,
+      int c0,
+      int c1,
+      QSemaphore *done) :
+    m_owner(owner),
+    m_start(start),
+    m_end(end),
+    m_c0(c0),
+    m_c1(c1),
+    m_done(done)
+  {
+    setAutoDelete(false);
+  }
+
+  void
+  run(void) override
+  {
+    maxCount = m_owner->foldBand(m_start, m_end, m_c0, m_c1);
+    m_done->release();
+  }
+};
+
+///////////////////////////////// WaveEyeWorker ////////////////////////////////
+WaveEyeWorker::WaveEyeWorker(WaveEyeDiagram *owner, QObject *parent) :
+  QObject(parent),
+  m_owner(owner)
+{
+}
+
+void
+WaveEyeWorker::run(void)
+{
+  struct timeval tv, otv, diff;
+  SUSDIFF time_ms;
+
+  gettimeofday(&otv, nullptr);
+
+  while (m_owner->foldPiece()) {
+    gettimeofday(&tv, nullptr);
+    timersub(&tv, &otv, &diff);
+
+    time_ms = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+
+    if (time_ms > WAVE_EYE_FEEDBACK_MS) {
+      otv = tv;
+      emit progress();
+    }
+  }
+
+  emit progress();
+}
+
+//////////////////////////////// WaveEyeDiagram ////////////////////////////////
+WaveEyeDiagram::WaveEyeDiagram(QObject *parent) : QObject(parent)
+{
+  m_workerThread = new QThread(this);
+  m_worker = new WaveEyeWorker(this);
+
+  m_worker->moveToThread(m_workerThread);
+
+  connect(this, SIGNAL(triggerWorker()), m_worker, SLOT(run()));
+  connect(m_worker, SIGNAL(progress()), this, SIGNAL(progress()));
+
+  m_workerThread->start();
+}
+
+WaveEyeDiagram::~WaveEyeDiagram()
+{
+  // The worker stops after the current piece
+  safeCancel();
+
+  m_workerThread->quit();
+  m_workerThread->wait();
+
+  delete m_worker;
+}
+
+//
+// Called with the mutex held. The worker notices the new generation and
+// starts its raster over.
+//
+void
+WaveEyeDiagram::reset(void)
+{
+  m_folded   = 0;
+  m_maxCount = 0;
+  ++m_generation;
+
+  if (m_enabled && m_params.isValid())
+    m_counts.assign(
+          SCAST(size_t, m_params.columns) * SCAST(size_t, m_params.rows),
+          0);
+  else
+    std::vector<quint32>().swap(m_counts);
+}
+
+// Called with the mutex held
+void
+WaveEyeDiagram::trigger(void)
+{
+  if (m_running
+      || !m_enabled
+      || m_data.isNull()
+      || !m_params.isValid()
+      || m_folded >= m_length)
+    return;
+
+  m_running = true;
+  emit triggerWorker();
+}
+
+//
+// Adds one to every bin the segment from (x0, y0) to (x1, y1) goes through
+// (in raster units, x0 <= x1), once per column. Only columns in [c0, c1)
+// are touched. Returns the largest count reached.
+//
+quint32
+WaveEyeDiagram::trace(
+    qreal x0,
+    qreal y0,
+    qreal x1,
+    qreal y1,
+    int c0,
+    int c1)
+{
+  int columns = m_foldParams.columns;
+  int rows    = m_foldParams.rows;
+  int first   = MAX(SCAST(int, std::floor(x0)), c0);
+  int last    = MIN(SCAST(int, std::floor(x1)), c1 - 1);
+  qreal slope = x1 > x0 ? (y1 - y0) / (x1 - x0) : 0;
+  quint32 maxCount = 0;
+
+  for (int c = first; c <= last; ++c) {
+    qreal xa = MAX(x0, SCAST(qreal, c));
+    qreal xb = MIN(x1, SCAST(qreal, c + 1));
+    qreal ya = x1 > x0 ? y0 + (xa - x0) * slope : y0;
+    qreal yb = x1 > x0 ? y0 + (xb - x0) * slope : y1;
+    int ra = SCAST(int, std::floor(MIN(ya, yb)));
+    int rb = SCAST(int, std::floor(MAX(ya, yb)));
+    quint32 *bin;
+
+    if (rb < 0 || ra >= rows)
+      continue;
+
+    ra = MAX(ra, 0);
+    rb = MIN(rb, rows - 1);
+
+    bin = m_foldCounts.data()
+        + SCAST(size_t, ra) * SCAST(size_t, columns)
+        + c;
+
+    for (int r = ra; r <= rb; ++r, bin += columns)
+      if (++*bin > maxCount)
+        maxCount = *bin;
+  }
+
+  return maxCount;
+}
+
+//
+// Folds samples in [start, end) into the columns in [c0, c1). Every segment
+// between consecutive samples is traced in all the traces it falls in
+// (clipped to them). Returns the largest count reached.
+//
+quint32
+WaveEyeDiagram::foldBand(SUSCOUNT start, SUSCOUNT end, int c0, int c1)
+{
+  WaveEyeParams const &p = m_foldParams;
+  qreal spanLen = p.span * p.period;
+  qreal xScale  = p.columns / spanLen;
+  qreal yScale  = p.rows / (p.max - p.min);
+  qreal xMin    = SCAST(qreal, c0);
+  qreal xMax    = SCAST(qreal, c1);
+  quint32 maxCount = 0;
+
+  for (SUSCOUNT n = MAX(start, 1); n < end; ++n) {
+    SUCOMPLEX z0 = m_foldData[n - 1];
+    SUCOMPLEX z1 = m_foldData[n];
+    qreal v0 = p.realComponent ? SU_C_REAL(z0) : SU_C_IMAG(z0);
+    qreal v1 = p.realComponent ? SU_C_REAL(z1) : SU_C_IMAG(z1);
+    qreal y0 = (p.max - v0) * yScale;
+    qreal y1 = (p.max - v1) * yScale;
+    qreal r  = SCAST(qreal, n) - p.origin;
+    qreal k  = std::floor(r / p.period);
+
+    // Offsets of the segment grow with j: the last trace is the one
+    // that starts before n - 1
+    for (int j = 0; j <= p.span; ++j) {
+      qreal o1 = r - (k - j) * p.period;
+      qreal o0 = o1 - 1;
+      qreal t0, t1, xa, xb;
+      quint32 count;
+
+      if (o0 >= spanLen)
+        break;
+
+      t0 = o0 < 0 ? -o0 : 0;
+      t1 = o1 > spanLen ? 1 - (o1 - spanLen) : 1;
+      xa = (o0 + t0) * xScale;
+      xb = (o0 + t1) * xScale;
+
+      if (xb < xMin || xa >= xMax)
+        continue;
+
+      count = trace(
+            xa,
+            y0 + (y1 - y0) * t0,
+            xb,
+            y0 + (y1 - y0) * t1,
+            c0,
+            c1);
+
+      if (count > maxCount)
+        maxCount = count;
+    }
+  }
+
+  return maxCount;
+}
+
+//
+// Folds the next piece of the buffer into the raster of the worker, in
+// parallel if it is wide enough, and publishes it. The state of the owner
+// is only locked to take a snapshot of it and to publish the result.
+// Returns false if there was nothing to do.
+//
+bool
+WaveEyeDiagram::foldPiece(void)
+{
+  std::vector<std::unique_ptr<WaveEyeBandTask>> tasks;
+  QMutexLocker dataLocker(&m_dataMutex);
+  QThreadPool *pool = QThreadPool::globalInstance();
+  QSemaphore done;
+  SUSCOUNT start, end;
+  size_t size;
+  int columns;
+  int bands, bandWidth;
+  quint32 maxCount;
+
+  m_mutex.lock();
+
+  if (!m_enabled
+      || m_data.isNull()
+      || !m_params.isValid()
+      || m_folded >= m_length) {
+    m_running = false;
+    m_mutex.unlock();
+
+    // Nothing to accumulate into anymore
+    if (!m_enabled || !m_params.isValid())
+      std::vector<quint32>().swap(m_foldCounts);
+
+    return false;
+  }
+
+  start = m_folded;
+  end   = MIN(m_folded + WAVE_EYE_PIECE_LENGTH, m_length);
+
+  if (m_foldGeneration != m_generation) {
+    m_foldGeneration = m_generation;
+    m_foldMaxCount   = 0;
+    m_foldCounts.clear();
+  }
+
+  m_foldParams = m_params;
+  m_foldData   = m_data;
+
+  m_mutex.unlock();
+
+  columns = m_foldParams.columns;
+  size    = SCAST(size_t, columns) * SCAST(size_t, m_foldParams.rows);
+
+  if (m_foldCounts.size() != size)
+    m_foldCounts.assign(size, 0);
+
+  bands = qBound(1, columns / WAVE_EYE_BAND_MIN_WIDTH, pool->maxThreadCount());
+  bandWidth = (columns + bands - 1) / bands;
+
+  for (int c = bandWidth; c < columns; c += bandWidth)
+    tasks.push_back(
+          std::unique_ptr<WaveEyeBandTask>(
+            new WaveEyeBandTask(
+              this,
+              start,
+              end,
+              c,
+              MIN(c + bandWidth, columns),
+              &done)));
+
+  for (auto &task : tasks)
+    pool->start(task.get());
+
+  maxCount = foldBand(start, end, 0, bandWidth);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+  for (auto &task : tasks)
+    if (pool->tryTake(task.get()))
+      task->run();
+#endif // QT_VERSION_CHECK
+
+  done.acquire(SCAST(int, tasks.size()));
+
+  for (auto &task : tasks)
+    maxCount = MAX(maxCount, task->maxCount);
+
+  m_foldMaxCount = MAX(m_foldMaxCount, maxCount);
+
+  // If the folding changed in the meantime, the next piece starts over
+  m_mutex.lock();
+
+  if (m_generation == m_foldGeneration) {
+    m_counts   = m_foldCounts;
+    m_maxCount = m_foldMaxCount;
+    m_folded   = end;
+  }
+
+  m_mutex.unlock();
+
+  return true;
+}
+
+void
+WaveEyeDiagram::setEnabled(bool enabled)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (enabled == m_enabled)
+    return;
+
+  m_enabled = enabled;
+  reset();
+  trigger();
+}
+
+// Accumulation starts over if the folding changes
+void
+WaveEyeDiagram::setParams(WaveEyeParams const &params)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (params == m_params)
+    return;
+
+  m_params = params;
+  reset();
+  trigger();
+}
+
+void
+WaveEyeDiagram::setBuffer(WaveSamples const &data, SUSCOUNT length)
+{
+  QMutexLocker dataLocker(&m_dataMutex);
+  QMutexLocker locker(&m_mutex);
+
+  m_data   = data;
+  m_length = length;
+  reset();
+  trigger();
+}
+
+//
+// Same contents, possibly longer (and possibly somewhere else). Only the
+// new samples are folded.
+//
+void
+WaveEyeDiagram::extendBuffer(WaveSamples const &data, SUSCOUNT length)
+{
+  QMutexLocker dataLocker(&m_dataMutex);
+  QMutexLocker locker(&m_mutex);
+
+  if (length < m_folded)
+    reset();
+
+  m_data   = data;
+  m_length = length;
+  trigger();
+}
+
+//
+// The first count samples of the buffer are about to be dropped. What was
+// folded so far stays, and the folding goes on once the buffer is handed
+// back through extendBuffer().
+//
+void
+WaveEyeDiagram::discard(SUSCOUNT count)
+{
+  QMutexLocker dataLocker(&m_dataMutex);
+  QMutexLocker locker(&m_mutex);
+
+  m_data    = WaveSamples();
+  m_length  = count < m_length ? m_length - count : 0;
+  m_folded  = count < m_folded ? m_folded - count : 0;
+  m_params.origin -= SCAST(qreal, count);
+}
+
+// The buffer is about to move (or go away). Folding pauses until then.
+void
+WaveEyeDiagram::safeCancel(void)
+{
+  QMutexLocker dataLocker(&m_dataMutex);
+  QMutexLocker locker(&m_mutex);
+
+  m_data = WaveSamples();
+}
+
+bool
+WaveEyeDiagram::isEnabled(void)
+{
+  QMutexLocker locker(&m_mutex);
+
+  return m_enabled;
+}
+
+qreal
+WaveEyeDiagram::getProgress(void)
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (m_length == 0)
+    return 1;
+
+  return SCAST(qreal, m_folded) / SCAST(qreal, m_length);
+}
+
+//
+// Paints the diagram as the given color, with an opacity proportional to
+// the logarithm of the hit count of each bin (one pixel per bin).
+//
+bool
+WaveEyeDiagram::render(QImage &image, QColor const &color)
+{
+  QMutexLocker locker(&m_mutex);
+  QRgb palette[256];
+  QRgb *line;
+  const quint32 *bin;
+  qreal k;
+
+  if (!m_enabled || m_counts.empty() || m_maxCount == 0)
+    return false;
+
+  if (image.width() != m_params.columns
+      || image.height() != m_params.rows
+      || image.format() != QImage::Format_ARGB32_Premultiplied)
+    image = QImage(
+          m_params.columns,
+          m_params.rows,
+          QImage::Format_ARGB32_Premultiplied);
+
+  for (int i = 0; i < 256; ++i)
+    palette[i] = WaveRasterizer::pixel(color, i / 255.);
+
+  k   = 255. / std::log1p(SCAST(qreal, m_maxCount));
+  bin = m_counts.data();
+
+  for (int r = 0; r < m_params.rows; ++r) {
+    line = RCAST(QRgb *, image.scanLine(r));
+
+    for (int c = 0; c < m_params.columns; ++c, ++bin)
+      line[c] = *bin == 0
+          ? 0
+          : palette[qBound(
+              1,
+              SCAST(int, k * std::log1p(SCAST(qreal, *bin))),
+              255)];
+  }
+
+  return true;
+}
@@ -0,0 +1,161 @@
+//
+//    WaveEyeDiagram.h: Persistence accumulation of periodic waveforms
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVEEYEDIAGRAM_H
+#define WAVEEYEDIAGRAM_H
+
+#include <QObject>
+#include <QMutex>
+#include <QImage>
+#include <QColor>
+#include <QThread>
+#include <sigutils/types.h>
+#include <vector>
+
+#include "SuWidgetsHelpers.h"
+#include "WaveSamples.h"
+
+// Resolution of the hit-count raster (traces are stretched to the screen)
+#define WAVE_EYE_DEFAULT_COLUMNS 1024
+#define WAVE_EYE_DEFAULT_ROWS    512
+
+//
+// How the waveform is folded. Traces start every period samples (from the
+// origin on, and before it too) and are span periods long. Rows cover the
+// range [min, max] of the selected component.
+//
+struct WaveEyeParams {
+  qreal origin = 0;
+  qreal period = 0;
+  int   span = 1;
+  qreal min = -1;
+  qreal max = +1;
+  bool  realComponent = true;
+  int   columns = WAVE_EYE_DEFAULT_COLUMNS;
+  int   rows = WAVE_EYE_DEFAULT_ROWS;
+
+  inline bool
+  isValid(void) const
+  {
+    return period >= 1 && span > 0 && max > min && columns > 0 && rows > 0;
+  }
+
+  inline bool
+  operator==(WaveEyeParams const &other) const
+  {
+    return origin == other.origin
+        && period == other.period
+        && span == other.span
+        && min == other.min
+        && max == other.max
+        && realComponent == other.realComponent
+        && columns == other.columns
+        && rows == other.rows;
+  }
+};
+
+class WaveEyeDiagram;
+
+class WaveEyeWorker : public QObject {
+  Q_OBJECT
+
+  WaveEyeDiagram *m_owner = nullptr;
+
+public:
+  WaveEyeWorker(WaveEyeDiagram *owner, QObject *parent = nullptr);
+
+public slots:
+  void run(void);
+
+signals:
+  void progress(void);
+};
+
+//
+// Eye diagram (persistence) of a waveform. Every trace is accumulated into
+// a 2D raster of hit counts, which is displayed with log intensity. Folding
+// runs in a thread of its own, a piece of the buffer at a time, and it is
+// incremental: samples appended to the buffer are folded on top of the
+// accumulated ones, and dropping samples from its front keeps them.
+//
+// Pieces are folded into a raster of the worker, which is published when
+// each piece is done. State shared with the owner is behind m_mutex, which
+// is only held for short periods: painting (and changing the folding)
+// never waits for a piece to be folded. Pieces started before a reset are
+// simply thrown away. The buffer itself is behind m_dataMutex, which the
+// worker holds while it reads samples: the owner only needs to take it to
+// move the buffer elsewhere (or forget it).
+//
+class WaveEyeDiagram : public QObject {
+  Q_OBJECT
+
+  QThread         *m_workerThread = nullptr;
+  WaveEyeWorker   *m_worker = nullptr;
+
+  // Taken before m_mutex, while the buffer is read (or moved)
+  QMutex           m_dataMutex;
+
+  // Everything below is protected by m_mutex
+  QMutex           m_mutex;
+  bool             m_running = false; // Worker run requested or running
+  bool             m_enabled = false;
+  WaveEyeParams    m_params;
+  WaveSamples      m_data;
+  SUSCOUNT         m_length = 0;
+  SUSCOUNT         m_folded = 0;      // Samples accumulated so far
+  quint64          m_generation = 0;  // Incremented on every reset
+  std::vector<quint32> m_counts;
+  quint32          m_maxCount = 0;
+
+  // Only touched by the worker (and its band tasks)
+  WaveEyeParams    m_foldParams;
+  WaveSamples      m_foldData;
+  quint64          m_foldGeneration = 0;
+  std::vector<quint32> m_foldCounts;
+  quint32          m_foldMaxCount = 0;
+
+  friend class WaveEyeWorker;
+  friend class WaveEyeBandTask;
+
+  void reset(void);
+  void trigger(void);
+  bool foldPiece(void);
+  quint32 foldBand(SUSCOUNT start, SUSCOUNT end, int c0, int c1);
+  quint32 trace(qreal x0, qreal y0, qreal x1, qreal y1, int c0, int c1);
+
+public:
+  WaveEyeDiagram(QObject *parent = nullptr);
+  ~WaveEyeDiagram() override;
+
+  void setEnabled(bool enabled);
+  void setParams(WaveEyeParams const &params);
+  void setBuffer(WaveSamples const &data, SUSCOUNT length);
+  void extendBuffer(WaveSamples const &data, SUSCOUNT length);
+  void discard(SUSCOUNT count);
+  void safeCancel(void);
+
+  bool isEnabled(void);
+  qreal getProgress(void);
+  bool render(QImage &image, QColor const &color);
+
+signals:
+  void triggerWorker(void);
+  void progress(void);
+};
+
+#endif // WAVEEYEDIAGRAM_H
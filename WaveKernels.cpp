@@ -0,0 +1,859 @@
+//
+//    WaveKernels.cpp: Vectorized inner loops of the waveform tree
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveKernels.h"
+#include <cfloat>
+#include <cmath>
+
+#if defined(_SU_SINGLE_PRECISION) && defined(__SSE2__)
+#  define WAVE_KERNELS_SSE2
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define WAVE_KERNELS_AVX2
+#    include <immintrin.h>
+#  endif // __GNUC__
+#endif // _SU_SINGLE_PRECISION && __SSE2__
+
+// Polynomial approximation of atan(x) in [0, 1] (A&S 4.4.49, |e| < 1e-5)
+#define WAVE_KERNELS_ATAN_C1 +0.9998660f
+#define WAVE_KERNELS_ATAN_C3 -0.3302995f
+#define WAVE_KERNELS_ATAN_C5 +0.1801410f
+#define WAVE_KERNELS_ATAN_C7 -0.0851330f
+#define WAVE_KERNELS_ATAN_C9 +0.0208351f
+
+////////////////////////////// Scalar kernels //////////////////////////////////
+void
+WaveKernels::calcLimitsBlockScalar(
+    WaveLimits &thisLimit,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len,
+    SUFLOAT wEnd)
+{
+  //
+  // wEnd is a last-block completeness factor (or weight). Can be
+  // from 1 / BLOCK_LENGTH to 1.
+  //
+
+  if (len > 0) {
+    const SUCOMPLEX *__restrict min  = data.minData() + offset;
+    const SUCOMPLEX *__restrict max  = data.maxData() + offset;
+    const SUCOMPLEX *__restrict mean = data.meanData() + offset;
+    const SUFLOAT   *__restrict env  = data.envelopeData() + offset;
+    const SUFLOAT   *__restrict freq = data.freqData() + offset;
+    SUFLOAT kInv   = 1.f / (SU_ASFLOAT(len) + wEnd - 1);
+
+    if (!thisLimit.isInitialized()) {
+      thisLimit.min = min[0];
+      thisLimit.max = max[0];
+    }
+
+    for (SUSCOUNT j = 0; j < len; ++j) {
+      if (max[j].real() > thisLimit.max.real())
+        thisLimit.max = max[j].real() + thisLimit.max.imag() * SU_I;
+      if (max[j].imag() > thisLimit.max.imag())
+        thisLimit.max = thisLimit.max.real() + max[j].imag() * SU_I;
+
+      if (min[j].real() < thisLimit.min.real())
+        thisLimit.min = min[j].real() + thisLimit.min.imag() * SU_I;
+      if (min[j].imag() < thisLimit.min.imag())
+        thisLimit.min = thisLimit.min.real() + min[j].imag() * SU_I;
+
+      if (thisLimit.envelope < env[j])
+        thisLimit.envelope = env[j];
+
+      if (j == len - 1) {
+        thisLimit.mean += wEnd * mean[j];
+        thisLimit.freq += wEnd * freq[j];
+      } else {
+        thisLimit.mean += mean[j];
+        thisLimit.freq += freq[j];
+      }
+    }
+
+    // Compute mean, mean frequency and finish
+    thisLimit.mean *= kInv;
+    thisLimit.freq *= kInv;
+  }
+}
+
+void
+WaveKernels::calcLimitsBlockCompact(
+    WaveLimits &thisLimit,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len,
+    SUFLOAT wEnd)
+{
+  if (len > 0) {
+    SUFLOAT kInv = 1.f / (SU_ASFLOAT(len) + wEnd - 1);
+    SUCOMPLEX min, max;
+    SUFLOAT env;
+
+    if (!thisLimit.isInitialized()) {
+      thisLimit.min = data.minAt(offset);
+      thisLimit.max = data.maxAt(offset);
+    }
+
+    for (size_t j = offset; j < offset + len; ++j) {
+      min = data.minAt(j);
+      max = data.maxAt(j);
+      env = data.envelopeAt(j);
+
+      thisLimit.min = MIN(min.real(), thisLimit.min.real())
+          + MIN(min.imag(), thisLimit.min.imag()) * SU_I;
+      thisLimit.max = MAX(max.real(), thisLimit.max.real())
+          + MAX(max.imag(), thisLimit.max.imag()) * SU_I;
+
+      if (thisLimit.envelope < env)
+        thisLimit.envelope = env;
+
+      if (j == offset + len - 1) {
+        thisLimit.mean += wEnd * data.meanAt(j);
+        thisLimit.freq += wEnd * data.freqAt(j);
+      } else {
+        thisLimit.mean += data.meanAt(j);
+        thisLimit.freq += data.freqAt(j);
+      }
+    }
+
+    thisLimit.mean *= kInv;
+    thisLimit.freq *= kInv;
+  }
+}
+
+void
+WaveKernels::calcLimitsBufScalar(
+    WaveLimits &thisLimit,
+    const SUCOMPLEX *__restrict data,
+    size_t len,
+    bool first)
+{
+  if (len > 0) {
+    SUFLOAT env2  = 0;
+    SUFLOAT kInv  = 1.f / SU_ASFLOAT(len);
+
+    thisLimit.envelope *= thisLimit.envelope;
+
+    if (!thisLimit.isInitialized()) {
+      thisLimit.min = data[0];
+      thisLimit.max = data[0];
+    }
+
+    for (SUSCOUNT j = 0; j < len; ++j) {
+      if (data[j].real() > thisLimit.max.real())
+        thisLimit.max = data[j].real() + thisLimit.max.imag() * SU_I;
+      if (data[j].imag() > thisLimit.max.imag())
+        thisLimit.max = thisLimit.max.real() + data[j].imag() * SU_I;
+
+      if (data[j].real() < thisLimit.min.real())
+        thisLimit.min = data[j].real() + thisLimit.min.imag() * SU_I;
+      if (data[j].imag() < thisLimit.min.imag())
+        thisLimit.min = thisLimit.min.real() + data[j].imag() * SU_I;
+
+      env2 = SU_C_REAL(data[j] * SU_C_CONJ(data[j]));
+      if (thisLimit.envelope < env2)
+        thisLimit.envelope = env2;
+
+      if (!first)
+        thisLimit.freq += SU_C_ARG(data[j] * SU_C_CONJ(data[j - 1]));
+
+      thisLimit.mean += data[j];
+    }
+
+    thisLimit.freq *= kInv;
+    thisLimit.mean *= kInv;
+    thisLimit.envelope = sqrt(thisLimit.envelope);
+  }
+}
+
+static inline SUFLOAT
+levelValue(SUCOMPLEX x, enum WaveSearchComponent component)
+{
+  switch (component) {
+    case WAVE_SEARCH_REAL:
+      return SU_C_REAL(x);
+
+    case WAVE_SEARCH_IMAG:
+      return SU_C_IMAG(x);
+
+    default:
+      return SU_C_ABS(x);
+  }
+}
+
+size_t
+WaveKernels::findLevelScalar(
+    const SUCOMPLEX *__restrict data,
+    size_t len,
+    enum WaveSearchComponent component,
+    bool slope,
+    bool above,
+    SUFLOAT level)
+{
+  SUFLOAT prev = 0, curr;
+
+  for (size_t j = 0; j < len; ++j) {
+    curr = levelValue(data[j], component);
+
+    if (slope) {
+      SUFLOAT diff = curr - prev;
+
+      prev = curr;
+      if (j == 0)
+        continue;
+
+      curr = diff;
+    }
+
+    if ((curr >= level) == above)
+      return j;
+  }
+
+  return len;
+}
+
+#ifdef WAVE_KERNELS_SSE2
+/////////////////////////////// SSE2 kernels ///////////////////////////////////
+//
+// Complex samples are processed in pairs: (re0, im0, re1, im1). Min, max
+// and mean accumulators keep real and imaginary parts in alternate lanes,
+// and are only reduced at the very end. New values always go first in
+// min / max: these return the second operand if any of them is NaN, so
+// NaN samples are skipped like the comparisons of the scalar kernels do.
+//
+
+#define WAVE_KERNELS_SWAP_PAIRS _MM_SHUFFLE(2, 3, 0, 1)
+
+static inline float
+fastArg(float re, float im)
+{
+  float ax = std::fabs(re);
+  float ay = std::fabs(im);
+  float mx = ax > ay ? ax : ay;
+  float mn = ax > ay ? ay : ax;
+  float a  = mn / (mx > FLT_MIN ? mx : FLT_MIN);
+  float s  = a * a;
+  float r  =
+      ((((WAVE_KERNELS_ATAN_C9 * s + WAVE_KERNELS_ATAN_C7) * s
+        + WAVE_KERNELS_ATAN_C5) * s
+        + WAVE_KERNELS_ATAN_C3) * s
+        + WAVE_KERNELS_ATAN_C1) * a;
+
+  if (ay > ax)
+    r = SU_ASFLOAT(PI / 2) - r;
+  if (std::signbit(re))
+    r = SU_ASFLOAT(PI) - r;
+
+  return std::copysign(r, im);
+}
+
+static inline __m128
+fastAtan2SSE2(__m128 y, __m128 x)
+{
+  const __m128 signMask = _mm_set1_ps(-0.f);
+  __m128 ax = _mm_andnot_ps(signMask, x);
+  __m128 ay = _mm_andnot_ps(signMask, y);
+  __m128 mx = _mm_max_ps(ax, ay);
+  __m128 mn = _mm_min_ps(ax, ay);
+  __m128 a  = _mm_div_ps(mn, _mm_max_ps(mx, _mm_set1_ps(FLT_MIN)));
+  __m128 s  = _mm_mul_ps(a, a);
+  __m128 r, m;
+
+  r = _mm_add_ps(
+        _mm_mul_ps(_mm_set1_ps(WAVE_KERNELS_ATAN_C9), s),
+        _mm_set1_ps(WAVE_KERNELS_ATAN_C7));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(WAVE_KERNELS_ATAN_C5));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(WAVE_KERNELS_ATAN_C3));
+  r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(WAVE_KERNELS_ATAN_C1));
+  r = _mm_mul_ps(r, a);
+
+  // |y| > |x|: r = pi / 2 - r
+  m = _mm_cmpgt_ps(ay, ax);
+  r = _mm_or_ps(
+        _mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(SU_ASFLOAT(PI / 2)), r)),
+        _mm_andnot_ps(m, r));
+
+  // x < 0 (including -0, as atan2 does): r = pi - r
+  m = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x), 31));
+  r = _mm_or_ps(
+        _mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(SU_ASFLOAT(PI)), r)),
+        _mm_andnot_ps(m, r));
+
+  // r is non-negative here, copy the sign of y
+  return _mm_or_ps(r, _mm_and_ps(y, signMask));
+}
+
+// Phase difference between x and its previous sample p, in lanes 0 and 2
+static inline __m128
+phaseDiffSSE2(__m128 x, __m128 p)
+{
+  const __m128 evenMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, 0, -1));
+  __m128 t1 = _mm_mul_ps(x, p);
+  __m128 t2 = _mm_mul_ps(x, _mm_shuffle_ps(p, p, WAVE_KERNELS_SWAP_PAIRS));
+  __m128 re = _mm_add_ps(t1, _mm_shuffle_ps(t1, t1, WAVE_KERNELS_SWAP_PAIRS));
+  __m128 im = _mm_sub_ps(_mm_shuffle_ps(t2, t2, WAVE_KERNELS_SWAP_PAIRS), t2);
+
+  return _mm_and_ps(fastAtan2SSE2(im, re), evenMask);
+}
+
+struct WaveKernelAccum {
+  __m128 min;
+  __m128 max;
+  __m128 sum;
+  __m128 env2;
+  __m128 freq;
+};
+
+static inline void
+accumInitSSE2(WaveKernelAccum &acc)
+{
+  acc.min  = _mm_set1_ps(+INFINITY);
+  acc.max  = _mm_set1_ps(-INFINITY);
+  acc.sum  = _mm_setzero_ps();
+  acc.env2 = _mm_setzero_ps();
+  acc.freq = _mm_setzero_ps();
+}
+
+static inline void
+accumPairSSE2(
+    WaveKernelAccum &acc,
+    const float *__restrict f,
+    bool first)
+{
+  __m128 x  = _mm_loadu_ps(f);
+  __m128 sq = _mm_mul_ps(x, x);
+
+  acc.min  = _mm_min_ps(x, acc.min);
+  acc.max  = _mm_max_ps(x, acc.max);
+  acc.sum  = _mm_add_ps(acc.sum, x);
+  acc.env2 = _mm_max_ps(
+        _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, WAVE_KERNELS_SWAP_PAIRS)),
+        acc.env2);
+
+  if (!first)
+    acc.freq = _mm_add_ps(acc.freq, phaseDiffSSE2(x, _mm_loadu_ps(f - 2)));
+}
+
+static inline void
+accumFinishSSE2(
+    WaveLimits &thisLimit,
+    WaveKernelAccum &acc,
+    const SUCOMPLEX *__restrict data,
+    size_t j,
+    size_t len,
+    bool first)
+{
+  float lanes[4];
+  float minRe, minIm, maxRe, maxIm;
+  float sumRe, sumIm;
+  float env2, freq;
+  SUFLOAT kInv = 1.f / SU_ASFLOAT(len);
+
+  // Fold odd and even lanes
+  __m128 min = _mm_min_ps(acc.min, _mm_movehl_ps(acc.min, acc.min));
+  __m128 max = _mm_max_ps(acc.max, _mm_movehl_ps(acc.max, acc.max));
+  __m128 sum = _mm_add_ps(acc.sum, _mm_movehl_ps(acc.sum, acc.sum));
+  __m128 e2  = _mm_max_ps(acc.env2, _mm_movehl_ps(acc.env2, acc.env2));
+  __m128 fr  = _mm_add_ps(acc.freq, _mm_movehl_ps(acc.freq, acc.freq));
+
+  _mm_storeu_ps(lanes, min);
+  minRe = lanes[0];
+  minIm = lanes[1];
+
+  _mm_storeu_ps(lanes, max);
+  maxRe = lanes[0];
+  maxIm = lanes[1];
+
+  _mm_storeu_ps(lanes, sum);
+  sumRe = lanes[0];
+  sumIm = lanes[1];
+
+  _mm_storeu_ps(lanes, e2);
+  env2 = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+
+  _mm_storeu_ps(lanes, fr);
+  freq = lanes[0];
+
+  // Odd tail
+  for (; j < len; ++j) {
+    float re = SU_C_REAL(data[j]);
+    float im = SU_C_IMAG(data[j]);
+    float e  = re * re + im * im;
+
+    if (re < minRe)
+      minRe = re;
+    if (im < minIm)
+      minIm = im;
+    if (re > maxRe)
+      maxRe = re;
+    if (im > maxIm)
+      maxIm = im;
+    if (e > env2)
+      env2 = e;
+
+    sumRe += re;
+    sumIm += im;
+
+    if (!first) {
+      SUCOMPLEX d = data[j] * SU_C_CONJ(data[j - 1]);
+      freq += fastArg(SU_C_REAL(d), SU_C_IMAG(d));
+    }
+  }
+
+  // Merge with the previous state of the limits
+  if (thisLimit.isInitialized()) {
+    if (SU_C_REAL(thisLimit.min) < minRe)
+      minRe = SU_C_REAL(thisLimit.min);
+    if (SU_C_IMAG(thisLimit.min) < minIm)
+      minIm = SU_C_IMAG(thisLimit.min);
+    if (SU_C_REAL(thisLimit.max) > maxRe)
+      maxRe = SU_C_REAL(thisLimit.max);
+    if (SU_C_IMAG(thisLimit.max) > maxIm)
+      maxIm = SU_C_IMAG(thisLimit.max);
+  }
+
+  if (thisLimit.envelope * thisLimit.envelope > env2)
+    env2 = thisLimit.envelope * thisLimit.envelope;
+
+  thisLimit.min      = SUCOMPLEX(minRe, minIm);
+  thisLimit.max      = SUCOMPLEX(maxRe, maxIm);
+  thisLimit.envelope = sqrt(env2);
+  thisLimit.mean     = (thisLimit.mean + SUCOMPLEX(sumRe, sumIm)) * kInv;
+  thisLimit.freq     = (thisLimit.freq + freq) * kInv;
+}
+
+static void
+calcLimitsBufSSE2(
+    WaveLimits &thisLimit,
+    const SUCOMPLEX *__restrict data,
+    size_t len,
+    bool first)
+{
+  const float *f = reinterpret_cast<const float *>(data);
+  WaveKernelAccum acc;
+  size_t j = 0;
+
+  if (len == 0)
+    return;
+
+  accumInitSSE2(acc);
+
+  for (; j + 2 <= len; j += 2)
+    accumPairSSE2(acc, f + 2 * j, first);
+
+  accumFinishSSE2(thisLimit, acc, data, j, len, first);
+}
+
+//
+// With the structure-of-arrays layout, two complex min / max / mean values
+// fit in a SSE register and four envelopes / frequencies can be processed
+// at once. The last element is weighted separately.
+//
+static void
+calcLimitsBlockSSE2(
+    WaveLimits &thisLimit,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len,
+    SUFLOAT wEnd)
+{
+  const float *__restrict minp  =
+      reinterpret_cast<const float *>(data.minData() + offset);
+  const float *__restrict maxp  =
+      reinterpret_cast<const float *>(data.maxData() + offset);
+  const float *__restrict meanp =
+      reinterpret_cast<const float *>(data.meanData() + offset);
+  const float *__restrict envp  = data.envelopeData() + offset;
+  const float *__restrict freqp = data.freqData() + offset;
+  __m128 min, max, mean, env, freq, w;
+  float lanes[4];
+  size_t j, full;
+  SUFLOAT kInv;
+
+  if (len == 0)
+    return;
+
+  kInv = 1.f / (SU_ASFLOAT(len) + wEnd - 1);
+  full = len - 1;
+
+  // Non-initialized limits may hold NaNs (INFINITY * SU_I), start from inf
+  if (thisLimit.isInitialized()) {
+    min = _mm_castpd_ps(
+          _mm_load1_pd(reinterpret_cast<const double *>(&thisLimit.min)));
+    max = _mm_castpd_ps(
+          _mm_load1_pd(reinterpret_cast<const double *>(&thisLimit.max)));
+  } else {
+    min = _mm_set1_ps(+INFINITY);
+    max = _mm_set1_ps(-INFINITY);
+  }
+
+  mean = _mm_setzero_ps();
+  env  = _mm_set1_ps(thisLimit.envelope);
+  freq = _mm_setzero_ps();
+
+  for (j = 0; j + 2 <= full; j += 2) {
+    min  = _mm_min_ps(_mm_loadu_ps(minp  + 2 * j), min);
+    max  = _mm_max_ps(_mm_loadu_ps(maxp  + 2 * j), max);
+    mean = _mm_add_ps(mean, _mm_loadu_ps(meanp + 2 * j));
+  }
+
+  for (; j < len; ++j) {
+    w    = _mm_set1_ps(j == full ? wEnd : 1);
+    min  = _mm_min_ps(_mm_castpd_ps(
+          _mm_load1_pd(reinterpret_cast<const double *>(minp + 2 * j))), min);
+    max  = _mm_max_ps(_mm_castpd_ps(
+          _mm_load1_pd(reinterpret_cast<const double *>(maxp + 2 * j))), max);
+    mean = _mm_add_ps(mean, _mm_mul_ps(w, _mm_castpd_ps(
+          _mm_load_sd(reinterpret_cast<const double *>(meanp + 2 * j)))));
+  }
+
+  for (j = 0; j + 4 <= full; j += 4) {
+    env  = _mm_max_ps(_mm_loadu_ps(envp  + j), env);
+    freq = _mm_add_ps(freq, _mm_loadu_ps(freqp + j));
+  }
+
+  for (; j < len; ++j) {
+    w    = _mm_set_ss(j == full ? wEnd : 1);
+    env  = _mm_max_ps(_mm_load1_ps(envp + j), env);
+    freq = _mm_add_ss(freq, _mm_mul_ss(w, _mm_load_ss(freqp + j)));
+  }
+
+  // Fold the upper halves
+  min  = _mm_min_ps(min,  _mm_movehl_ps(min, min));
+  max  = _mm_max_ps(max,  _mm_movehl_ps(max, max));
+  mean = _mm_add_ps(mean, _mm_movehl_ps(mean, mean));
+  env  = _mm_max_ps(env,  _mm_movehl_ps(env, env));
+  env  = _mm_max_ps(env,  _mm_shuffle_ps(env, env, _MM_SHUFFLE(1, 1, 1, 1)));
+  freq = _mm_add_ps(freq, _mm_movehl_ps(freq, freq));
+  freq = _mm_add_ps(freq, _mm_shuffle_ps(freq, freq, _MM_SHUFFLE(1, 1, 1, 1)));
+
+  _mm_storeu_ps(lanes, min);
+  thisLimit.min = SUCOMPLEX(lanes[0], lanes[1]);
+
+  _mm_storeu_ps(lanes, max);
+  thisLimit.max = SUCOMPLEX(lanes[0], lanes[1]);
+
+  _mm_storeu_ps(lanes, mean);
+  thisLimit.mean = (thisLimit.mean + SUCOMPLEX(lanes[0], lanes[1])) * kInv;
+
+  thisLimit.envelope = _mm_cvtss_f32(env);
+  thisLimit.freq     = (thisLimit.freq + _mm_cvtss_f32(freq)) * kInv;
+}
+
+//
+// Level comparator. Four samples per iteration: the selected component of
+// (re0, im0, re1, im1) and (re2, im2, re3, im3) is gathered in one vector.
+// Magnitudes are computed as sqrt(re^2 + im^2), which may differ from
+// SU_C_ABS in the last bit.
+//
+static inline __m128
+levelValueSSE2(const float *f, enum WaveSearchComponent component)
+{
+  __m128 a  = _mm_loadu_ps(f);
+  __m128 b  = _mm_loadu_ps(f + 4);
+  __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+  switch (component) {
+    case WAVE_SEARCH_REAL:
+      return re;
+
+    case WAVE_SEARCH_IMAG:
+      return im;
+
+    default:
+      return _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+  }
+}
+
+static size_t
+findLevelSSE2(
+    const SUCOMPLEX *__restrict data,
+    size_t len,
+    enum WaveSearchComponent component,
+    bool slope,
+    bool above,
+    SUFLOAT level)
+{
+  const float *f = reinterpret_cast<const float *>(data);
+  const __m128 l = _mm_set1_ps(level);
+  size_t first = slope ? 1 : 0;
+  size_t j = first;
+
+  for (; j + 4 <= len; j += 4) {
+    __m128 v = levelValueSSE2(f + 2 * j, component);
+    int mask;
+
+    if (slope)
+      v = _mm_sub_ps(v, levelValueSSE2(f + 2 * j - 2, component));
+
+    // Not greater or equal, so that NaNs compare like in the scalar kernel
+    mask = _mm_movemask_ps(above ? _mm_cmpge_ps(v, l) : _mm_cmpnge_ps(v, l));
+
+    if (mask != 0) {
+      while (!(mask & 1)) {
+        mask >>= 1;
+        ++j;
+      }
+
+      return j;
+    }
+  }
+
+  // The remaining samples (and the one before them, in slope mode)
+  return j - first + WaveKernels::findLevelScalar(
+        data + j - first,
+        len - j + first,
+        component,
+        slope,
+        above,
+        level);
+}
+
+#endif // WAVE_KERNELS_SSE2
+
+#ifdef WAVE_KERNELS_AVX2
+/////////////////////////////// AVX2 kernels ///////////////////////////////////
+__attribute__((target("avx2,fma"))) static inline __m256
+fastAtan2AVX2(__m256 y, __m256 x)
+{
+  const __m256 signMask = _mm256_set1_ps(-0.f);
+  __m256 ax = _mm256_andnot_ps(signMask, x);
+  __m256 ay = _mm256_andnot_ps(signMask, y);
+  __m256 mx = _mm256_max_ps(ax, ay);
+  __m256 mn = _mm256_min_ps(ax, ay);
+  __m256 a  = _mm256_div_ps(mn, _mm256_max_ps(mx, _mm256_set1_ps(FLT_MIN)));
+  __m256 s  = _mm256_mul_ps(a, a);
+  __m256 r, m;
+
+  r = _mm256_fmadd_ps(
+        _mm256_set1_ps(WAVE_KERNELS_ATAN_C9),
+        s,
+        _mm256_set1_ps(WAVE_KERNELS_ATAN_C7));
+  r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(WAVE_KERNELS_ATAN_C5));
+  r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(WAVE_KERNELS_ATAN_C3));
+  r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(WAVE_KERNELS_ATAN_C1));
+  r = _mm256_mul_ps(r, a);
+
+  m = _mm256_cmp_ps(ay, ax, _CMP_GT_OQ);
+  r = _mm256_blendv_ps(
+        r,
+        _mm256_sub_ps(_mm256_set1_ps(SU_ASFLOAT(PI / 2)), r),
+        m);
+
+  // blendv only looks at the sign bit, which also covers x = -0
+  r = _mm256_blendv_ps(
+        r,
+        _mm256_sub_ps(_mm256_set1_ps(SU_ASFLOAT(PI)), r),
+        x);
+
+  return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+}
+
+__attribute__((target("avx2,fma"))) static void
+calcLimitsBufAVX2(
+    WaveLimits &thisLimit,
+    const SUCOMPLEX *__restrict data,
+    size_t len,
+    bool first)
+{
+  const float *f = reinterpret_cast<const float *>(data);
+  const __m256 evenMask = _mm256_castsi256_ps(
+        _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1));
+  __m256 min  = _mm256_set1_ps(+INFINITY);
+  __m256 max  = _mm256_set1_ps(-INFINITY);
+  __m256 sum  = _mm256_setzero_ps();
+  __m256 env2 = _mm256_setzero_ps();
+  __m256 freq = _mm256_setzero_ps();
+  WaveKernelAccum acc;
+  size_t j = 0;
+
+  if (len == 0)
+    return;
+
+  for (; j + 4 <= len; j += 4) {
+    __m256 x  = _mm256_loadu_ps(f + 2 * j);
+    __m256 sq = _mm256_mul_ps(x, x);
+
+    min  = _mm256_min_ps(x, min);
+    max  = _mm256_max_ps(x, max);
+    sum  = _mm256_add_ps(sum, x);
+    env2 = _mm256_max_ps(
+          _mm256_add_ps(sq, _mm256_permute_ps(sq, WAVE_KERNELS_SWAP_PAIRS)),
+          env2);
+
+    if (!first) {
+      __m256 p  = _mm256_loadu_ps(f + 2 * j - 2);
+      __m256 t1 = _mm256_mul_ps(x, p);
+      __m256 t2 = _mm256_mul_ps(x, _mm256_permute_ps(p, WAVE_KERNELS_SWAP_PAIRS));
+      __m256 re = _mm256_add_ps(t1, _mm256_permute_ps(t1, WAVE_KERNELS_SWAP_PAIRS));
+      __m256 im = _mm256_sub_ps(_mm256_permute_ps(t2, WAVE_KERNELS_SWAP_PAIRS), t2);
+
+      freq = _mm256_add_ps(
+            freq,
+            _mm256_and_ps(fastAtan2AVX2(im, re), evenMask));
+    }
+  }
+
+  // Fold the upper half into the 128-bit accumulators
+  acc.min  = _mm_min_ps(_mm256_castps256_ps128(min),  _mm256_extractf128_ps(min, 1));
+  acc.max  = _mm_max_ps(_mm256_castps256_ps128(max),  _mm256_extractf128_ps(max, 1));
+  acc.sum  = _mm_add_ps(_mm256_castps256_ps128(sum),  _mm256_extractf128_ps(sum, 1));
+  acc.env2 = _mm_max_ps(_mm256_castps256_ps128(env2), _mm256_extractf128_ps(env2, 1));
+  acc.freq = _mm_add_ps(_mm256_castps256_ps128(freq), _mm256_extractf128_ps(freq, 1));
+
+  for (; j + 2 <= len; j += 2)
+    accumPairSSE2(acc, f + 2 * j, first);
+
+  accumFinishSSE2(thisLimit, acc, data, j, len, first);
+}
+#endif // WAVE_KERNELS_AVX2
+
+////////////////////////////////// Dispatch ////////////////////////////////////
+#ifdef WAVE_KERNELS_AVX2
+static bool
+haveAVX2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif // WAVE_KERNELS_AVX2
+
+bool
+WaveKernels::supports(enum Isa isa)
+{
+  switch (isa) {
+    case ISA_SCALAR:
+      return true;
+
+#ifdef WAVE_KERNELS_SSE2
+    case ISA_SSE2:
+      return true;
+#endif // WAVE_KERNELS_SSE2
+
+#ifdef WAVE_KERNELS_AVX2
+    case ISA_AVX2:
+      return haveAVX2();
+#endif // WAVE_KERNELS_AVX2
+
+    default:
+      return false;
+  }
+}
+
+WaveKernels::LimitsBufKernel
+WaveKernels::limitsBuf(enum Isa isa)
+{
+  if (!supports(isa))
+    return nullptr;
+
+  switch (isa) {
+#ifdef WAVE_KERNELS_AVX2
+    case ISA_AVX2:
+      return calcLimitsBufAVX2;
+#endif // WAVE_KERNELS_AVX2
+
+#ifdef WAVE_KERNELS_SSE2
+    case ISA_SSE2:
+      return calcLimitsBufSSE2;
+#endif // WAVE_KERNELS_SSE2
+
+    default:
+      return calcLimitsBufScalar;
+  }
+}
+
+WaveKernels::LimitsBlockKernel
+WaveKernels::limitsBlock(enum Isa isa)
+{
+  if (!supports(isa))
+    return nullptr;
+
+#ifdef WAVE_KERNELS_SSE2
+  if (isa != ISA_SCALAR)
+    return calcLimitsBlockSSE2;
+#endif // WAVE_KERNELS_SSE2
+
+  return calcLimitsBlockScalar;
+}
+
+WaveKernels::LevelKernel
+WaveKernels::findLevel(enum Isa isa)
+{
+  if (!supports(isa))
+    return nullptr;
+
+#ifdef WAVE_KERNELS_SSE2
+  if (isa != ISA_SCALAR)
+    return findLevelSSE2;
+#endif // WAVE_KERNELS_SSE2
+
+  return findLevelScalar;
+}
+
+static enum WaveKernels::Isa
+bestIsa(void)
+{
+  if (WaveKernels::supports(WaveKernels::ISA_AVX2))
+    return WaveKernels::ISA_AVX2;
+  else if (WaveKernels::supports(WaveKernels::ISA_SSE2))
+    return WaveKernels::ISA_SSE2;
+
+  return WaveKernels::ISA_SCALAR;
+}
+
+WaveKernels::LimitsBufKernel
+WaveKernels::limitsBuf(void)
+{
+  static const LimitsBufKernel kernel = limitsBuf(bestIsa());
+
+  return kernel;
+}
+
+WaveKernels::LimitsBlockKernel
+WaveKernels::limitsBlock(void)
+{
+  static const LimitsBlockKernel kernel = limitsBlock(bestIsa());
+
+  return kernel;
+}
+
+WaveKernels::LevelKernel
+WaveKernels::findLevel(void)
+{
+  static const LevelKernel kernel = findLevel(bestIsa());
+
+  return kernel;
+}
+
+const char *
+WaveKernels::name(void)
+{
+  switch (bestIsa()) {
+    case ISA_AVX2:
+      return "avx2";
+
+    case ISA_SSE2:
+      return "sse2";
+
+    default:
+      return "scalar";
+  }
+}
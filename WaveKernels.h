@@ -0,0 +1,112 @@
+//
+//    WaveKernels.h: Vectorized inner loops of the waveform tree
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVEKERNELS_H
+#define WAVEKERNELS_H
+
+#include "WaveViewTree.h"
+
+//
+// The scalar kernels are the reference implementation. Vectorized versions
+// are selected at load time according to the capabilities of the CPU. They
+// compute min / max and envelopes exactly, but sums are performed in a
+// different order and the phase difference uses a polynomial approximation
+// of atan2 (max error around 1e-5 rad).
+//
+
+class WaveKernels {
+public:
+  typedef void (*LimitsBufKernel)(
+      WaveLimits &,
+      const SUCOMPLEX *__restrict,
+      size_t,
+      bool);
+
+  typedef void (*LimitsBlockKernel)(
+      WaveLimits &,
+      const WaveLimitVector &,
+      size_t,
+      size_t,
+      SUFLOAT);
+
+  typedef size_t (*LevelKernel)(
+      const SUCOMPLEX *__restrict,
+      size_t,
+      enum WaveSearchComponent,
+      bool,
+      bool,
+      SUFLOAT);
+
+  static void calcLimitsBufScalar(
+      WaveLimits &limit,
+      const SUCOMPLEX *__restrict buf,
+      size_t len,
+      bool first);
+
+  static void calcLimitsBlockScalar(
+      WaveLimits &limit,
+      const WaveLimitVector &data,
+      size_t offset,
+      size_t len,
+      SUFLOAT wEnd);
+
+  // Compact vectors are always decoded by the scalar kernel
+  static void calcLimitsBlockCompact(
+      WaveLimits &limit,
+      const WaveLimitVector &data,
+      size_t offset,
+      size_t len,
+      SUFLOAT wEnd);
+
+  //
+  // First sample that is at or above the level (or that is not, if !above).
+  // In slope mode, differences between consecutive samples are compared
+  // instead, starting from buf[1] - buf[0]. Returns len if there is none.
+  //
+  static size_t findLevelScalar(
+      const SUCOMPLEX *__restrict buf,
+      size_t len,
+      enum WaveSearchComponent component,
+      bool slope,
+      bool above,
+      SUFLOAT level);
+
+  //
+  // Kernels of a given instruction set, as the dispatcher would select them
+  // if it were the best one available (sets that have no specific version
+  // of a kernel fall back to the previous one). Null if the set was not
+  // compiled in or the CPU does not support it.
+  //
+  enum Isa {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2
+  };
+
+  static bool              supports(enum Isa);
+  static LimitsBufKernel   limitsBuf(enum Isa);
+  static LimitsBlockKernel limitsBlock(enum Isa);
+  static LevelKernel       findLevel(enum Isa);
+
+  static LimitsBufKernel   limitsBuf(void);
+  static LimitsBlockKernel limitsBlock(void);
+  static LevelKernel       findLevel(void);
+  static const char       *name(void);
+};
+
+#endif // WAVEKERNELS_H
@@ -0,0 +1,112 @@
+//
+//    WaveRasterizer.cpp: Direct span rasterization of waveform columns
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#include "WaveRasterizer.h"
+#include <cstring>
+
+WaveRasterizer::WaveRasterizer(QPainter &painter)
+{
+  QPaintDevice *device = painter.device();
+
+  if (!painter.isActive() || device == nullptr)
+    return;
+
+  if (device->devType() != QInternal::Image)
+    return;
+
+  if (!painter.worldTransform().isIdentity()
+      || painter.hasClipping()
+      || painter.compositionMode() != QPainter::CompositionMode_SourceOver)
+    return;
+
+  // Raster paint engines write straight into the image memory. Nothing
+  // is pending at this point, so both can be mixed safely.
+  *this = WaveRasterizer(*static_cast<QImage *>(device));
+}
+
+WaveRasterizer::WaveRasterizer(QImage &image)
+{
+  if (image.format() != QImage::Format_ARGB32_Premultiplied)
+    return;
+
+  m_bits   = reinterpret_cast<QRgb *>(image.bits());
+  m_stride = image.bytesPerLine() / static_cast<int>(sizeof(QRgb));
+  m_width  = image.width();
+  m_height = image.height();
+}
+
+// Makes columns in [x0, x1) transparent
+void
+WaveRasterizer::clear(int x0, int x1)
+{
+  x0 = qBound(0, x0, m_width);
+  x1 = qBound(0, x1, m_width);
+
+  if (x0 >= x1)
+    return;
+
+  for (int y = 0; y < m_height; ++y)
+    memset(
+          m_bits + y * m_stride + x0,
+          0,
+          static_cast<size_t>(x1 - x0) * sizeof(QRgb));
+}
+
+// Moves the image dx columns to the right (left if negative). Columns
+// left uncovered are made transparent.
+void
+WaveRasterizer::scroll(int dx)
+{
+  int count = m_width - qAbs(dx);
+
+  if (dx == 0)
+    return;
+
+  if (count <= 0) {
+    clear(0, m_width);
+    return;
+  }
+
+  for (int y = 0; y < m_height; ++y) {
+    QRgb *row = m_bits + y * m_stride;
+
+    if (dx > 0)
+      memmove(row + dx, row, static_cast<size_t>(count) * sizeof(QRgb));
+    else
+      memmove(row, row - dx, static_cast<size_t>(count) * sizeof(QRgb));
+  }
+
+  if (dx > 0)
+    clear(0, dx);
+  else
+    clear(count, m_width);
+}
+
+QRgb
+WaveRasterizer::pixel(QColor const &color, qreal opacity)
+{
+  return pixel(color.rgba(), opacity);
+}
+
+QRgb
+WaveRasterizer::pixel(QRgb rgb, qreal opacity)
+{
+  int alpha = qRound(qAlpha(rgb) * qBound(0., opacity, 1.));
+
+  return qPremultiply(qRgba(qRed(rgb), qGreen(rgb), qBlue(rgb), alpha));
+}
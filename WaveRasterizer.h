@@ -0,0 +1,124 @@
+//
+//    WaveRasterizer.h: Direct span rasterization of waveform columns
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVERASTERIZER_H
+#define WAVERASTERIZER_H
+
+#include <QPainter>
+#include <QImage>
+#include <utility>
+
+//
+// Zoomed-out waveforms are drawn as one vertical span per pixel column.
+// Going through QPainter for each of them means a few state changes and a
+// line rasterization per column, so these spans are written straight into
+// the scanlines of the target image instead. Only premultiplied ARGB32
+// images painted without transformation nor clipping are supported: in
+// that case, blending (source over) is just an integer multiply-add per
+// channel. Otherwise, the rasterizer is not valid and callers must fall
+// back to QPainter.
+//
+class WaveRasterizer {
+  QRgb *m_bits   = nullptr;
+  int   m_stride = 0; // In pixels
+  int   m_width  = 0;
+  int   m_height = 0;
+
+  // x * a / 255 for the four channels of x at once
+  static inline QRgb
+  byteMul(QRgb x, unsigned int a)
+  {
+    QRgb t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+
+    return x | t;
+  }
+
+public:
+  WaveRasterizer(QPainter &painter);
+  WaveRasterizer(QImage &image);
+
+  void clear(int x0, int x1);
+  void scroll(int dx);
+
+  static QRgb pixel(QColor const &color, qreal opacity = 1);
+  static QRgb pixel(QRgb rgba, qreal opacity = 1);
+
+  // Interpolates between two pixels (weight in [0, 255], 0 being a)
+  static inline QRgb
+  mix(QRgb a, QRgb b, unsigned int weight)
+  {
+    return byteMul(a, 255 - weight) + byteMul(b, weight);
+  }
+
+  inline bool
+  isValid(void) const
+  {
+    return m_bits != nullptr;
+  }
+
+  inline int
+  width(void) const
+  {
+    return m_width;
+  }
+
+  inline int
+  height(void) const
+  {
+    return m_height;
+  }
+
+  // Blends pixel (as returned by pixel()) over column x, from y0 to y1
+  // (both included, in any order)
+  inline void
+  vline(int x, int y0, int y1, QRgb pixel)
+  {
+    unsigned int inv = 255 - qAlpha(pixel);
+    QRgb *p;
+
+    if (x < 0 || x >= m_width)
+      return;
+
+    if (y0 > y1)
+      std::swap(y0, y1);
+
+    if (y0 < 0)
+      y0 = 0;
+
+    if (y1 >= m_height)
+      y1 = m_height - 1;
+
+    p = m_bits + y0 * m_stride + x;
+
+    if (inv == 0) {
+      for (int y = y0; y <= y1; ++y, p += m_stride)
+        *p = pixel;
+    } else if (inv < 255) {
+      for (int y = y0; y <= y1; ++y, p += m_stride)
+        *p = pixel + byteMul(*p, inv);
+    }
+  }
+};
+
+#endif // WAVERASTERIZER_H
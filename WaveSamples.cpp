@@ -0,0 +1,91 @@
+//
+//    WaveSamples.cpp: Waveform samples in their native format
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveSamples.h"
+#include <algorithm>
+
+//
+// Converts I / Q pairs into interleaved floats. These are plain loops over
+// flat arrays, which compilers vectorize.
+//
+template <typename T>
+static void
+convertPairs(
+    SUFLOAT *__restrict dest,
+    const T *__restrict src,
+    size_t len,
+    SUFLOAT scale)
+{
+  for (size_t i = 0; i < 2 * len; ++i)
+    dest[i] = scale * SCAST(SUFLOAT, src[i]);
+}
+
+void
+WaveSamples::convert(SUCOMPLEX *dest, SUSCOUNT offset, size_t len) const
+{
+  SUFLOAT *f = RCAST(SUFLOAT *, dest);
+
+  switch (m_format) {
+    case WAVE_SAMPLE_SC16:
+      convertPairs(
+            f,
+            SCAST(const int16_t *, m_data) + 2 * offset,
+            len,
+            m_scale);
+      break;
+
+    case WAVE_SAMPLE_SC8:
+      convertPairs(
+            f,
+            SCAST(const int8_t *, m_data) + 2 * offset,
+            len,
+            m_scale);
+      break;
+
+    default:
+      std::copy(
+            SCAST(const SUCOMPLEX *, m_data) + offset,
+            SCAST(const SUCOMPLEX *, m_data) + offset + len,
+            dest);
+  }
+}
+
+WaveSampleSpan::WaveSampleSpan(
+    WaveSamples const &samples,
+    SUSCOUNT offset,
+    size_t len,
+    size_t history)
+{
+  SUCOMPLEX *dest;
+
+  if (samples.isNative()) {
+    m_data = samples.native() + offset;
+    return;
+  }
+
+  if (len + history <= WAVE_SAMPLE_SPAN_LOCAL_LENGTH) {
+    dest = RCAST(SUCOMPLEX *, m_local);
+  } else {
+    m_heap.resize(len + history);
+    dest = m_heap.data();
+  }
+
+  samples.convert(dest, offset - history, len + history);
+  m_data = dest + history;
+}
@@ -0,0 +1,233 @@
+//
+//    WaveSamples.h: Waveform samples in their native format
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVESAMPLES_H
+#define WAVESAMPLES_H
+
+#include <sigutils/types.h>
+#include <cstdint>
+#include <vector>
+
+#include "SuWidgetsHelpers.h"
+
+// Full scale of integer samples is displayed as [-1, 1)
+#define WAVE_SAMPLES_SC16_SCALE       (1.f / 32768.f)
+#define WAVE_SAMPLES_SC8_SCALE        (1.f / 128.f)
+
+// Spans up to this length (e.g. a piece of the tree worker, along with the
+// samples before it) are converted on the stack
+#define WAVE_SAMPLE_SPAN_LOCAL_LENGTH (4096 + 64)
+
+enum WaveSampleFormat {
+  WAVE_SAMPLE_COMPLEX, // SUCOMPLEX
+  WAVE_SAMPLE_SC16,    // Interleaved signed 16-bit I / Q
+  WAVE_SAMPLE_SC8      // Interleaved signed 8-bit I / Q
+};
+
+//
+// Read-only handle to a buffer of samples, which behaves like a pointer to
+// SUCOMPLEX: it can be offset and indexed, and indexing converts integer
+// samples to complex floats (multiplied by the scale). Captures are kept
+// in memory as they are stored, and only converted on the fly.
+//
+// Converting handles from plain SUCOMPLEX pointers is implicit, so that
+// code written for native buffers keeps working with no changes.
+//
+class WaveSamples {
+  const void      *m_data   = nullptr;
+  WaveSampleFormat m_format = WAVE_SAMPLE_COMPLEX;
+  SUFLOAT          m_scale  = 1;
+
+public:
+  static inline size_t
+  sampleSize(WaveSampleFormat format)
+  {
+    switch (format) {
+      case WAVE_SAMPLE_SC16:
+        return 2 * sizeof(int16_t);
+
+      case WAVE_SAMPLE_SC8:
+        return 2 * sizeof(int8_t);
+
+      default:
+        return sizeof(SUCOMPLEX);
+    }
+  }
+
+  static inline SUFLOAT
+  defaultScale(WaveSampleFormat format)
+  {
+    switch (format) {
+      case WAVE_SAMPLE_SC16:
+        return WAVE_SAMPLES_SC16_SCALE;
+
+      case WAVE_SAMPLE_SC8:
+        return WAVE_SAMPLES_SC8_SCALE;
+
+      default:
+        return 1;
+    }
+  }
+
+  WaveSamples() = default;
+
+  inline
+  WaveSamples(const SUCOMPLEX *data) : m_data(data)
+  {
+  }
+
+  inline
+  WaveSamples(const void *data, WaveSampleFormat format, SUFLOAT scale) :
+    m_data(data),
+    m_format(format),
+    m_scale(scale)
+  {
+  }
+
+  inline
+  WaveSamples(const void *data, WaveSampleFormat format) :
+    WaveSamples(data, format, defaultScale(format))
+  {
+  }
+
+  inline bool
+  isNull(void) const
+  {
+    return m_data == nullptr;
+  }
+
+  inline bool
+  isNative(void) const
+  {
+    return m_format == WAVE_SAMPLE_COMPLEX;
+  }
+
+  inline WaveSampleFormat
+  format(void) const
+  {
+    return m_format;
+  }
+
+  inline SUFLOAT
+  scale(void) const
+  {
+    return m_scale;
+  }
+
+  inline size_t
+  sampleSize(void) const
+  {
+    return sampleSize(m_format);
+  }
+
+  inline const void *
+  bytes(void) const
+  {
+    return m_data;
+  }
+
+  // Null unless samples are SUCOMPLEX already
+  inline const SUCOMPLEX *
+  native(void) const
+  {
+    return isNative() ? SCAST(const SUCOMPLEX *, m_data) : nullptr;
+  }
+
+  inline SUCOMPLEX
+  operator[](SUSCOUNT i) const
+  {
+    switch (m_format) {
+      case WAVE_SAMPLE_SC16: {
+        const int16_t *p = SCAST(const int16_t *, m_data) + 2 * i;
+        return m_scale * SUCOMPLEX(p[0], p[1]);
+      }
+
+      case WAVE_SAMPLE_SC8: {
+        const int8_t *p = SCAST(const int8_t *, m_data) + 2 * i;
+        return m_scale * SUCOMPLEX(p[0], p[1]);
+      }
+
+      default:
+        return SCAST(const SUCOMPLEX *, m_data)[i];
+    }
+  }
+
+  inline WaveSamples &
+  operator+=(SUSCOUNT count)
+  {
+    m_data = SCAST(const char *, m_data) + count * sampleSize();
+    return *this;
+  }
+
+  inline WaveSamples
+  operator+(SUSCOUNT count) const
+  {
+    WaveSamples samples = *this;
+    return samples += count;
+  }
+
+  inline bool
+  operator==(WaveSamples const &other) const
+  {
+    return m_data == other.m_data
+        && m_format == other.m_format
+        && m_scale == other.m_scale;
+  }
+
+  inline bool
+  operator!=(WaveSamples const &other) const
+  {
+    return !(*this == other);
+  }
+
+  void convert(SUCOMPLEX *dest, SUSCOUNT offset, size_t len) const;
+};
+
+//
+// Samples [offset, offset + len) of a buffer as an array of SUCOMPLEX, for
+// the kernels that work on whole arrays. Native buffers are used in place.
+// Anything else is converted into a local buffer (or a heap one, if the
+// span does not fit in it), along with the history samples right before
+// it, for kernels that look back (e.g. data[-1]).
+//
+class WaveSampleSpan {
+  SUFLOAT                m_local[2 * WAVE_SAMPLE_SPAN_LOCAL_LENGTH];
+  std::vector<SUCOMPLEX> m_heap;
+  const SUCOMPLEX       *m_data = nullptr;
+
+public:
+  WaveSampleSpan(
+      WaveSamples const &samples,
+      SUSCOUNT offset,
+      size_t len,
+      size_t history = 0);
+
+  inline const SUCOMPLEX *
+  data(void) const
+  {
+    return m_data;
+  }
+
+  inline
+  operator const SUCOMPLEX *() const
+  {
+    return m_data;
+  }
+};
+
+#endif // WAVESAMPLES_H
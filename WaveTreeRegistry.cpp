@@ -0,0 +1,311 @@
+//
+//    WaveTreeRegistry.cpp: Process-wide registry of shared waveform trees
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#include "WaveTreeRegistry.h"
+#include <QDebug>
+#include <algorithm>
+
+WaveTreeRegistry::WaveTreeRegistry(QObject *parent) : QObject(parent)
+{
+}
+
+WaveTreeRegistry::~WaveTreeRegistry()
+{
+  for (auto &entry : m_entries)
+    delete entry.tree;
+}
+
+WaveTreeRegistry *
+WaveTreeRegistry::instance(void)
+{
+  static WaveTreeRegistry registry;
+
+  return &registry;
+}
+
+std::vector<WaveTreeRegistryEntry>::iterator
+WaveTreeRegistry::find(const WaveViewTree *tree)
+{
+  return std::find_if(
+        m_entries.begin(),
+        m_entries.end(),
+        [tree] (WaveTreeRegistryEntry const &entry) {
+          return entry.tree == tree;
+        });
+}
+
+std::vector<WaveTreeRegistryEntry>::iterator
+WaveTreeRegistry::evict(std::vector<WaveTreeRegistryEntry>::iterator it)
+{
+  WaveViewTree *tree = it->tree;
+
+  it = m_entries.erase(it);
+
+  tree->safeCancel();
+  delete tree;
+
+  return it;
+}
+
+//
+// Returns a tree of data (with one more reference), creating it if no
+// other view is showing the same buffer. A buffer that grew (or shrank)
+// in place extends (or rebuilds) the tree for everyone. Trees are found by
+// buffer and length: the contents are only hashed when a tree is created
+// or an idle one is adopted, never on every update of a growing capture.
+//
+// Buffers whose contents were replaced (not just appended to) must be
+// acquired with rebuild set: the tree is built again for every view that
+// shows them.
+//
+WaveViewTree *
+WaveTreeRegistry::acquire(
+    WaveSamples const &data,
+    SUSCOUNT length,
+    int blockBits,
+    bool rebuild)
+{
+  WaveTreeRegistryEntry entry;
+
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->data != data || it->blockBits != blockBits)
+      continue;
+
+    // Idle tree: make sure that the buffer is still the same one
+    if (it->refs == 0
+        && (rebuild
+            || length < it->hashLength
+            || WaveViewTree::contentHash(data, it->hashLength) != it->hash)) {
+      evict(it);
+      break;
+    }
+
+    ++it->refs;
+    it->lastUsed = ++m_clock;
+
+    if (rebuild) {
+      BLOCKSIG(it->tree, clear());
+
+      it->hash       = WaveViewTree::contentHash(data, length);
+      it->hashLength = length;
+      it->tree->reprocess(data, length);
+    } else if (length != it->tree->getLength()) {
+      // Samples already hashed are still there when the buffer grows, so
+      // the fingerprint only needs to be taken again for a shorter one
+      if (length < it->tree->getLength()) {
+        BLOCKSIG(it->tree, clear());
+
+        if (length < it->hashLength) {
+          it->hash       = WaveViewTree::contentHash(data, length);
+          it->hashLength = length;
+        }
+      }
+
+      it->tree->reprocess(data, length);
+    }
+
+    return it->tree;
+  }
+
+  entry.tree       = new WaveViewTree(this);
+  entry.data       = data;
+  entry.blockBits  = blockBits;
+  entry.refs       = 1;
+  entry.lastUsed   = ++m_clock;
+  entry.hash       = WaveViewTree::contentHash(data, length);
+  entry.hashLength = length;
+
+  entry.tree->setBlockBits(blockBits);
+
+  connect(
+        entry.tree,
+        SIGNAL(ready(void)),
+        this,
+        SLOT(onTreeReady(void)));
+
+  m_entries.push_back(entry);
+
+  entry.tree->reprocess(data, length);
+
+  enforceBudget();
+
+  return entry.tree;
+}
+
+void
+WaveTreeRegistry::retain(WaveViewTree *tree)
+{
+  auto it = find(tree);
+
+  if (it != m_entries.end()) {
+    ++it->refs;
+    it->lastUsed = ++m_clock;
+  }
+}
+
+//
+// Trees nobody uses are kept if complete. Otherwise, their buffer may go
+// away in the middle of the build.
+//
+void
+WaveTreeRegistry::release(WaveViewTree *tree)
+{
+  auto it = find(tree);
+
+  if (it == m_entries.end() || it->refs == 0)
+    return;
+
+  if (--it->refs > 0)
+    return;
+
+  if (it->data.isNull()
+      || !it->tree->isComplete()
+      || it->tree->isRunning())
+    evict(it);
+  else
+    enforceBudget();
+}
+
+void
+WaveTreeRegistry::touch(const WaveViewTree *tree)
+{
+  auto it = find(tree);
+
+  if (it != m_entries.end())
+    it->lastUsed = ++m_clock;
+}
+
+//
+// The contents at data are about to change (e.g. shifted by a sliding
+// window). Trees built from it stop reading it, are never handed out
+// again, and every view holding them is told to fall back to a tree of
+// its own. They go away once the last view releases them.
+//
+void
+WaveTreeRegistry::retire(WaveSamples const &data)
+{
+  std::vector<WaveViewTree *> trees;
+
+  for (auto &entry : m_entries) {
+    if (entry.data == data) {
+      entry.data = WaveSamples();
+      entry.tree->safeCancel();
+      trees.push_back(entry.tree);
+    }
+  }
+
+  // Holders release the trees (which may evict them) as they are told
+  for (auto tree : trees)
+    emit retired(tree);
+}
+
+void
+WaveTreeRegistry::setBudget(size_t bytes)
+{
+  m_budget = bytes;
+  enforceBudget();
+}
+
+size_t
+WaveTreeRegistry::getUsage(void) const
+{
+  size_t usage = 0;
+
+  for (auto const &entry : m_entries)
+    usage += entry.tree->memoryUsage();
+
+  return usage;
+}
+
+void
+WaveTreeRegistry::enforceBudget(void)
+{
+  size_t usage = getUsage();
+
+  if (usage <= m_budget) {
+    m_overBudget = false;
+    return;
+  }
+
+  std::sort(
+        m_entries.begin(),
+        m_entries.end(),
+        [] (WaveTreeRegistryEntry const &a, WaveTreeRegistryEntry const &b) {
+          return a.lastUsed < b.lastUsed;
+        });
+
+  // Idle trees go away first
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    if (usage <= m_budget)
+      break;
+
+    if (it->refs == 0) {
+      usage -= it->tree->memoryUsage();
+      it = evict(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Trees in use are compacted (trees still being built will do it once
+  // they are done)
+  for (auto &entry : m_entries) {
+    if (usage <= m_budget)
+      break;
+
+    if (!entry.tree->getCompactLevels()) {
+      usage -= entry.tree->memoryUsage();
+      entry.tree->setCompactLevels(true);
+      usage += entry.tree->memoryUsage();
+    }
+  }
+
+  // Then, they lose their lower levels (least recently used first, and
+  // from the bottom up)
+  for (auto &entry : m_entries) {
+    while (usage > m_budget) {
+      size_t before = entry.tree->memoryUsage();
+
+      if (!entry.tree->evictLevel())
+        break;
+
+      usage = usage - before + entry.tree->memoryUsage();
+    }
+
+    if (usage <= m_budget)
+      break;
+  }
+
+  // Nothing else can be freed until some view lets its tree go
+  if (usage > m_budget && !m_overBudget)
+    qWarning()
+        << "WaveTreeRegistry: trees in use take"
+        << usage
+        << "bytes, over the budget of"
+        << m_budget;
+
+  m_overBudget = usage > m_budget;
+}
+
+//////////////////////////////// Slots /////////////////////////////////////////
+void
+WaveTreeRegistry::onTreeReady(void)
+{
+  // Trees take their final size once built
+  enforceBudget();
+}
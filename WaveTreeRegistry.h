@@ -0,0 +1,102 @@
+//
+//    WaveTreeRegistry.h: Process-wide registry of shared waveform trees
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVETREEREGISTRY_H
+#define WAVETREEREGISTRY_H
+
+#include <QObject>
+#include <QByteArray>
+#include <vector>
+#include "WaveViewTree.h"
+
+#define WAVE_TREE_REGISTRY_DEFAULT_BUDGET (SCAST(size_t, 512) << 20)
+
+struct WaveTreeRegistryEntry {
+  WaveViewTree    *tree = nullptr;
+  WaveSamples      data;            // Null once retired
+  int              blockBits = WAVEFORM_BLOCK_BITS;
+  unsigned int     refs = 0;
+  quint64          lastUsed = 0;
+
+  // Fingerprint of the first hashLength samples, checked before reusing
+  // an idle tree (its buffer may have been freed, and the address reused).
+  // Taken when the tree is created, and kept while the buffer grows.
+  QByteArray       hash;
+  SUSCOUNT         hashLength = 0;
+};
+
+//
+// Views of the same capture buffer share a single tree, so that the same
+// data is never processed twice. Trees are reference counted: those no view
+// uses anymore are kept around (idle) in case the buffer is displayed
+// again, until the memory budget is exceeded. Then, idle trees are deleted
+// least recently used first and, if that is not enough, the levels of trees
+// in use are compacted (least recently used first too). As a last resort,
+// trees in use drop their lower levels (see WaveViewTree::evictLevel()),
+// and views read raw samples instead. If the budget still cannot be met
+// (e.g. trees are still being built), a warning is logged, and it is
+// enforced again once they are ready or released.
+//
+class WaveTreeRegistry : public QObject {
+  Q_OBJECT
+
+  std::vector<WaveTreeRegistryEntry> m_entries;
+  size_t  m_budget = WAVE_TREE_REGISTRY_DEFAULT_BUDGET;
+  quint64 m_clock = 0;
+  bool    m_overBudget = false; // Already warned about it
+
+  WaveTreeRegistry(QObject *parent = nullptr);
+
+  std::vector<WaveTreeRegistryEntry>::iterator find(const WaveViewTree *);
+  std::vector<WaveTreeRegistryEntry>::iterator evict(
+      std::vector<WaveTreeRegistryEntry>::iterator);
+  void enforceBudget(void);
+
+public:
+  ~WaveTreeRegistry() override;
+
+  static WaveTreeRegistry *instance(void);
+
+  inline size_t
+  getBudget(void) const
+  {
+    return m_budget;
+  }
+
+  WaveViewTree *acquire(
+      WaveSamples const &data,
+      SUSCOUNT length,
+      int blockBits = WAVEFORM_BLOCK_BITS,
+      bool rebuild = false);
+  void retain(WaveViewTree *);
+  void release(WaveViewTree *);
+  void touch(const WaveViewTree *);
+  void retire(WaveSamples const &data);
+
+  void setBudget(size_t bytes);
+  size_t getUsage(void) const;
+
+public slots:
+  void onTreeReady(void);
+
+signals:
+  // Holders of tree must stop using it (see retire())
+  void retired(WaveViewTree *tree);
+};
+
+#endif // WAVETREEREGISTRY_H
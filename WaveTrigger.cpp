@@ -0,0 +1,249 @@
+//
+//    WaveTrigger.cpp: Scope-style trigger for streamed waveforms
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveTrigger.h"
+#include "WaveKernels.h"
+
+WaveTrigger::WaveTrigger()
+{
+  reset();
+}
+
+bool
+WaveTrigger::setParams(WaveTriggerParams const &params)
+{
+  if (!params.isValid())
+    return false;
+
+  m_params = params;
+  reset();
+
+  return true;
+}
+
+//
+// Forgets everything about the stream. The first trigger point can only
+// be found once there are enough samples before it.
+//
+void
+WaveTrigger::reset(void)
+{
+  m_history.clear();
+  m_capture.clear();
+  m_window.clear();
+
+  m_capture.reserve(m_params.length);
+
+  m_haveLast  = false;
+  m_armed     = false;
+  m_capturing = false;
+  m_ready     = false;
+  m_skip      = m_params.preTrigger;
+  m_count     = 0;
+}
+
+//
+// First sample in [start, len) (or difference, in slope mode) that is at
+// or above the level (or below it). The first difference of the chunk is
+// taken from the last sample of the previous one.
+//
+size_t
+WaveTrigger::find(const SUCOMPLEX *data, size_t start, size_t len, bool above)
+{
+  WaveTriggerParams const &p = m_params;
+  WaveKernels::LevelKernel kernel = WaveKernels::findLevel();
+
+  if (start >= len)
+    return len;
+
+  if (!p.slope)
+    return start + kernel(
+          data + start,
+          len - start,
+          p.component,
+          false,
+          above,
+          p.level);
+
+  if (start == 0) {
+    if (m_haveLast) {
+      SUCOMPLEX pair[2] = {m_last, data[0]};
+
+      if (WaveKernels::findLevelScalar(
+            pair,
+            2,
+            p.component,
+            true,
+            above,
+            p.level) == 1)
+        return 0;
+    }
+
+    if (++start >= len)
+      return len;
+  }
+
+  return start - 1 + kernel(
+        data + start - 1,
+        len - start + 1,
+        p.component,
+        true,
+        above,
+        p.level);
+}
+
+//
+// Next trigger point in [start, len), or len if there is none. Edges are
+// armed by a sample on the other side of the level, which may come in an
+// earlier chunk.
+//
+size_t
+WaveTrigger::scan(const SUCOMPLEX *data, size_t start, size_t len)
+{
+  enum WaveSearchCondition cond = m_params.condition;
+  bool above = cond == WAVE_SEARCH_ABOVE || cond == WAVE_SEARCH_RISING;
+  size_t at;
+
+  if (cond == WAVE_SEARCH_ABOVE || cond == WAVE_SEARCH_BELOW)
+    return find(data, start, len, above);
+
+  if (!m_armed) {
+    at = find(data, start, len, !above);
+    if (at == len)
+      return len;
+
+    m_armed = true;
+    start   = at + 1;
+  }
+
+  at = find(data, start, len, above);
+  if (at < len)
+    m_armed = false;
+
+  return at;
+}
+
+// Starts the window with the samples right before data[at]
+void
+WaveTrigger::startCapture(const SUCOMPLEX *data, size_t at)
+{
+  size_t pre         = m_params.preTrigger;
+  size_t fromData    = MIN(at, pre);
+  size_t fromHistory = pre - fromData;
+
+  m_capture.clear();
+  m_capture.insert(
+        m_capture.end(),
+        m_history.end() - fromHistory,
+        m_history.end());
+  m_capture.insert(m_capture.end(), data + at - fromData, data + at);
+
+  m_capturing = true;
+}
+
+//
+// Keeps (at least) the last preTrigger samples of the stream. The history
+// is trimmed only once it doubles, so that small chunks do not move it
+// around every time.
+//
+void
+WaveTrigger::updateHistory(const SUCOMPLEX *data, size_t len)
+{
+  size_t pre = m_params.preTrigger;
+
+  if (pre == 0)
+    return;
+
+  if (len >= pre) {
+    m_history.assign(data + len - pre, data + len);
+  } else {
+    m_history.insert(m_history.end(), data, data + len);
+
+    if (m_history.size() > 2 * pre)
+      m_history.erase(m_history.begin(), m_history.end() - pre);
+  }
+}
+
+//
+// Scans a chunk of the stream. Returns true if at least one window was
+// completed (only the last one is kept).
+//
+bool
+WaveTrigger::feed(const SUCOMPLEX *data, size_t len)
+{
+  SUSCOUNT post = m_params.length - m_params.preTrigger;
+  bool completed = false;
+  size_t p = 0, n, at;
+
+  while (p < len) {
+    if (m_capturing) {
+      n = MIN(len - p, m_params.length - m_capture.size());
+      m_capture.insert(m_capture.end(), data + p, data + p + n);
+      p += n;
+
+      if (m_capture.size() == m_params.length) {
+        m_window.swap(m_capture);
+        m_capture.clear();
+
+        m_capturing = false;
+        m_ready     = true;
+        m_armed     = false;
+        m_skip      = m_params.holdoff > post ? m_params.holdoff - post : 0;
+        completed   = true;
+        ++m_count;
+      }
+    } else if (m_skip > 0) {
+      n = MIN(len - p, m_skip);
+      p += n;
+      m_skip -= n;
+    } else {
+      at = scan(data, p, len);
+      if (at == len)
+        break;
+
+      startCapture(data, at);
+      p = at;
+    }
+  }
+
+  if (len > 0) {
+    updateHistory(data, len);
+    m_last     = data[len - 1];
+    m_haveLast = true;
+  }
+
+  return completed;
+}
+
+//
+// Hands the last complete window over (swapping it with the given vector,
+// whose storage is reused for later windows). Returns false if there is
+// no window that was not taken yet.
+//
+bool
+WaveTrigger::takeWindow(std::vector<SUCOMPLEX> &window)
+{
+  if (!m_ready)
+    return false;
+
+  window.swap(m_window);
+  m_ready = false;
+
+  return true;
+}
@@ -0,0 +1,106 @@
+//
+//    WaveTrigger.h: Scope-style trigger for streamed waveforms
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+#ifndef WAVETRIGGER_H
+#define WAVETRIGGER_H
+
+#include <WaveViewTree.h>
+#include <vector>
+
+#define WAVE_TRIGGER_DEFAULT_LENGTH 4096
+
+//
+// Trigger conditions are the ones of the sample search. Level conditions
+// (above / below) fire on the first sample that meets them, and edges on
+// the first sample past the level. In slope mode, the difference between
+// consecutive samples is compared instead of the samples themselves.
+//
+struct WaveTriggerParams {
+  enum WaveSearchComponent component = WAVE_SEARCH_REAL;
+  enum WaveSearchCondition condition = WAVE_SEARCH_RISING;
+  bool     slope      = false;
+  SUFLOAT  level      = 0;
+  SUSCOUNT length     = WAVE_TRIGGER_DEFAULT_LENGTH; // Window length
+  SUSCOUNT preTrigger = 0; // Samples in the window before the trigger point
+  SUSCOUNT holdoff    = 0; // Minimum distance between trigger points
+
+  inline bool
+  isValid(void) const
+  {
+    return length > 0 && preTrigger < length;
+  }
+};
+
+//
+// Scans a stream for trigger points and captures a window of samples around
+// each of them. Trigger points are never closer than the part of the window
+// after them (windows do not overlap) nor than the holdoff. Edge triggers
+// are rearmed by a sample on the other side of the level, looked for after
+// the holdoff expires.
+//
+// Only the last complete window is kept: consumers that are slower than
+// the trigger rate skip windows, but never see a partial one.
+//
+class WaveTrigger {
+  WaveTriggerParams      m_params;
+
+  std::vector<SUCOMPLEX> m_history; // Last preTrigger samples of the stream
+  std::vector<SUCOMPLEX> m_capture; // Window being captured
+  std::vector<SUCOMPLEX> m_window;  // Last complete window
+
+  SUCOMPLEX m_last      = 0;       // Last sample of the previous chunk
+  bool      m_haveLast  = false;
+  bool      m_armed     = false;   // Edge: other side of the level seen
+  bool      m_capturing = false;
+  bool      m_ready     = false;   // m_window not taken yet
+  SUSCOUNT  m_skip      = 0;       // Samples left before rearming
+  quint64   m_count     = 0;       // Windows captured so far
+
+  size_t find(const SUCOMPLEX *data, size_t start, size_t len, bool above);
+  size_t scan(const SUCOMPLEX *data, size_t start, size_t len);
+  void startCapture(const SUCOMPLEX *data, size_t at);
+  void updateHistory(const SUCOMPLEX *data, size_t len);
+
+public:
+  inline WaveTriggerParams const &
+  params(void) const
+  {
+    return m_params;
+  }
+
+  inline bool
+  isReady(void) const
+  {
+    return m_ready;
+  }
+
+  inline quint64
+  count(void) const
+  {
+    return m_count;
+  }
+
+  WaveTrigger();
+
+  bool setParams(WaveTriggerParams const &params);
+  void reset(void);
+  bool feed(const SUCOMPLEX *data, size_t len);
+  bool takeWindow(std::vector<SUCOMPLEX> &window);
+};
+
+#endif // WAVETRIGGER_H
@@ -19,7 +19,15 @@
 #include "WaveView.h"
 #include <sys/time.h>
 #include <QPainterPath>
+#include <QPolygon>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <algorithm>
+#include <memory>
 #include "SuWidgetsHelpers.h"
+#include "WaveRasterizer.h"
+#include "WaveTreeRegistry.h"
 #include "YIQ.h"
 
 static inline QColor const &
@@ -35,20 +43,84 @@ phaseToColor(qreal angle)
         1023)];
 }
 
+// Same as phaseToColor, as packed ARGB
+struct WaveViewPhaseTable {
+  QRgb rgb[1024];
+
+  WaveViewPhaseTable()
+  {
+    for (int i = 0; i < 1024; ++i)
+      rgb[i] = yiqTable[i].rgba();
+  }
+};
+
+static inline QRgb
+phaseToRgb(qreal angle)
+{
+  static const WaveViewPhaseTable table;
+
+  if (angle < 0)
+    angle += SCAST(qreal, 2 * PI);
+
+  // Angles are non-negative here: truncation is enough
+  return table.rgb[
+        qBound(0, SCAST(int, angle * (1024 / (2 * PI))), 1023)];
+}
+
 WaveView::WaveView()
 {
-  m_waveTree = &m_ownWaveTree;
-  borrowTree(*this);
+  attachTree(&m_ownWaveTree, false);
+
+  connect(
+        WaveTreeRegistry::instance(),
+        SIGNAL(retired(WaveViewTree *)),
+        this,
+        SLOT(onTreeRetired(WaveViewTree *)));
+
+  connect(
+        &m_eye,
+        SIGNAL(progress(void)),
+        this,
+        SIGNAL(eyeProgress(void)));
 }
 
 WaveView::~WaveView()
 {
   safeCancel();
+
+  if (m_sharedTree != nullptr)
+    WaveTreeRegistry::instance()->release(m_sharedTree);
 }
 
 void
 WaveView::borrowTree(WaveView &view)
 {
+  bool shared = view.m_sharedTree != nullptr;
+
+  // Shared trees must outlive the view they are borrowed from
+  if (shared)
+    WaveTreeRegistry::instance()->retain(view.m_sharedTree);
+
+  attachTree(view.m_waveTree, shared);
+
+  m_eye.setBuffer(m_waveTree->getSamples(), m_waveTree->getLength());
+}
+
+//
+// Makes the view draw from tree. Shared trees come with a reference taken
+// from the registry, which is given back once the view moves on.
+//
+void
+WaveView::attachTree(WaveViewTree *tree, bool shared)
+{
+  WaveViewTree *prevShared = m_sharedTree;
+
+  if (tree == m_waveTree) {
+    if (shared)
+      WaveTreeRegistry::instance()->release(tree);
+    return;
+  }
+
   if (m_waveTree != nullptr) {
     disconnect(
           m_waveTree,
@@ -63,7 +135,10 @@ WaveView::borrowTree(WaveView &view)
           nullptr);
   }
 
-  m_waveTree = view.m_waveTree;
+  m_waveTree   = tree;
+  m_sharedTree = shared ? tree : nullptr;
+  invalidateLayer();
+
   connect(
         m_waveTree,
         SIGNAL(ready(void)),
@@ -75,6 +150,9 @@ WaveView::borrowTree(WaveView &view)
         SIGNAL(progress(quint64, quint64)),
         this,
         SLOT(onProgress(quint64, quint64)));
+
+  if (prevShared != nullptr)
+    WaveTreeRegistry::instance()->release(prevShared);
 }
 
 qreal
@@ -86,7 +164,7 @@ WaveView::getEnvelope(void) const
   if (m_waveTree->size() == 0)
     return 0;
 
-  return SCAST(qreal, (*m_waveTree)[m_waveTree->size() - 1][0].envelope);
+  return SCAST(qreal, m_waveTree->last().envelopeAt(0));
 }
 
 void
@@ -132,43 +210,127 @@ WaveView::setGeometry(int width, int height)
 }
 
 /////////////////////////////// Drawing methods ////////////////////////////////
+
+//
+// Envelope of a close-up view between two pixel columns: a trapezoid from
+// x0 to x1, filled with a horizontal gradient from c0 to c1. Degenerate
+// (x0 == x1) spans are just vertical lines at x1.
+//
+struct WaveViewEnvelopeSpan {
+  int  x0, top0, bottom0;
+  int  x1, top1, bottom1;
+  QRgb c0, c1;
+};
+
+static void
+fillEnvelopeSpans(
+    QPainter &p,
+    WaveRasterizer &raster,
+    std::vector<WaveViewEnvelopeSpan> const &spans,
+    qreal opacity)
+{
+  if (raster.isValid()) {
+    for (auto const &span : spans) {
+      QRgb p0 = WaveRasterizer::pixel(span.c0, opacity);
+      QRgb p1 = span.c1 == span.c0
+          ? p0
+          : WaveRasterizer::pixel(span.c1, opacity);
+      qreal width = span.x1 - span.x0;
+
+      if (span.x0 == span.x1) {
+        raster.vline(span.x1, span.top1, span.bottom1, p1);
+        continue;
+      }
+
+      for (int x = span.x0; x < span.x1; ++x) {
+        qreal t = (x + .5 - span.x0) / width;
+        QRgb pixel = p0;
+
+        if (p0 != p1)
+          pixel = WaveRasterizer::mix(p0, p1, SCAST(unsigned, 255 * t));
+
+        raster.vline(
+              x,
+              qRound(span.top0 + t * (span.top1 - span.top0)),
+              qRound(span.bottom0 + t * (span.bottom1 - span.bottom0)),
+              pixel);
+      }
+    }
+  } else {
+    QPainterPath flat;
+    QRgb flatColor = 0;
+
+    p.setOpacity(opacity);
+
+    // Spans of the same color are filled at once
+    for (auto const &span : spans) {
+      if (span.x0 == span.x1) {
+        p.setPen(QColor::fromRgba(span.c1));
+        p.drawLine(span.x1, span.top1, span.x1, span.bottom1);
+      } else if (span.c0 == span.c1) {
+        if (span.c0 != flatColor && !flat.isEmpty()) {
+          p.fillPath(flat, QColor::fromRgba(flatColor));
+          flat = QPainterPath();
+        }
+
+        flatColor = span.c0;
+        flat.moveTo(span.x0, span.top0);
+        flat.lineTo(span.x1, span.top1);
+        flat.lineTo(span.x1, span.bottom1);
+        flat.lineTo(span.x0, span.bottom0);
+        flat.closeSubpath();
+      } else {
+        QPainterPath path;
+        QLinearGradient gradient(span.x0, 0, span.x1, 0);
+
+        path.moveTo(span.x0, span.top0);
+        path.lineTo(span.x1, span.top1);
+        path.lineTo(span.x1, span.bottom1);
+        path.lineTo(span.x0, span.bottom0);
+
+        gradient.setColorAt(0, QColor::fromRgba(span.c0));
+        gradient.setColorAt(1, QColor::fromRgba(span.c1));
+        p.fillPath(path, gradient);
+      }
+    }
+
+    if (!flat.isEmpty())
+      p.fillPath(flat, QColor::fromRgba(flatColor));
+  }
+}
+
+//
+// Close-up views may have many samples per pixel column. Instead of
+// painting every piece as it is found, envelope spans and waveform vertices
+// are collected first and emitted in batches: spans are rasterized straight
+// into the target image (if possible) and the waveform is a single polyline.
+//
 void
 WaveView::drawWaveClose(QPainter &p)
 {
   qreal firstSamp, lastSamp;
   qint64 firstIntegerSamp, lastIntegerSamp;
   SUSCOUNT length = m_waveTree->getLength();
-  const SUCOMPLEX *data = m_waveTree->getData();
+  WaveSamples const &data = m_waveTree->getSamples();
   int prevMinEnvY = 0;
   int prevMaxEnvY = 0;
   int nextX, currX, currY;
-  int prevX = 0, prevY = 0;
+  int prevX = 0;
   int pathX = 0;
 
   qreal prevPhase = 0;
   qreal alpha = 1;
   bool havePrevEnv = false;
-  bool havePrevWf  = false;
-  QColor color = m_foreground;
-  QColor darkenedForeground;
   int minEnvY = 0, maxEnvY = 0;
-  QPen pen;
   bool paintSamples = m_sampPerPx < 1. / (2 * WAVEFORM_CIRCLE_DIM);
+  QRgb foreground = m_foreground.rgba();
+  std::vector<WaveViewEnvelopeSpan> spans;
+  QPolygon wave;
+  WaveRasterizer raster(p);
 
   if (m_sampPerPx > 1)
     alpha = sqrt(1. / m_sampPerPx);
 
-  pen.setColor(color);
-  pen.setStyle(Qt::SolidLine);
-  p.setPen(pen);
-
-  // Initialize darkened foreground
-  if (m_showWaveform && !m_showPhase) {
-    darkenedForeground.setRed(m_foreground.red() / 3);
-    darkenedForeground.setGreen(m_foreground.green() / 3);
-    darkenedForeground.setBlue(m_foreground.blue() / 3);
-  }
-
   // Determine the representation range
   firstSamp = px2samp(m_leftMargin);
   lastSamp  = px2samp(m_width - 1);
@@ -182,308 +344,705 @@ WaveView::drawWaveClose(QPainter &p)
   if (lastIntegerSamp >= SCAST(qint64, length))
     lastIntegerSamp = SCAST(qint64, length - 1);
 
+  if (lastIntegerSamp < firstIntegerSamp)
+    return;
+
+  if (m_showWaveform)
+    wave.reserve(SCAST(int, lastIntegerSamp - firstIntegerSamp + 1));
+
   nextX = SCAST(int, samp2px(SCAST(qreal, firstIntegerSamp)));
   for (qint64 i = firstIntegerSamp; i <= lastIntegerSamp; ++i) {
     currX = nextX;
     nextX = SCAST(int, samp2px(SCAST(qreal, i + 1)));
     currY = SCAST(int, value2px(cast(data[i])));
 
-    if (i >= 0 && i < SCAST(qint64, length)) {
-      // Draw envelope?
-      if (m_showEnvelope) {
-        // Determine limits
-        qreal mag    = SCAST(qreal, SU_C_ABS(data[i]));
-        qreal phase  = SCAST(qreal, SU_C_ARG(data[i]));
+    // Draw envelope?
+    if (m_showEnvelope) {
+      // Determine limits
+      qreal mag    = SCAST(qreal, SU_C_ABS(data[i]));
+      qreal phase  = SCAST(qreal, SU_C_ARG(data[i]));
 
-        int pxLower  = SCAST(int, value2px(+mag));
-        int pxUpper  = SCAST(int, value2px(-mag));
+      int pxLower  = SCAST(int, value2px(+mag));
+      int pxUpper  = SCAST(int, value2px(-mag));
 
-        // Previous pixel column is not the same as next
-        //  Initialize limits
-        if (currX != prevX) {
+      // Previous pixel column is not the same as next
+      //  Initialize limits
+      if (currX != prevX) {
+        minEnvY = pxLower;
+        maxEnvY = pxUpper;
+        pathX   = prevX;
+      } else {
+        // If not: update limits
+        if (pxLower < minEnvY)
           minEnvY = pxLower;
-          maxEnvY = pxUpper;
-          pathX   = prevX;
-        } else {
-          // If not: update limits
-          if (pxLower < minEnvY)
-            minEnvY = pxLower;
-
-          if (pxUpper > maxEnvY)
-            maxEnvY = pxUpper;
-        }
 
-        // Next pixel column will be different: time to draw line
-        if (currX != nextX) {
-          p.setPen(Qt::NoPen);
-          p.setOpacity(m_showWaveform ? .33 : 1.);
+        if (pxUpper > maxEnvY)
+          maxEnvY = pxUpper;
+      }
 
-          if (havePrevEnv) {
-            QPainterPath path;
+      // Next pixel column will be different: time to add a span
+      if (currX != nextX) {
+        if (havePrevEnv) {
+          WaveViewEnvelopeSpan span;
 
-            if (pathX != currX) {
-              path.moveTo(pathX, prevMinEnvY);
-              path.lineTo(currX, minEnvY);
-              path.lineTo(currX, maxEnvY);
-              path.lineTo(pathX, prevMaxEnvY);
-            }
+          span.x0      = pathX;
+          span.top0    = prevMinEnvY;
+          span.bottom0 = prevMaxEnvY;
+          span.x1      = currX;
+          span.top1    = minEnvY;
+          span.bottom1 = maxEnvY;
 
-            // Show phase?
-            if (m_showPhase) {
-              if (m_showPhaseDiff) {
-                // Display its first derivative (frequency)
-                qreal phaseDiff = phase - prevPhase;
-                if (phaseDiff < 0)
-                  phaseDiff += 2. * SCAST(qreal, PI);
-                QColor diffColor = phaseDiff2Color(phaseDiff);
-
-                if (pathX != currX) {
-                  p.fillPath(path, diffColor);
-                } else {
-                  p.setPen(diffColor);
-                  p.drawLine(currX, minEnvY, currX, maxEnvY);
-                }
-              } else {
-                // Display it as-is
-                if (pathX != currX) {
-                  QLinearGradient gradient(prevX, 0, currX, 0);
-                  gradient.setColorAt(0, phaseToColor(prevPhase));
-                  gradient.setColorAt(1, phaseToColor(phase));
-                  p.fillPath(path, gradient);
-                } else {
-                  p.setPen( phaseToColor(phase));
-                  p.drawLine(currX, minEnvY, currX, maxEnvY);
-                }
-
-              }
+          // Show phase?
+          if (m_showPhase) {
+            if (m_showPhaseDiff) {
+              // Display its first derivative (frequency)
+              qreal phaseDiff = phase - prevPhase;
+              if (phaseDiff < 0)
+                phaseDiff += 2. * SCAST(qreal, PI);
+              span.c0 = span.c1 = phaseDiff2Color(phaseDiff).rgba();
             } else {
-              if (pathX != currX) {
-                p.fillPath(path, m_foreground);
-              } else {
-                p.setPen(m_foreground);
-                p.drawLine(currX, minEnvY, currX, maxEnvY);
-              }
+              // Display it as-is
+              span.c0 = phaseToRgb(prevPhase);
+              span.c1 = phaseToRgb(phase);
             }
+          } else {
+            span.c0 = span.c1 = foreground;
           }
 
-          prevMinEnvY  = minEnvY;
-          prevMaxEnvY  = maxEnvY;
-          havePrevEnv = true;
+          spans.push_back(span);
         }
 
-        prevPhase  = phase;
+        prevMinEnvY  = minEnvY;
+        prevMaxEnvY  = maxEnvY;
+        havePrevEnv = true;
       }
 
-      if (m_showWaveform) {
-        p.setOpacity(alpha);
+      prevPhase  = phase;
+    }
 
-        if (havePrevWf) {
-          p.setPen(QPen(m_foreground));
-          p.drawLine(prevX, prevY, currX, currY);
-        }
+    if (m_showWaveform)
+      wave.append(QPoint(currX, currY));
 
-        if (paintSamples) {
-          p.setBrush(QBrush(m_foreground));
-          p.drawEllipse(
-                currX - WAVEFORM_CIRCLE_DIM / 2,
-                currY - WAVEFORM_CIRCLE_DIM / 2,
-                WAVEFORM_CIRCLE_DIM,
-                WAVEFORM_CIRCLE_DIM);
-        }
-      }
+    prevX = currX;
+  }
+
+  if (!spans.empty()) {
+    p.setPen(Qt::NoPen);
+    fillEnvelopeSpans(p, raster, spans, m_showWaveform ? .33 : 1.);
+  }
+
+  if (m_showWaveform) {
+    p.setOpacity(alpha);
+    p.setPen(QPen(m_foreground));
+    p.drawPolyline(wave);
+
+    if (paintSamples) {
+      p.setBrush(QBrush(m_foreground));
+      for (auto const &point : wave)
+        p.drawEllipse(
+              point.x() - WAVEFORM_CIRCLE_DIM / 2,
+              point.y() - WAVEFORM_CIRCLE_DIM / 2,
+              WAVEFORM_CIRCLE_DIM,
+              WAVEFORM_CIRCLE_DIM);
     }
+  }
+}
+
+//
+// Columns of a zoomed-out waveform are independent once the level is chosen,
+// so wide images are split in vertical tiles whose columns are queried from
+// the tree by the global thread pool. The calling thread takes the first
+// one, and takes back those that did not start yet (e.g. because the pool
+// is busy building a tree).
+//
+class WaveViewTileTask : public QRunnable {
+  WaveView   *m_view;
+  int         m_level;
+  qreal       m_start;
+  int         m_x0;
+  int         m_x1;
+  QSemaphore *m_done;
+
+public:
+  WaveViewTileTask(
+      WaveView *view,
+      int level,
+      qreal start,
+      int x0,
+      int x1,
+      QSemaphore *done) :
+    m_view(view),
+    m_level(level),
+    m_start(start),
+    m_x0(x0),
+    m_x1(x1),
+    m_done(done)
+  {
+    setAutoDelete(false);
+  }
 
-    prevX      = currX;
-    prevY      = currY;
-    havePrevWf = true;
+  void
+  run(void) override
+  {
+    m_view->updateColumnsTile(m_level, m_start, m_x0, m_x1);
+    m_done->release();
   }
+};
+
+static inline SUCOMPLEX
+componentMin(SUCOMPLEX a, SUCOMPLEX b)
+{
+  return SUCOMPLEX(
+        MIN(SU_C_REAL(a), SU_C_REAL(b)),
+        MIN(SU_C_IMAG(a), SU_C_IMAG(b)));
+}
+
+static inline SUCOMPLEX
+componentMax(SUCOMPLEX a, SUCOMPLEX b)
+{
+  return SUCOMPLEX(
+        MAX(SU_C_REAL(a), SU_C_REAL(b)),
+        MAX(SU_C_IMAG(a), SU_C_IMAG(b)));
 }
 
-// Draw wave far away. We will use a different approach: since we already have
+//
+// Queries columns [x0, x1) of the view from the tree, as if it started at
+// sample start (which may be fractional).
+//
+void
+WaveView::updateColumns(int level, qreal start, int x0, int x1)
+{
+  std::vector<std::unique_ptr<WaveViewTileTask>> tasks;
+  QThreadPool *pool = QThreadPool::globalInstance();
+  QSemaphore done;
+  int tiles;
+  int tileWidth;
+
+  if (m_columns.size() != SCAST(size_t, m_width))
+    m_columns.resize(SCAST(size_t, m_width));
+
+  tiles = qBound(
+        1,
+        (x1 - x0) / WAVE_VIEW_TILE_MIN_WIDTH,
+        pool->maxThreadCount());
+
+  if (tiles < 2) {
+    updateColumnsTile(level, start, x0, x1);
+    return;
+  }
+
+  tileWidth = (x1 - x0 + tiles - 1) / tiles;
+
+  for (int x = x0 + tileWidth; x < x1; x += tileWidth)
+    tasks.push_back(
+          std::unique_ptr<WaveViewTileTask>(
+            new WaveViewTileTask(
+              this,
+              level,
+              start,
+              x,
+              MIN(x + tileWidth, x1),
+              &done)));
+
+  for (auto &task : tasks)
+    pool->start(task.get());
+
+  updateColumnsTile(level, start, x0, x0 + tileWidth);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+  for (auto &task : tasks)
+    if (pool->tryTake(task.get()))
+      task->run();
+#endif // QT_VERSION_CHECK
+
+  done.acquire(SCAST(int, tasks.size()));
+}
+
+// Wave far away. We will use a different approach: since we already have
 // range information, we exploit it in order to know what to paint, and
-// how
+// how. Every pixel column is a vertical span, summarized here from the
+// blocks that fall in it. Only the columns in [x0, x1) are updated.
 void
-WaveView::drawWaveFar(QPainter &p, int level)
+WaveView::updateColumnsTile(int level, qreal start, int x0, int x1)
 {
   qreal firstSamp, lastSamp;
-  qint64 firstBlock, lastBlock;
+  qint64 firstBlock, lastBlock, tileBlock;
   int nextX, currX;
-  int prevX = -1, prevYA = 0, prevYB = 0;
-  int minEnvY = 0, maxEnvY = 0;
-  int minWfY  = 0, maxWfY  = 0;
+  int prevX = -1;
+  SUCOMPLEX prevMin = 0, prevMax = 0;
+  SUCOMPLEX lo = 0, hi = 0;
+  SUFLOAT envelope = 0;
   int bits;
   bool havePrev = false;
-  QPen pen;
-  WaveViewTree::iterator view = m_waveTree->begin() + level;
+  WaveViewTree::const_iterator view = m_waveTree->cbegin() + level;
 
-  bits = (level + 1) * WAVEFORM_BLOCK_BITS;
+  if (level < m_waveTree->getFirstLevel()) {
+    updateColumnsTileRaw(start, x0, x1);
+    return;
+  }
 
-  pen.setColor(m_foreground);
-  pen.setStyle(Qt::SolidLine);
-  p.setPen(pen);
+  for (int x = x0; x < x1; ++x)
+    m_columns[SCAST(size_t, x)].valid = false;
 
-  // Initialize darkened foreground
+  bits = (level + 1) * m_waveTree->getBlockBits();
 
   // Determine the representation range
-  firstSamp = px2samp(m_leftMargin);
-  lastSamp  = px2samp(m_width - 1);
+  firstSamp = px2samp(m_leftMargin, start);
+  lastSamp  = px2samp(m_width - 1, start);
 
   firstBlock = SCAST(qint64, std::ceil(firstSamp)) >> bits;
   lastBlock  = SCAST(qint64, std::floor(lastSamp)) >> bits;
 
+  // Start a bit before the tile and end a bit after it, so that the
+  // columns at its edges look the same as if the image was queried at once
+  tileBlock = SCAST(qint64, std::floor(px2samp(x0 - 1, start)));
+  tileBlock = (tileBlock >> bits) - 1;
+  if (firstBlock < tileBlock)
+    firstBlock = tileBlock;
+
+  tileBlock = SCAST(qint64, std::ceil(px2samp(x1, start)));
+  tileBlock = (tileBlock >> bits) + 1;
+  if (lastBlock > tileBlock)
+    lastBlock = tileBlock;
+
   if (firstBlock < 0)
     firstBlock = 0;
 
   if (lastBlock >= SCAST(qint64, view->size()))
     lastBlock = SCAST(qint64, view->size() - 1);
 
-  nextX = SCAST(int, samp2px(SCAST(qreal, firstBlock << bits)));
+  // Tree still being built: only blocks below the watermark are final
+  if (!m_waveTree->isComplete()) {
+    qint64 readyBlocks = SCAST(qint64, m_waveTree->getBuilt() >> bits);
+    if (lastBlock >= readyBlocks)
+      lastBlock = readyBlocks - 1;
+  }
+
+  nextX = SCAST(int, samp2px(SCAST(qreal, firstBlock << bits), start));
 
   for (qint64 i = firstBlock; i <= lastBlock; ++i) {
-    WaveLimits &z = (*view)[SCAST(unsigned long, i)];
     qint64 samp = i << bits;
+    SUCOMPLEX min = view->minAt(i);
+    SUCOMPLEX max = view->maxAt(i);
+    SUFLOAT mag   = view->envelopeAt(i);
 
     currX = nextX;
-    nextX = SCAST(int, samp2px(SCAST(qreal, samp + (1 << bits))));
+    nextX = SCAST(int, samp2px(SCAST(qreal, samp + (1 << bits)), start));
+
+    // Previous pixel column is not the same as next
+    //  Initialize limits
+    if (currX != prevX) {
+      // Spans are joined to the previous block so that the waveform
+      // looks continuous
+      if (havePrev) {
+        lo = componentMin(min, prevMax);
+        hi = componentMax(max, prevMin);
+      } else {
+        lo = min;
+        hi = max;
+      }
 
-    // Draw envelope?
-    if (m_showEnvelope) {
-      // Determine limits
-      qreal mag   = SCAST(qreal, z.envelope);
-      qreal phase = SCAST(qreal, SU_C_ARG(z.mean));
+      envelope = mag;
+    } else {
+      // If not: update limits
+      lo = componentMin(lo, min);
+      hi = componentMax(hi, max);
 
-      int pxHigh  = SCAST(int, value2px(+mag));
-      int pxLow   = SCAST(int, value2px(-mag));
+      if (envelope < mag)
+        envelope = mag;
+    }
 
-      // Previous pixel column is not the same as next
-      //  Initialize limits
-      if (currX != prevX) {
-        minEnvY = pxHigh;
-        maxEnvY = pxLow;
-      } else {
-        // If not: update limits
-        if (minEnvY > pxHigh)
-          minEnvY = pxHigh;
+    // Next pixel column will be different: save it
+    if (currX != nextX && currX >= x0 && currX < x1) {
+      WaveViewColumn &column = m_columns[SCAST(size_t, currX)];
+
+      column.lo       = lo;
+      column.hi       = hi;
+      column.mean     = view->meanAt(i);
+      column.envelope = envelope;
+      column.freq     = view->freqAt(i);
+      column.valid    = true;
+      column.first    = !havePrev;
+    }
 
-        if (maxEnvY < pxLow)
-          maxEnvY = pxLow;
-      }
+    prevMin  = min;
+    prevMax  = max;
+    prevX    = currX;
 
-      // Next pixel column will be different: time to draw line
-      if (currX != nextX) {
-        p.setPen(Qt::NoPen);
-        p.setOpacity(m_showWaveform ? .33 : 1.);
+    havePrev = true;
 
-        if (havePrev) {
-          // Show phase?
-          QColor lineColor;
+    if (nextX >= x1)
+      break;
+  }
+}
 
-          if (m_showPhase) {
-            // Display its first derivative (frequency, cached)
-            if (m_showPhaseDiff) {
-              lineColor = phaseDiff2Color(
-                    SCAST(qreal, z.freq < 0 ? z.freq + 2 * PI : z.freq));
-            }
-            else
-              lineColor = phaseToColor(phase);
-          } else {
-            lineColor = m_foreground;
-          }
+//
+// Same as updateColumnsTile, for levels that were evicted from the tree to
+// meet the memory budget (see WaveViewTree::evictLevel). Every column is
+// summarized from the samples that fall in it with computeLimits, which
+// reads the first level left and the raw samples at its ends.
+//
+void
+WaveView::updateColumnsTileRaw(qreal start, int x0, int x1)
+{
+  qint64 built = SCAST(qint64, m_waveTree->getBuilt());
+  qint64 first, last, next;
+  SUCOMPLEX prevMin = 0, prevMax = 0;
+  bool havePrev = false;
+  int x = MAX(x0, m_leftMargin) - 1;
 
-          p.setPen(QPen(lineColor));
-          p.drawLine(currX, minEnvY, currX, maxEnvY);
-        }
+  if (built > SCAST(qint64, m_waveTree->getLength()))
+    built = SCAST(qint64, m_waveTree->getLength());
+
+  for (int i = x0; i < x1; ++i)
+    m_columns[SCAST(size_t, i)].valid = false;
+
+  // Start a column before the tile, so that its first column is joined
+  // to the previous one as if the image was queried at once
+  next = SCAST(qint64, std::ceil(px2samp(x, start)));
+
+  for (; x < x1; ++x) {
+    WaveLimits limits;
+
+    first = MAX(next, 0);
+    next  = SCAST(qint64, std::ceil(px2samp(x + 1, start)));
+    last  = MIN(next, built) - 1;
+
+    if (first >= built)
+      break;
+
+    if (first > last)
+      continue;
+
+    m_waveTree->computeLimits(first, last, limits);
+
+    if (x >= x0) {
+      WaveViewColumn &column = m_columns[SCAST(size_t, x)];
+
+      // Spans are joined to the previous column so that the waveform
+      // looks continuous
+      if (havePrev) {
+        column.lo = componentMin(limits.min, prevMax);
+        column.hi = componentMax(limits.max, prevMin);
+      } else {
+        column.lo = limits.min;
+        column.hi = limits.max;
       }
+
+      column.mean     = limits.mean;
+      column.envelope = limits.envelope;
+      column.freq     = limits.freq;
+      column.valid    = true;
+      column.first    = !havePrev;
     }
 
-    // Draw waveform
-    if (m_showWaveform) {
-      qreal min = cast(z.min);
-      qreal max = cast(z.max);
+    prevMin  = limits.min;
+    prevMax  = limits.max;
+    havePrev = true;
+  }
+}
 
-      int yA = SCAST(int, value2px(min));
-      int yB = SCAST(int, value2px(max));
+//
+// Paints columns [x0, x1) from the column cache. Every column is rasterized
+// directly into the target image whenever possible (p is only used
+// otherwise). No tree access happens here.
+//
+void
+WaveView::drawColumns(QPainter *p, WaveRasterizer &raster, int x0, int x1)
+{
+  qreal envOpacity = m_showWaveform ? .33 : 1.;
+  qreal wfOpacity  = m_showEnvelope ? .33 : .66;
+  QRgb envPixel    = WaveRasterizer::pixel(m_foreground, envOpacity);
+  QRgb wfPixel     = WaveRasterizer::pixel(m_foreground, wfOpacity);
 
-      // Previous pixel column is not the same as next
-      //  Initialize limits
-      if (currX != prevX) {
-        // These comparisons seem inverted. They are not: remember that
-        // vertical screen coordinates are top-down, while regular cartesian
-        // coordinates are bottom-up. This results in a change of signedness
-        // in the vertical coordinate.
-
-        if (havePrev) {
-          minWfY = MIN(yB, prevYA);
-          maxWfY = MAX(yA, prevYB);
-        } else {
-          minWfY = yB;
-          maxWfY = yA;
+  for (int x = x0; x < x1; ++x) {
+    WaveViewColumn const &column = m_columns[SCAST(size_t, x)];
+
+    if (!column.valid)
+      continue;
+
+    // Draw envelope?
+    if (m_showEnvelope && !column.first) {
+      qreal mag  = SCAST(qreal, column.envelope);
+      int pxHigh = SCAST(int, value2px(+mag));
+      int pxLow  = SCAST(int, value2px(-mag));
+      QColor lineColor;
+
+      // Show phase?
+      if (m_showPhase) {
+        // Display its first derivative (frequency, cached)
+        if (m_showPhaseDiff) {
+          SUFLOAT freq = column.freq;
+          lineColor = phaseDiff2Color(
+                SCAST(qreal, freq < 0 ? freq + 2 * PI : freq));
         }
+        else
+          lineColor = phaseToColor(SCAST(qreal, SU_C_ARG(column.mean)));
       } else {
-        // If not: update limits
-        if (minWfY > yB)
-          minWfY = yB;
-
-        if (maxWfY < yA)
-          maxWfY = yA;
+        lineColor = m_foreground;
       }
 
-      // Next pixel column is going to be different, draw!
-      if (currX != nextX) {
-        p.setOpacity(m_showEnvelope ? .33 : .66);
-        p.setPen(QPen(m_foreground));
-        p.drawLine(currX, minWfY, currX, maxWfY);
+      if (raster.isValid()) {
+        raster.vline(
+              x,
+              pxHigh,
+              pxLow,
+              m_showPhase
+              ? WaveRasterizer::pixel(lineColor, envOpacity)
+              : envPixel);
+      } else {
+        p->setOpacity(envOpacity);
+        p->setPen(QPen(lineColor));
+        p->drawLine(x, pxHigh, x, pxLow);
       }
-
-      prevYA = yA;
-      prevYB = yB;
     }
 
-    prevX    = currX;
+    // Draw waveform. These seem inverted. They are not: remember that
+    // vertical screen coordinates are top-down, while regular cartesian
+    // coordinates are bottom-up.
+    if (m_showWaveform) {
+      int minWfY = SCAST(int, value2px(cast(column.hi)));
+      int maxWfY = SCAST(int, value2px(cast(column.lo)));
 
-    havePrev = true;
+      if (raster.isValid()) {
+        raster.vline(x, minWfY, maxWfY, wfPixel);
+      } else {
+        p->setOpacity(wfOpacity);
+        p->setPen(QPen(m_foreground));
+        p->drawLine(x, minWfY, x, maxWfY);
+      }
+    }
   }
 }
 
+////////////////////////////// Layer cache /////////////////////////////////////
+WaveViewColumnState
+WaveView::columnState(int level) const
+{
+  WaveViewColumnState state;
+
+  state.level      = level;
+  state.blockBits  = m_waveTree->getBlockBits();
+  state.compact    = m_waveTree->getCompactLevels();
+  state.firstLevel = m_waveTree->getFirstLevel();
+  state.generation = m_waveTree->getGeneration();
+  state.width      = m_width;
+  state.leftMargin = m_leftMargin;
+  state.sampPerPx  = m_sampPerPx;
+
+  return state;
+}
+
+WaveViewLayerState
+WaveView::layerState(void) const
+{
+  WaveViewLayerState state;
+
+  state.height        = m_height;
+  state.min           = m_min;
+  state.max           = m_max;
+  state.foreground    = m_foreground.rgba();
+  state.realComponent = m_realComponent;
+  state.showWaveform  = m_showWaveform;
+  state.showEnvelope  = m_showEnvelope;
+  state.showPhase     = m_showPhase;
+  state.showPhaseDiff = m_showPhaseDiff;
+  state.phaseDiffOrigin   = m_phaseDiffOrigin;
+  state.phaseDiffContrast = m_phaseDiffContrast;
+
+  return state;
+}
+
 void
-WaveView::drawWave(QPainter &painter)
+WaveView::invalidateLayer(void)
 {
-  setGeometry(painter.device()->width(), painter.device()->height());
+  m_columnsValid = false;
+  m_layerValid   = false;
+}
 
-  if (!m_waveTree->isComplete()) {
-    QFont font;
-    QFontMetrics metrics(font);
-    QString text;
-    QRect rect;
-    int tw;
-
-    if (m_waveTree->isRunning()) {
-      if (m_lastProgressMax > 0)
-        text = QString::asprintf(
-              "Processing waveform (%ld%% complete)",
-              100 * m_lastProgressCurr / m_lastProgressMax);
+//
+// Zoomed-out waveforms are summarized into per-column data and rendered
+// into a layer, both kept between frames. If nothing but the horizontal
+// position changed (e.g. when panning or autoscrolling), both are shifted
+// by a whole number of pixels and only the columns that were exposed, or
+// whose blocks were not final yet, are queried from the tree again. The
+// layer may end up displaced by up to half a pixel from the actual start
+// of the view. This is tracked in m_columnStart (an absolute, fractional
+// sample), so errors never build up.
+//
+// Changes in the display mode, colors or vertical zoom leave the columns
+// untouched: the layer is just repainted from them.
+//
+void
+WaveView::drawWaveLayer(QPainter &painter, int level)
+{
+  WaveViewColumnState columns = columnState(level);
+  WaveViewLayerState state = layerState();
+  int bits = (level + 1) * m_waveTree->getBlockBits();
+  SUSCOUNT blockMask = (SCAST(SUSCOUNT, 1) << bits) - 1;
+  SUSCOUNT built = m_waveTree->isComplete()
+      ? m_waveTree->getLength()
+      : m_waveTree->getBuilt();
+  qreal start = SCAST(qreal, m_start) + SCAST(qreal, m_discarded);
+  SUSCOUNT final = m_discarded + built;
+  qreal columnStart;
+  int left = 0, right = m_width;
+  int dx = 0;
+  bool reuse = false;
+
+  if (m_layer.width() != m_width || m_layer.height() != m_height) {
+    m_layer = QImage(m_width, m_height, QImage::Format_ARGB32_Premultiplied);
+    m_layerValid = false;
+  }
+
+  WaveRasterizer raster(m_layer);
+
+  // Blocks are aligned to the first sample kept, which must not have moved
+  // from one block to another.
+  if (m_columnsValid
+      && columns == m_columnState
+      && ((m_discarded - m_columnDiscarded) & blockMask) == 0) {
+    qreal shift = (start - m_columnStart) / m_sampPerPx;
+
+    if (std::fabs(shift) < m_width) {
+      SUSCOUNT stable = MIN(m_columnFinal, final);
+      qreal oldest, newest;
+
+      dx = SCAST(int, std::round(shift));
+      m_columnStart += dx * m_sampPerPx;
+
+      // Columns at the edges (former or current) do not have all their
+      // blocks summarized
+      left  = 1;
+      right = m_width - 1;
+
+      if (dx < 0)
+        left = -dx + 1;
       else
-        text = "Processing waveform";
-    } else {
-      text = "No wave data";
+        right = m_width - dx - 1;
+
+      // Columns of samples that were discarded
+      if (m_discarded != m_columnDiscarded) {
+        oldest = (SCAST(qreal, m_discarded) - m_columnStart) / m_sampPerPx;
+        left = MAX(left, SCAST(int, oldest + m_leftMargin) + 2);
+      }
+
+      // Columns of blocks that were not final
+      stable = m_discarded + ((stable - m_discarded) & ~blockMask);
+      newest = (SCAST(qreal, stable) - m_columnStart) / m_sampPerPx;
+      right = MIN(right, SCAST(int, newest + m_leftMargin) - 1);
+
+      left  = qBound(0, left,  m_width);
+      right = qBound(0, right, m_width);
+      reuse = left < right;
     }
+  }
+
+  if (reuse) {
+    if (dx > 0)
+      std::move(
+            m_columns.begin() + dx,
+            m_columns.end(),
+            m_columns.begin());
+    else if (dx < 0)
+      std::move_backward(
+            m_columns.begin(),
+            m_columns.end() + dx,
+            m_columns.end());
+  } else {
+    left  = m_width;
+    right = m_width;
+    m_columnStart = start;
+  }
+
+  columnStart = m_columnStart - SCAST(qreal, m_discarded);
+
+  if (left > 0)
+    updateColumns(level, columnStart, 0, left);
+
+  if (right < m_width)
+    updateColumns(level, columnStart, right, m_width);
+
+  m_columnState     = columns;
+  m_columnFinal     = final;
+  m_columnDiscarded = m_discarded;
+  m_columnsValid    = true;
+
+  // Only the updated columns need to be painted again
+  if (reuse && m_layerValid && state == m_layerState) {
+    raster.scroll(-dx);
+
+    if (left > 0) {
+      raster.clear(0, left);
+      drawColumns(nullptr, raster, 0, left);
+    }
+
+    if (right < m_width) {
+      raster.clear(right, m_width);
+      drawColumns(nullptr, raster, right, m_width);
+    }
+  } else {
+    raster.clear(0, m_width);
+    drawColumns(nullptr, raster, 0, m_width);
+  }
+
+  m_layerState = state;
+  m_layerValid = true;
+
+  painter.drawImage(0, 0, m_layer);
+}
+
+void
+WaveView::drawStatus(QPainter &painter, bool top)
+{
+  QFont font;
+  QFontMetrics metrics(font);
+  QString text;
+  QRect rect;
+  int tw;
+
+  if (m_waveTree->isRunning()) {
+    if (m_lastProgressMax > 0)
+      text = QString::asprintf(
+            "Processing waveform (%ld%% complete)",
+            100 * m_lastProgressCurr / m_lastProgressMax);
+    else
+      text = "Processing waveform";
+  } else {
+    text = "No wave data";
+  }
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
-    tw = metrics.horizontalAdvance(text);
+  tw = metrics.horizontalAdvance(text);
 #else
-    tw = metrics.width(text);
+  tw = metrics.width(text);
 #endif // QT_VERSION_CHECK
 
-    rect.setRect(
-          m_width / 2 - tw / 2,
-          m_height / 2 - metrics.height() / 2,
-          tw,
-          metrics.height());
+  rect.setRect(
+        m_width / 2 - tw / 2,
+        top ? metrics.height() / 2 : m_height / 2 - metrics.height() / 2,
+        tw,
+        metrics.height());
+
+  painter.setPen(m_foreground);
+  painter.setOpacity(1);
+  painter.drawText(rect, Qt::AlignHCenter | Qt::AlignBottom, text);
+}
+
+void
+WaveView::drawWave(QPainter &painter)
+{
+  bool building;
+
+  setGeometry(painter.device()->width(), painter.device()->height());
 
-    painter.setPen(m_foreground);
-    painter.setOpacity(1);
-    painter.drawText(rect, Qt::AlignHCenter | Qt::AlignBottom, text);
+  // While the tree is being built, the part that is ready is drawn as well
+  building = !m_waveTree->isComplete()
+      && m_waveTree->isRunning()
+      && m_waveTree->getBuilt() > 0;
 
+  if (!m_waveTree->isComplete() && !building) {
+    drawStatus(painter, false);
     return;
   }
 
@@ -491,35 +1050,210 @@ WaveView::drawWave(QPainter &painter)
   if (m_waveTree->getLength() == 0 || m_waveTree->size() == 0)
     return;
 
+  if (m_sharedTree != nullptr)
+    WaveTreeRegistry::instance()->touch(m_sharedTree);
+
   painter.save();
-  if (m_sampPerPx > 8.) {
+  if (m_sampPerPx > 2 * m_waveTree->getBlockLength()) {
     int level;
 
     // More than one waveform block per pixel. The waveform is zoomed out. Compute the
-    // zoom-out level. The idea is that:
+    // zoom-out level. The idea is that, for a fan-out of N (4 by default):
     //
-    // sampPerPx in (0, 8):    Draw lines
-    // sampPerPx in [8, 64):   Level 0
-    // sampPerPx in [64, 512): Level 1
+    // sampPerPx in (0, 2N):       Draw lines
+    // sampPerPx in [2N, N^2):     Level 0
+    // sampPerPx in [N^2, N^3):    Level 1
     //
 
     level = SCAST(
           int,
-          floor(log(m_sampPerPx) / log(WAVEFORM_BLOCK_LENGTH))) - 1;
+          floor(log(m_sampPerPx) / log(m_waveTree->getBlockLength()))) - 1;
     if (level >= m_waveTree->size())
       level = m_waveTree->size() - 1;
 
-    drawWaveFar(painter, level);
+    if (m_waveTree == &m_ownWaveTree || m_sharedTree != nullptr) {
+      drawWaveLayer(painter, level);
+    } else {
+      // Borrowed trees may change behind our back: nothing is kept
+      WaveRasterizer raster(painter);
+      invalidateLayer();
+      updateColumns(level, SCAST(qreal, m_start), 0, m_width);
+      drawColumns(&painter, raster, 0, m_width);
+    }
   } else {
     drawWaveClose(painter);
   }
   painter.restore();
+
+  if (m_showEye)
+    drawEye(painter);
+
+  if (building)
+    drawStatus(painter, true);
+}
+
+//
+// The eye diagram is drawn over its first trace (i.e. the periodic
+// selection), in place of the waveform. Vertical zoom changes start it
+// over, as the rows of the diagram follow the view.
+//
+void
+WaveView::drawEye(QPainter &painter)
+{
+  WaveEyeParams params;
+  qreal x0, x1;
+
+  params.origin        = m_eyeOrigin;
+  params.period        = m_eyePeriod;
+  params.span          = m_eyeSpan;
+  params.min           = m_min;
+  params.max           = m_max;
+  params.realComponent = m_realComponent;
+
+  m_eye.setParams(params);
+
+  if (!m_eye.render(m_eyeImage, m_foreground))
+    return;
+
+  x0 = samp2px(m_eyeOrigin);
+  x1 = samp2px(m_eyeOrigin + m_eyeSpan * m_eyePeriod);
+
+  painter.save();
+  painter.setCompositionMode(QPainter::CompositionMode_Source);
+  painter.setRenderHint(QPainter::SmoothPixmapTransform);
+  painter.drawImage(QRectF(x0, 0, x1 - x0, m_height), m_eyeImage);
+  painter.restore();
+}
+
+//
+// Fan-out of the tree. Borrowed trees belong to someone else, and therefore
+// they cannot be reconfigured from here.
+//
+bool
+WaveView::setBlockBits(int bits)
+{
+  // Shared trees are looked up again with the new fan-out
+  if (m_shareTrees && m_sharedTree != nullptr) {
+    WaveSamples data = m_sharedTree->getSamples();
+    SUSCOUNT length = m_sharedTree->getLength();
+
+    if (!m_ownWaveTree.setBlockBits(bits))
+      return false;
+
+    if (bits != m_sharedTree->getBlockBits())
+      attachTree(
+            WaveTreeRegistry::instance()->acquire(data, length, bits),
+            true);
+
+    return true;
+  }
+
+  if (m_waveTree != &m_ownWaveTree)
+    return false;
+
+  return m_waveTree->setBlockBits(bits);
+}
+
+void
+WaveView::setCompactLevels(bool compact)
+{
+  if (m_waveTree == &m_ownWaveTree)
+    m_waveTree->setCompactLevels(compact);
+}
+
+//
+// Sidecar file where the tree is saved once built, and loaded from when the
+// same capture (stored in the source file) is displayed again. An empty
+// path disables the cache.
+//
+void
+WaveView::setCachePath(QString const &path, QString const &source)
+{
+  if (m_waveTree == &m_ownWaveTree)
+    m_waveTree->setCachePath(path, source);
+}
+
+//
+// Views showing the same buffer share a single tree, taken from the tree
+// registry. The registry decides whether these trees are compact (it
+// compacts them when running out of memory budget), and they are not
+// saved to the on-disk cache.
+//
+// Buffers that slide (see discardBuffer) or belong to the widget (see
+// setPrivateBuffer) are never shared, as their contents change under the
+// tree. The setting is kept nevertheless, and applies again from the next
+// call to setBuffer() with a buffer that can be shared.
+//
+void
+WaveView::setShareTrees(bool share)
+{
+  WaveSamples data = m_waveTree->getSamples();
+  SUSCOUNT length = m_waveTree->getLength();
+
+  if (share == m_shareTrees)
+    return;
+
+  m_shareTrees = share;
+
+  if (share) {
+    if (m_waveTree == &m_ownWaveTree && length > 0 && canShareBuffer()) {
+      attachTree(
+            WaveTreeRegistry::instance()->acquire(
+              data,
+              length,
+              m_ownWaveTree.getBlockBits()),
+            true);
+      BLOCKSIG(&m_ownWaveTree, clear());
+    }
+  } else if (m_sharedTree != nullptr) {
+    attachTree(&m_ownWaveTree, false);
+    setTreeBuffer(data, length, true);
+  }
+}
+
+//
+// Persistence mode. Traces of span periods start every period samples,
+// counting from origin.
+//
+void
+WaveView::setShowEye(bool show)
+{
+  m_showEye = show;
+  m_eye.setEnabled(show);
+}
+
+void
+WaveView::setEyePeriod(qreal origin, qreal period, int span)
+{
+  m_eyeOrigin = origin;
+  m_eyePeriod = period;
+  m_eyeSpan   = span;
+}
+
+//
+// Private buffers belong to the widget, which grows, slides or refills
+// them in place. Trees built from them would be read by other views while
+// the buffer moves, so they are never shared. This must be set before the
+// buffer is passed to setBuffer().
+//
+void
+WaveView::setPrivateBuffer(bool isPrivate)
+{
+  m_privateBuffer = isPrivate;
+
+  // The tree of the view is filled by the next setBuffer()
+  if (isPrivate && m_sharedTree != nullptr)
+    attachTree(&m_ownWaveTree, false);
 }
 
 void
 WaveView::safeCancel()
 {
-  m_waveTree->safeCancel();
+  m_eye.safeCancel();
+
+  // Shared trees may still be in use by other views
+  if (m_sharedTree == nullptr)
+    m_waveTree->safeCancel();
 }
 
 void
@@ -529,11 +1263,43 @@ WaveView::setBuffer(const std::vector<SUCOMPLEX> *buf)
 }
 
 void
-WaveView::setBuffer(const SUCOMPLEX *data, size_t size)
+WaveView::setBuffer(WaveSamples const &data, size_t size)
 {
+  m_sliding = false;
+
+  m_eye.setBuffer(data, size);
+  setTreeBuffer(data, size, true);
+}
+
+//
+// Trees are built again from scratch if rebuild is set. Otherwise, data is
+// taken as the same buffer as before, possibly with more samples.
+//
+void
+WaveView::setTreeBuffer(WaveSamples const &data, size_t size, bool rebuild)
+{
+  if (canShareBuffer()) {
+    if (size > 0) {
+      attachTree(
+            WaveTreeRegistry::instance()->acquire(
+              data,
+              size,
+              m_ownWaveTree.getBlockBits(),
+              rebuild),
+            true);
+
+      if (m_ownWaveTree.getLength() > 0)
+        BLOCKSIG(&m_ownWaveTree, clear());
+      return;
+    }
+
+    attachTree(&m_ownWaveTree, false);
+  }
+
   if (m_waveTree == &m_ownWaveTree) {
     BLOCKSIG(m_waveTree, clear());
     m_waveTree->reprocess(data, size);
+    invalidateLayer();
   }
 }
 
@@ -544,18 +1310,62 @@ WaveView::refreshBuffer(const std::vector<SUCOMPLEX> *buf)
 }
 
 void
-WaveView::refreshBuffer(const SUCOMPLEX *data, size_t size)
+WaveView::refreshBuffer(WaveSamples const &data, size_t size)
 {
-  if (m_waveTree == &m_ownWaveTree)
+  m_eye.extendBuffer(data, size);
+
+  // The registry extends shared trees that grew in place
+  if (canShareBuffer())
+    setTreeBuffer(data, size, false);
+  else if (m_waveTree == &m_ownWaveTree)
     m_waveTree->reprocess(data, size);
 }
 
+//
+// Called before the first count samples of the buffer are dropped. The
+// view keeps showing the same time interval.
+//
+// Sliding windows are not shared: the contents of the buffer are about to
+// change. The shared tree is retired from the registry, so every view that
+// holds it (this one included) falls back to a tree of its own. This view
+// goes on with it (built on refresh) until it is given a new buffer, but
+// getShareTrees() still reports what the caller asked for. isTreeShared()
+// tells which one is in use.
+//
+bool
+WaveView::discardBuffer(SUSCOUNT count)
+{
+  if (m_sharedTree != nullptr) {
+    WaveTreeRegistry::instance()->retire(m_sharedTree->getSamples());
+  } else if (m_waveTree != &m_ownWaveTree) {
+    return false;
+  } else if (!m_waveTree->discard(count)) {
+    return false;
+  }
+
+  m_t0    += SCAST(qreal, count) * m_deltaT;
+  m_start -= SCAST(qint64, count);
+  m_end   -= SCAST(qint64, count);
+
+  m_discarded += count;
+  m_sliding    = true;
+
+  m_eye.discard(count);
+  m_eyeOrigin -= SCAST(qreal, count);
+
+  return true;
+}
+
 ///////////////////////////////////// Slots ////////////////////////////////////
 void
 WaveView::onReady(void)
 {
   m_lastProgressCurr = m_lastProgressMax = 0;
 
+  // Other views may have rebuilt a shared tree from scratch
+  if (m_sharedTree != nullptr)
+    invalidateLayer();
+
   emit ready();
 }
 
@@ -568,3 +1378,17 @@ WaveView::onProgress(quint64 curr, quint64 max)
   emit progress();
 }
 
+//
+// The buffer of a shared tree is about to change under it. The view stops
+// reading it until its owner hands it over again (see refreshBuffer).
+//
+void
+WaveView::onTreeRetired(WaveViewTree *tree)
+{
+  if (tree != m_sharedTree)
+    return;
+
+  m_eye.safeCancel();
+  attachTree(&m_ownWaveTree, false);
+}
+
@@ -21,13 +21,104 @@
 
 #include <QPainter>
 #include <WaveViewTree.h>
+#include "WaveEyeDiagram.h"
+
+// Narrower images are not worth splitting between threads
+#define WAVE_VIEW_TILE_MIN_WIDTH 256
+
+class WaveRasterizer;
+
+//
+// Screen-space summary of the blocks that fall in a pixel column of a
+// zoomed-out waveform. It does not depend on the vertical zoom nor on the
+// display mode, so the columns only need to be queried again from the tree
+// when the horizontal zoom or the data change.
+//
+struct WaveViewColumn {
+  SUCOMPLEX lo;       // Waveform range (joined to the previous column)
+  SUCOMPLEX hi;
+  SUCOMPLEX mean;     // Of the last block in the column
+  SUFLOAT   envelope; // Largest envelope in the column
+  SUFLOAT   freq;     // Of the last block in the column
+  bool      valid;    // Some block ends in this column
+  bool      first;    // First block of the view (no envelope drawn)
+};
+
+//
+// Everything but the horizontal position that affects which blocks fall
+// in each column. Cached columns are only reused if it did not change.
+//
+struct WaveViewColumnState {
+  int      level = -1;
+  int      blockBits = 0;
+  bool     compact = false;
+  int      firstLevel = 0; // Levels below it were evicted
+  unsigned generation = 0; // See WaveViewTree::getGeneration()
+  int      width = 0;
+  int      leftMargin = 0;
+  qreal    sampPerPx = 0;
+
+  inline bool
+  operator==(WaveViewColumnState const &other) const
+  {
+    return level == other.level
+        && blockBits == other.blockBits
+        && compact == other.compact
+        && firstLevel == other.firstLevel
+        && generation == other.generation
+        && width == other.width
+        && leftMargin == other.leftMargin
+        && sampPerPx == other.sampPerPx;
+  }
+};
+
+//
+// Everything that affects how cached columns are painted. The layer cache
+// is only scrolled if it did not change, and fully repainted (from the
+// cached columns) otherwise.
+//
+struct WaveViewLayerState {
+  int      height = 0;
+  qreal    min = 0;
+  qreal    max = 0;
+  QRgb     foreground = 0;
+  bool     realComponent = false;
+  bool     showWaveform = false;
+  bool     showEnvelope = false;
+  bool     showPhase = false;
+  bool     showPhaseDiff = false;
+  unsigned phaseDiffOrigin = 0;
+  qreal    phaseDiffContrast = 0;
+
+  inline bool
+  operator==(WaveViewLayerState const &other) const
+  {
+    return height == other.height
+        && min == other.min
+        && max == other.max
+        && foreground == other.foreground
+        && realComponent == other.realComponent
+        && showWaveform == other.showWaveform
+        && showEnvelope == other.showEnvelope
+        && showPhase == other.showPhase
+        && showPhaseDiff == other.showPhaseDiff
+        && phaseDiffOrigin == other.phaseDiffOrigin
+        && phaseDiffContrast == other.phaseDiffContrast;
+  }
+};
 
 class WaveView : public QObject {
   Q_OBJECT
 
+  friend class WaveViewTileTask;
+
   // Rescaled wave data
   WaveViewTree  m_ownWaveTree;
   WaveViewTree *m_waveTree = nullptr;
+  WaveViewTree *m_sharedTree = nullptr; // Held from the tree registry
+  bool          m_shareTrees = false;
+  bool          m_sliding    = false; // Buffer slides: never shared
+  bool          m_privateBuffer = false; // See setPrivateBuffer()
 
   // Representation properties
   QColor m_foreground;
@@ -56,6 +147,28 @@ class WaveView : public QObject {
   uint64_t m_lastProgressCurr = 0;
   uint64_t m_lastProgressMax = 0;
 
+  // Column and layer caches of the zoomed-out waveform. Positions are
+  // absolute, i.e. they count the samples discarded so far.
+  std::vector<WaveViewColumn> m_columns;
+  WaveViewColumnState         m_columnState;
+  bool                        m_columnsValid = false;
+  qreal                       m_columnStart = 0;
+  SUSCOUNT                    m_columnFinal = 0;
+  SUSCOUNT                    m_columnDiscarded = 0;
+  SUSCOUNT                    m_discarded = 0;
+
+  QImage                      m_layer;
+  WaveViewLayerState          m_layerState;
+  bool                        m_layerValid = false;
+
+  // Persistence (eye diagram) of the periodic selection
+  WaveEyeDiagram              m_eye;
+  QImage                      m_eyeImage;
+  bool                        m_showEye = false;
+  qreal                       m_eyeOrigin = 0;
+  qreal                       m_eyePeriod = 0;
+  int                         m_eyeSpan = 1;
+
   // Representation config
   qreal m_phaseDiffContrast = 1;
   unsigned int m_phaseDiffOrigin = 0;
@@ -80,8 +193,25 @@ class WaveView : public QObject {
     return m_colorTable[(index + m_phaseDiffOrigin) & 0xff];
   }
 
+  void attachTree(WaveViewTree *tree, bool shared);
+
+  // Whether the current buffer may be displayed from a registry tree
+  inline bool
+  canShareBuffer(void) const
+  {
+    return m_shareTrees && !m_sliding && !m_privateBuffer;
+  }
+  void setTreeBuffer(WaveSamples const &, size_t, bool rebuild);
   void drawWaveClose(QPainter &painter);
-  void drawWaveFar(QPainter &painter, int level);
+  void updateColumns(int level, qreal start, int x0, int x1);
+  void updateColumnsTile(int level, qreal start, int x0, int x1);
+  void updateColumnsTileRaw(qreal start, int x0, int x1);
+  void drawColumns(QPainter *painter, WaveRasterizer &raster, int x0, int x1);
+  void drawWaveLayer(QPainter &painter, int level);
+  WaveViewColumnState columnState(int level) const;
+  WaveViewLayerState layerState(void) const;
+  void drawEye(QPainter &painter);
+  void drawStatus(QPainter &painter, bool top);
 
 public:
   // Inlined methods
@@ -133,16 +263,28 @@ public:
     return (t - m_t0) * m_sampleRate;
   }
 
+  inline qreal
+  px2samp(qreal px, qreal start) const
+  {
+    return (px - m_leftMargin) * m_sampPerPx + start;
+  }
+
+  inline qreal
+  samp2px(qreal samp, qreal start) const
+  {
+    return (samp - start) / m_sampPerPx + m_leftMargin;
+  }
+
   inline qreal
   px2samp(qreal px) const
   {
-    return (px - m_leftMargin) * m_sampPerPx + static_cast<qreal>(m_start);
+    return px2samp(px, static_cast<qreal>(m_start));
   }
 
   inline qreal
   samp2px(qreal samp) const
   {
-    return (samp - static_cast<qreal>(m_start)) / m_sampPerPx + m_leftMargin;
+    return samp2px(samp, static_cast<qreal>(m_start));
   }
 
   inline qreal
@@ -217,6 +359,9 @@ public:
     unsigned int i;
     for (i = 0; i < 256; ++i)
       m_colorTable[i] = table[i];
+
+    // Cached columns do not depend on colors
+    m_layerValid = false;
   }
 
   inline qreal
@@ -309,6 +454,61 @@ public:
     m_showWaveform = show;
   }
 
+  inline int
+  getBlockBits(void) const
+  {
+    return m_waveTree->getBlockBits();
+  }
+
+  inline bool
+  getCompactLevels(void) const
+  {
+    return m_waveTree->getCompactLevels();
+  }
+
+  inline bool
+  getShareTrees(void) const
+  {
+    return m_shareTrees;
+  }
+
+  // Whether the tree actually comes from the registry (see setShareTrees)
+  inline bool
+  isTreeShared(void) const
+  {
+    return m_sharedTree != nullptr;
+  }
+
+  inline bool
+  isEyeVisible(void) const
+  {
+    return m_showEye;
+  }
+
+  inline qreal
+  getEyeOrigin(void) const
+  {
+    return m_eyeOrigin;
+  }
+
+  inline qreal
+  getEyePeriod(void) const
+  {
+    return m_eyePeriod;
+  }
+
+  inline int
+  getEyeSpan(void) const
+  {
+    return m_eyeSpan;
+  }
+
+  inline SUSCOUNT
+  getDiscardAlignment(void) const
+  {
+    return m_waveTree->getDiscardAlignment();
+  }
+
   inline bool
   isEnvelopeVisible(void) const
   {
@@ -345,6 +545,18 @@ public:
     m_waveTree->computeLimits(start, end, limits);
   }
 
+  inline bool
+  computeRangeStats(qint64 start, qint64 end, WaveRangeStats &stats) const
+  {
+    return m_waveTree->computeRangeStats(start, end, stats);
+  }
+
+  inline qint64
+  search(qint64 from, const WaveSearchQuery &query) const
+  {
+    return m_waveTree->search(from, query);
+  }
+
   inline int
   width() const
   {
@@ -369,21 +581,32 @@ public:
   void setVerticalZoom(qreal min, qreal max);
   void setGeometry(int width, int height);
   void borrowTree(WaveView &);
+  bool setBlockBits(int bits);
+  void setCompactLevels(bool compact);
+  void setShareTrees(bool share);
+  void setPrivateBuffer(bool isPrivate);
+  void setShowEye(bool show);
+  void setEyePeriod(qreal origin, qreal period, int span);
+  void setCachePath(QString const &path, QString const &source);
   void drawWave(QPainter &painter);
+  void invalidateLayer(void);
   void setBuffer(const std::vector<SUCOMPLEX> *);
-  void setBuffer(const SUCOMPLEX *, size_t);
+  void setBuffer(WaveSamples const &, size_t);
 
   void safeCancel();
   void refreshBuffer(const std::vector<SUCOMPLEX> *);
-  void refreshBuffer(const SUCOMPLEX *, size_t);
+  void refreshBuffer(WaveSamples const &, size_t);
+  bool discardBuffer(SUSCOUNT count);
   // Slots
 public slots:
   void onReady(void);
   void onProgress(quint64, quint64);
+  void onTreeRetired(WaveViewTree *);
 
   // Signals
 signals:
   void ready(void);
   void progress(void);
+  void eyeProgress(void);
 };
 #endif // WAVEVIEW_H
@@ -19,18 +19,586 @@
 
 #include "WaveViewTree.h"
 #include "WaveWorker.h"
+#include "WaveKernels.h"
 #include <QDeadlineTimer>
+#include <QThreadPool>
+#include <QFile>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDateTime>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <sigutils/util/compat-time.h>
 
+#ifdef Q_OS_UNIX
+#  include <sys/stat.h>
+#endif // Q_OS_UNIX
+
 #define WAVE_VIEW_TREE_WORKER_PIECE_LENGTH 4096
-#define WAVE_VIEW_TREE_FEEDBACK_MS          500
+#define WAVE_VIEW_TREE_FEEDBACK_MS          40 // Partial trees are drawn
 #define WAVE_VIEW_TREE_MIN_PARALLEL_SIZE   WAVE_VIEW_TREE_WORKER_PIECE_LENGTH
 
+// Pieces of integer captures are converted once, without touching the heap
+#if WAVE_VIEW_TREE_WORKER_PIECE_LENGTH + (1 << WAVEFORM_BLOCK_MAX_BITS) + 1 \
+  > WAVE_SAMPLE_SPAN_LOCAL_LENGTH
+#  error "Pieces of the tree worker do not fit in the local buffer of spans"
+#endif
+
+//
+// Multi-core construction. Span boundaries are aligned to
+// 2^WAVE_VIEW_TREE_SPAN_ALIGN_BITS samples, which means that all levels
+// whose blocks are not bigger than this (whatever the fan-out of the tree)
+// can be built independently for each span. The minimum size guarantees
+// that the last of these levels is never the top of the tree.
+//
+#define WAVE_VIEW_TREE_SPAN_ALIGN_BITS      16
+#define WAVE_VIEW_TREE_SPAN_MIN_SIZE        (1 << 22)
+#define WAVE_VIEW_TREE_SPANS_PER_THREAD     4
+
+//
+// On-disk cache of the tree. Only captures big enough to make the build
+// noticeable are cached. Captures are identified by the size, modification
+// time and inode of their file (see WaveViewTreeCacheSource), and then by
+// their length and a hash of evenly spaced chunks of samples. The hash
+// alone would miss changes between the chunks.
+//
+#define WAVE_VIEW_TREE_CACHE_MAGIC          "SUWVTREE"
+#define WAVE_VIEW_TREE_CACHE_VERSION        3
+#define WAVE_VIEW_TREE_CACHE_ENDIANNESS     0x01020304
+#define WAVE_VIEW_TREE_CACHE_MIN_SIZE       (1 << 22)
+#define WAVE_VIEW_TREE_CACHE_HASH_CHUNKS    64
+#define WAVE_VIEW_TREE_CACHE_HASH_CHUNK     8192
+
+//
+// Bounds read from the levels are widened by this fraction before pruning,
+// so that rounding (of magnitudes or compact levels) never hides a hit.
+//
+#define WAVE_VIEW_TREE_SEARCH_SLACK         1e-5f
+
+//
+// Trees over the memory budget may drop their lower levels (see
+// evictLevel()), as long as the blocks of the first level left do not
+// exceed 2^WAVE_VIEW_TREE_EVICT_MAX_BITS samples: queries read up to two of
+// them from the raw samples.
+//
+#define WAVE_VIEW_TREE_EVICT_MAX_BITS       12
+
+struct WaveViewTreeCacheHeader {
+  char      magic[8];
+  uint32_t  version;
+  uint32_t  endianness;
+  uint32_t  sampleSize;
+  uint32_t  blockBits;
+  uint64_t  length;
+  uint64_t  levels;
+  uint64_t  sourceSize;  // Capture file the tree was built from
+  uint64_t  sourceInode;
+  int64_t   sourceMtime;
+  uint8_t   hash[32];    // Sampled, see WaveViewTree::contentHash()
+  SUCOMPLEX oMin;
+  SUCOMPLEX oMax;
+  SUCOMPLEX mean;
+  SUFLOAT   rms;
+  SuWidgetsHelpers::KahanState state;
+};
+
+// Followed by one of these per level, and the levels themselves
+struct WaveViewTreeCacheLevel {
+  uint64_t size;
+  uint64_t offset;
+};
+
+////////////////////////////// WaveLimitVector ////////////////////////////////
+static inline size_t
+alignLimitArray(size_t size)
+{
+  return (size + WAVEFORM_LIMIT_VECTOR_ALIGN - 1)
+      & ~SCAST(size_t, WAVEFORM_LIMIT_VECTOR_ALIGN - 1);
+}
+
+WaveLimitVector::WaveLimitVector(const WaveLimitVector &other)
+{
+  *this = other;
+}
+
+WaveLimitVector::WaveLimitVector(WaveLimitVector &&other) noexcept
+{
+  swap(other);
+}
+
+WaveLimitVector &
+WaveLimitVector::operator=(const WaveLimitVector &other)
+{
+  WaveLimitVector tmp;
+  size_t n = other.m_size;
+
+  if (this != &other) {
+    if (other.m_compact) {
+      tmp.allocateCompact(n);
+      tmp.m_quant = other.m_quant;
+
+      std::copy(other.m_qMin,      other.m_qMin + 2 * n,     tmp.m_qMin);
+      std::copy(other.m_qMax,      other.m_qMax + 2 * n,     tmp.m_qMax);
+      std::copy(other.m_qMean,     other.m_qMean + 2 * n,    tmp.m_qMean);
+      std::copy(other.m_qEnvelope, other.m_qEnvelope + n,    tmp.m_qEnvelope);
+      std::copy(other.m_qFreq,     other.m_qFreq + n,        tmp.m_qFreq);
+      std::copy(other.m_sum,       other.m_sum + n,          tmp.m_sum);
+      std::copy(other.m_power,     other.m_power + n,        tmp.m_power);
+    } else {
+      tmp.reserve(n);
+
+      std::copy(other.m_min,      other.m_min + n,      tmp.m_min);
+      std::copy(other.m_max,      other.m_max + n,      tmp.m_max);
+      std::copy(other.m_mean,     other.m_mean + n,     tmp.m_mean);
+      std::copy(other.m_envelope, other.m_envelope + n, tmp.m_envelope);
+      std::copy(other.m_freq,     other.m_freq + n,     tmp.m_freq);
+      std::copy(other.m_sum,      other.m_sum + n,      tmp.m_sum);
+      std::copy(other.m_power,    other.m_power + n,    tmp.m_power);
+    }
+
+    tmp.m_size = n;
+    swap(tmp);
+  }
+
+  return *this;
+}
+
+WaveLimitVector &
+WaveLimitVector::operator=(WaveLimitVector &&other) noexcept
+{
+  WaveLimitVector tmp(std::move(other));
+
+  swap(tmp);
+
+  return *this;
+}
+
+WaveLimitVector::~WaveLimitVector()
+{
+  free(m_alloc);
+}
+
+void
+WaveLimitVector::swap(WaveLimitVector &other) noexcept
+{
+  std::swap(m_alloc,    other.m_alloc);
+  std::swap(m_min,      other.m_min);
+  std::swap(m_max,      other.m_max);
+  std::swap(m_mean,     other.m_mean);
+  std::swap(m_envelope, other.m_envelope);
+  std::swap(m_freq,     other.m_freq);
+  std::swap(m_sum,      other.m_sum);
+  std::swap(m_power,    other.m_power);
+  std::swap(m_size,     other.m_size);
+  std::swap(m_capacity, other.m_capacity);
+  std::swap(m_front,    other.m_front);
+
+  std::swap(m_compact,   other.m_compact);
+  std::swap(m_qMin,      other.m_qMin);
+  std::swap(m_qMax,      other.m_qMax);
+  std::swap(m_qMean,     other.m_qMean);
+  std::swap(m_qEnvelope, other.m_qEnvelope);
+  std::swap(m_qFreq,     other.m_qFreq);
+  std::swap(m_quant,     other.m_quant);
+}
+
+//
+// All field arrays share a single block of storage. Each of them starts at a
+// cache-line boundary, provided that the storage itself is aligned.
+//
+size_t
+WaveLimitVector::storageSize(size_t capacity)
+{
+  return 4 * alignLimitArray(capacity * sizeof(SUCOMPLEX))
+       + 3 * alignLimitArray(capacity * sizeof(SUFLOAT));
+}
+
+size_t
+WaveLimitVector::compactStorageSize(size_t capacity)
+{
+  return 3 * alignLimitArray(2 * capacity * sizeof(uint16_t))
+       + 2 * alignLimitArray(capacity * sizeof(uint16_t))
+       + alignLimitArray(capacity * sizeof(SUCOMPLEX))
+       + alignLimitArray(capacity * sizeof(SUFLOAT));
+}
+
+//
+// Heap memory held by this vector. Attached storage (e.g. levels mapped
+// from the cache) belongs to someone else and is not counted.
+//
+size_t
+WaveLimitVector::memoryUsage(void) const
+{
+  if (m_alloc == nullptr)
+    return 0;
+
+  return WAVEFORM_LIMIT_VECTOR_ALIGN + (m_compact
+      ? compactStorageSize(m_capacity)
+      : storageSize(m_capacity + m_front));
+}
+
+void
+WaveLimitVector::layout(void *storage, size_t capacity)
+{
+  size_t cplxSize  = alignLimitArray(capacity * sizeof(SUCOMPLEX));
+  size_t floatSize = alignLimitArray(capacity * sizeof(SUFLOAT));
+  uintptr_t base   = RCAST(uintptr_t, storage);
+
+  m_min      = RCAST(SUCOMPLEX *, base);
+  m_max      = RCAST(SUCOMPLEX *, base + cplxSize);
+  m_mean     = RCAST(SUCOMPLEX *, base + 2 * cplxSize);
+  m_sum      = RCAST(SUCOMPLEX *, base + 3 * cplxSize);
+  m_envelope = RCAST(SUFLOAT *,   base + 4 * cplxSize);
+  m_freq     = RCAST(SUFLOAT *,   base + 4 * cplxSize + floatSize);
+  m_power    = RCAST(SUFLOAT *,   base + 4 * cplxSize + 2 * floatSize);
+  m_capacity = capacity;
+  m_front    = 0;
+}
+
+void
+WaveLimitVector::reallocate(size_t capacity)
+{
+  WaveLimitVector tmp;
+  void *alloc;
+
+  alloc = malloc(storageSize(capacity) + WAVEFORM_LIMIT_VECTOR_ALIGN);
+  if (alloc == nullptr)
+    throw std::bad_alloc();
+
+  tmp.m_alloc = alloc;
+  tmp.m_size  = m_size;
+  tmp.layout(
+        RCAST(void *, alignLimitArray(RCAST(uintptr_t, alloc))),
+        capacity);
+
+  std::copy(m_min,      m_min + m_size,      tmp.m_min);
+  std::copy(m_max,      m_max + m_size,      tmp.m_max);
+  std::copy(m_mean,     m_mean + m_size,     tmp.m_mean);
+  std::copy(m_envelope, m_envelope + m_size, tmp.m_envelope);
+  std::copy(m_freq,     m_freq + m_size,     tmp.m_freq);
+  std::copy(m_sum,      m_sum + m_size,      tmp.m_sum);
+  std::copy(m_power,    m_power + m_size,    tmp.m_power);
+
+  swap(tmp);
+}
+
+//
+// Uses external storage (laid out as storageSize(size) bytes) that must
+// outlive this vector, or at least until it is reallocated.
+//
+void
+WaveLimitVector::attach(void *storage, size_t size)
+{
+  WaveLimitVector tmp;
+
+  tmp.layout(storage, size);
+  tmp.m_size = size;
+
+  swap(tmp);
+}
+
+//
+// Quantization. Codes are clamped to the valid range (and undefined values
+// mapped to 0), as the range of the waveform only bounds them up to
+// rounding errors.
+//
+static inline uint16_t
+quantizeLimit(SUFLOAT value, SUFLOAT offset, SUFLOAT step, int rounding)
+{
+  SUFLOAT q;
+
+  if (!(step > 0))
+    return 0;
+
+  q = (value - offset) / step;
+
+  if (rounding < 0)
+    q = std::floor(q);
+  else if (rounding > 0)
+    q = std::ceil(q);
+  else
+    q = std::round(q);
+
+  if (!(q > 0))
+    return 0;
+
+  if (q > WAVEFORM_LIMIT_QUANT_MAX)
+    return WAVEFORM_LIMIT_QUANT_MAX;
+
+  return SCAST(uint16_t, q);
+}
+
+static inline void
+quantizeComplex(
+    uint16_t *codes,
+    size_t i,
+    SUCOMPLEX value,
+    const WaveLimitQuantizer &q,
+    int rounding)
+{
+  codes[2 * i] = quantizeLimit(
+        SU_C_REAL(value),
+        SU_C_REAL(q.offset),
+        q.reStep,
+        rounding);
+  codes[2 * i + 1] = quantizeLimit(
+        SU_C_IMAG(value),
+        SU_C_IMAG(q.offset),
+        q.imStep,
+        rounding);
+}
+
+//
+// Block sums are kept at full precision after the codes, as range statistics
+// must stay exact regardless of the storage mode.
+//
+void
+WaveLimitVector::allocateCompact(size_t size)
+{
+  size_t cplxSize = alignLimitArray(2 * size * sizeof(uint16_t));
+  size_t realSize = alignLimitArray(size * sizeof(uint16_t));
+  size_t sumSize  = alignLimitArray(size * sizeof(SUCOMPLEX));
+  WaveLimitVector tmp;
+  uintptr_t base;
+  void *alloc;
+
+  alloc = malloc(compactStorageSize(size) + WAVEFORM_LIMIT_VECTOR_ALIGN);
+  if (alloc == nullptr)
+    throw std::bad_alloc();
+
+  base = alignLimitArray(RCAST(uintptr_t, alloc));
+
+  tmp.m_alloc     = alloc;
+  tmp.m_compact   = true;
+  tmp.m_qMin      = RCAST(uint16_t *, base);
+  tmp.m_qMax      = RCAST(uint16_t *, base + cplxSize);
+  tmp.m_qMean     = RCAST(uint16_t *, base + 2 * cplxSize);
+  tmp.m_qEnvelope = RCAST(uint16_t *, base + 3 * cplxSize);
+  tmp.m_qFreq     = RCAST(uint16_t *, base + 3 * cplxSize + realSize);
+  tmp.m_sum       = RCAST(SUCOMPLEX *, base + 3 * cplxSize + 2 * realSize);
+  tmp.m_power     = RCAST(
+        SUFLOAT *,
+        base + 3 * cplxSize + 2 * realSize + sumSize);
+  tmp.m_capacity  = size;
+
+  swap(tmp);
+}
+
+void
+WaveLimitVector::compact(const WaveLimitQuantizer &q)
+{
+  WaveLimitVector tmp;
+
+  if (m_compact)
+    return;
+
+  tmp.allocateCompact(m_size);
+  tmp.m_quant = q;
+  tmp.m_size  = m_size;
+
+  for (size_t i = 0; i < m_size; ++i) {
+    quantizeComplex(tmp.m_qMin,  i, m_min[i],  q, -1);
+    quantizeComplex(tmp.m_qMax,  i, m_max[i],  q, +1);
+    quantizeComplex(tmp.m_qMean, i, m_mean[i], q,  0);
+
+    tmp.m_qEnvelope[i] = quantizeLimit(m_envelope[i], 0, q.envStep, +1);
+    tmp.m_qFreq[i]     = quantizeLimit(m_freq[i], q.freqOffset, q.freqStep, 0);
+  }
+
+  std::copy(m_sum,   m_sum + m_size,   tmp.m_sum);
+  std::copy(m_power, m_power + m_size, tmp.m_power);
+
+  swap(tmp);
+}
+
+void
+WaveLimitVector::expand(void)
+{
+  WaveLimitVector tmp;
+
+  if (!m_compact)
+    return;
+
+  tmp.reserve(m_size);
+  tmp.m_size = m_size;
+
+  for (size_t i = 0; i < m_size; ++i)
+    tmp.set(i, (*this)[i]);
+
+  swap(tmp);
+}
+
+void
+WaveLimitVector::reserve(size_t capacity)
+{
+  expand();
+
+  if (capacity > m_capacity)
+    reallocate(capacity);
+}
+
+void
+WaveLimitVector::resize(size_t size)
+{
+  WaveLimits empty;
+
+  expand();
+
+  // Grow geometrically, levels are usually extended a few blocks at a time.
+  // Room left by erased elements is reused if moving the rest is cheap.
+  if (size > m_capacity) {
+    if (m_alloc != nullptr
+        && m_front >= m_size
+        && size <= m_capacity + m_front)
+      rewind();
+    else
+      reallocate(MAX(size, 2 * m_capacity));
+  }
+
+  for (size_t i = m_size; i < size; ++i)
+    set(i, empty);
+
+  m_size = size;
+}
+
+//
+// Moves the elements back to the beginning of the storage, reclaiming the
+// room left by eraseFront().
+//
+void
+WaveLimitVector::rewind(void)
+{
+  size_t n = m_front;
+
+  if (n == 0)
+    return;
+
+  std::copy(m_min,      m_min + m_size,      m_min - n);
+  std::copy(m_max,      m_max + m_size,      m_max - n);
+  std::copy(m_mean,     m_mean + m_size,     m_mean - n);
+  std::copy(m_envelope, m_envelope + m_size, m_envelope - n);
+  std::copy(m_freq,     m_freq + m_size,     m_freq - n);
+  std::copy(m_sum,      m_sum + m_size,      m_sum - n);
+  std::copy(m_power,    m_power + m_size,    m_power - n);
+
+  m_min      -= n;
+  m_max      -= n;
+  m_mean     -= n;
+  m_envelope -= n;
+  m_freq     -= n;
+  m_sum      -= n;
+  m_power    -= n;
+  m_capacity += n;
+  m_front     = 0;
+}
+
+//
+// Erasing just moves the start of the arrays forward. Elements are only
+// moved back (see rewind()) once the erased ones outnumber them, so each
+// rewind moves fewer elements than were erased since the previous one:
+// the amortized cost is O(count), no matter the size of the vector.
+//
+void
+WaveLimitVector::eraseFront(size_t count)
+{
+  expand();
+
+  if (count >= m_size) {
+    m_size = 0;
+    rewind();
+    return;
+  }
+
+  m_min      += count;
+  m_max      += count;
+  m_mean     += count;
+  m_envelope += count;
+  m_freq     += count;
+  m_sum      += count;
+  m_power    += count;
+  m_capacity -= count;
+  m_front    += count;
+  m_size     -= count;
+
+  // Attached storage may be read-only, a copy of the rest is made instead
+  if (m_front > m_size) {
+    if (m_alloc != nullptr)
+      rewind();
+    else
+      reallocate(m_size);
+  }
+}
+
+void
+WaveLimitVector::clear(void)
+{
+  m_size = 0;
+}
+
+//////////////////////////////// WaveSpanTask //////////////////////////////////
+WaveSpanTask::WaveSpanTask(
+    WaveWorker *worker,
+    SUSCOUNT start,
+    SUSCOUNT end,
+    int depth)
+{
+  m_worker = worker;
+  m_start  = start;
+  m_end    = end;
+  m_depth  = depth;
+
+  setAutoDelete(false);
+}
+
+void
+WaveSpanTask::run(void)
+{
+  SUSCOUNT i = m_start;
+  SUSCOUNT length;
+
+  try {
+    while (i <= m_end && !m_worker->isCancelled()) {
+      length = WAVE_VIEW_TREE_WORKER_PIECE_LENGTH;
+      if (i + length > m_end + 1)
+        length = m_end + 1 - i;
+
+      WaveSampleSpan data(
+            m_worker->m_owner->m_data,
+            i,
+            length,
+            m_worker->buildHistory(i));
+
+      SuWidgetsHelpers::calcLimits(&m_min, &m_max, data, length, i > m_start);
+      SuWidgetsHelpers::kahanAccumulate(data, length, &m_state);
+
+      m_wEnd = m_worker->build(i, i + length - 1, data, m_depth);
+
+      i += length;
+    }
+  } catch (std::bad_alloc &) {
+    m_worker->cancel();
+  }
+
+  m_done.release();
+}
+
+void
+WaveSpanTask::waitForDone(void)
+{
+  m_done.acquire();
+}
+
+///////////////////////////////// WaveWorker ///////////////////////////////////
 WaveWorker::WaveWorker(WaveViewTree *owner, SUSCOUNT since, QObject *parent) :
-  QObject(parent)
+  QObject(parent), m_cancelFlag(false)
 {
   m_owner = owner;
   m_since = since;
+  m_cachePath = owner->m_cachePath;
+  m_cacheSource = owner->m_cacheSource;
 }
 
 WaveWorker::~WaveWorker()
@@ -38,20 +606,23 @@ WaveWorker::~WaveWorker()
 
 }
 
-void
+SUFLOAT
 WaveWorker::buildNextView(
     WaveViewTree::iterator p,
     SUSCOUNT start,
     SUSCOUNT end,
-    SUFLOAT  wEnd)
+    SUFLOAT  wEnd,
+    int      depth)
 {
   WaveViewTree::iterator next = p + 1;
+  int bits = m_owner->m_blockBits;
+  SUSCOUNT blockLength = SCAST(SUSCOUNT, m_owner->m_blockLength);
   SUSCOUNT length, nextLength;
   SUFLOAT nextWEnd = 1;
   SUFLOAT currWend = 1;
 
-  start >>= WAVEFORM_BLOCK_BITS;
-  start <<= WAVEFORM_BLOCK_BITS;
+  start >>= bits;
+  start <<= bits;
 
   if (next == m_owner->end()) {
     m_owner->append(WaveLimitVector());
@@ -61,45 +632,59 @@ WaveWorker::buildNextView(
   }
 
   length = p->size();
-  nextLength = (length + WAVEFORM_BLOCK_LENGTH - 1) >> WAVEFORM_BLOCK_BITS;
+  nextLength = (length + blockLength - 1) >> bits;
 
   if (next->size() < nextLength)
     next->resize(nextLength);
 
-  for (auto i = start; i <= end; i += WAVEFORM_BLOCK_LENGTH) {
-    const WaveLimits *data = p->data() + i;
+  for (auto i = start; i <= end; i += blockLength) {
     WaveLimits thisLimit;
-    quint64 left = MIN(end + 1 - i, WAVEFORM_BLOCK_LENGTH);
+    quint64 left = MIN(end + 1 - i, blockLength);
 
-    if (i + WAVEFORM_BLOCK_LENGTH > end) {
+    if (i + blockLength > end) {
       currWend = wEnd;
-      nextWEnd = SU_ASFLOAT(left) / WAVEFORM_BLOCK_LENGTH;
+      nextWEnd = SU_ASFLOAT(left) / blockLength;
     }
 
-    WaveViewTree::calcLimitsBlock(thisLimit, data, left, currWend);
+    WaveViewTree::calcLimitsBlock(thisLimit, *p, i, left, currWend);
+    WaveViewTree::calcSumsBlock(thisLimit, *p, i, left);
 
-    (*next)[i >> WAVEFORM_BLOCK_BITS] = thisLimit;
+    next->set(i >> bits, thisLimit);
   }
 
-  if (next->size() > 1)
-    buildNextView(
+  if (next->size() > 1 && depth != 1)
+    return buildNextView(
         next,
-        start >> WAVEFORM_BLOCK_BITS,
-        end   >> WAVEFORM_BLOCK_BITS,
-        nextWEnd);
+        start >> bits,
+        end   >> bits,
+        nextWEnd,
+        depth - 1);
+
+  return nextWEnd;
 }
 
-void
-WaveWorker::build(SUSCOUNT start, SUSCOUNT end)
+//
+// Builds the lowest level from samples [start, end]. `data` points to the
+// sample `start`, and the ones before it given by buildHistory() must be
+// readable too.
+//
+SUFLOAT
+WaveWorker::build(
+    SUSCOUNT start,
+    SUSCOUNT end,
+    const SUCOMPLEX *data,
+    int depth)
 {
   WaveViewTree::iterator next = m_owner->begin();
-  const SUCOMPLEX *data;
+  int bits = m_owner->m_blockBits;
+  SUSCOUNT blockLength = SCAST(SUSCOUNT, m_owner->m_blockLength);
   SUSCOUNT length = m_owner->m_length;
   SUSCOUNT nextLength;
   SUFLOAT wEnd = 1;
 
-  start >>= WAVEFORM_BLOCK_BITS;
-  start <<= WAVEFORM_BLOCK_BITS;
+  data -= start & (blockLength - 1);
+  start >>= bits;
+  start <<= bits;
 
   if (next == m_owner->end()) {
     m_owner->append(WaveLimitVector());
@@ -107,127 +692,349 @@ WaveWorker::build(SUSCOUNT start, SUSCOUNT end)
     next->resize(1);
   }
 
-  nextLength = (length + WAVEFORM_BLOCK_LENGTH - 1) >> WAVEFORM_BLOCK_BITS;
+  nextLength = (length + blockLength - 1) >> bits;
 
   if (next->size() < nextLength)
     next->resize(nextLength);
 
-  for (SUSCOUNT i = start; i <= end; i += WAVEFORM_BLOCK_LENGTH) {
+  for (SUSCOUNT i = start; i <= end; i += blockLength) {
     WaveLimits thisLimit;
-    quint64 left  = MIN(end + 1 - i, WAVEFORM_BLOCK_LENGTH);
-    data          = m_owner->m_data + i;
+    quint64 left  = MIN(end + 1 - i, blockLength);
+    const SUCOMPLEX *block = data + (i - start);
 
-    if (i + WAVEFORM_BLOCK_LENGTH > end)
-      wEnd = SU_ASFLOAT(left) / WAVEFORM_BLOCK_LENGTH;
+    if (i + blockLength > end)
+      wEnd = SU_ASFLOAT(left) / blockLength;
 
-    WaveViewTree::calcLimitsBuf(thisLimit, data, left, start == 0);
+    // Only the very first block lacks a previous sample. This makes the
+    // result independent of how the waveform was split in pieces.
+    WaveViewTree::calcLimitsBuf(thisLimit, block, left, i == 0);
+    WaveViewTree::calcSumsBuf(thisLimit, block, left);
 
-    (*next)[i >> WAVEFORM_BLOCK_BITS] = thisLimit;
+    next->set(i >> bits, thisLimit);
   }
 
-  if (next->size() > 1)
-    buildNextView(
+  if (next->size() > 1 && depth != 1)
+    return buildNextView(
           next,
-          start >> WAVEFORM_BLOCK_BITS,
-          end   >> WAVEFORM_BLOCK_BITS,
-          wEnd);
-}
-
-void
-WaveWorker::cancel()
-{
-  QMutexLocker locker(&m_mutex);
+          start >> bits,
+          end   >> bits,
+          wEnd,
+          depth - 1);
 
-  m_cancelFlag = true;
+  return wEnd;
 }
 
-void
-WaveWorker::run(void)
+//
+// Builds the tree from `since` up to the end of the waveform using all
+// available cores. The lower levels of each span (and its partial sums for
+// the mean and RMS) are built by span tasks in the global thread pool,
+// while this thread merges the partial sums in order and stitches the
+// upper levels as soon as the spans are ready. Returns the number of samples
+// that were actually processed.
+//
+SUSCOUNT
+WaveWorker::buildParallel(SUSCOUNT since)
 {
-  SUSCOUNT i = m_since;
-  SUSCOUNT length;
+  std::vector<std::unique_ptr<WaveSpanTask>> tasks;
+  QThreadPool *pool = QThreadPool::globalInstance();
+  SUSCOUNT length = m_owner->m_length;
+  SUSCOUNT align  = SCAST(SUSCOUNT, 1) << WAVE_VIEW_TREE_SPAN_ALIGN_BITS;
+  SUSCOUNT spanLength;
+  SUSCOUNT start, next;
+  SUSCOUNT i = since;
+  int bits  = m_owner->m_blockBits;
+  int depth = WAVE_VIEW_TREE_SPAN_ALIGN_BITS / bits;
+  int spanBits = depth * bits;
+  int spanCount = pool->maxThreadCount() * WAVE_VIEW_TREE_SPANS_PER_THREAD;
+  bool first = since == 0;
   struct timeval tv, otv, diff;
   SUSDIFF time_ms;
 
+  // Restored on cancellation, so that the tree can be resumed from `since`
+  SuWidgetsHelpers::KahanState state = m_owner->m_state;
+  SUCOMPLEX mean = m_owner->m_mean;
+  SUFLOAT   rms  = m_owner->m_rms;
+
   gettimeofday(&otv, nullptr);
 
-  while (i < m_owner->m_length && !m_cancelFlag) {
-    m_mutex.lock();
+  spanLength = (length - since) / SCAST(SUSCOUNT, spanCount);
+  spanLength = ((spanLength + align - 1) / align) * align;
 
-    length = WAVE_VIEW_TREE_WORKER_PIECE_LENGTH;
-    if (i + length >= m_owner->m_length)
-      length = m_owner->m_length - i;
+  // Levels must not be reallocated while the spans are being built. This
+  // is a no-op if the owner allocated them before starting the worker.
+  m_owner->allocateLevels(length);
+
+  for (start = since; start < length; start = next) {
+    next = (start / spanLength + 1) * spanLength;
+    if (next > length)
+      next = length;
+
+    tasks.push_back(
+          std::unique_ptr<WaveSpanTask>(
+            new WaveSpanTask(this, start, next - 1, depth)));
+  }
+
+  for (auto &task : tasks)
+    pool->start(task.get());
 
-    SuWidgetsHelpers::calcLimits(
-          &m_owner->m_oMin,
-          &m_owner->m_oMax,
-          m_owner->m_data + i,
-          length,
-          i > 0);
+  for (auto &task : tasks) {
+    task->waitForDone();
 
-    SuWidgetsHelpers::kahanMeanAndRms(
+    if (m_cancelFlag)
+      continue;
+
+    // Spans also compute their share of the mean and RMS
+    SuWidgetsHelpers::kahanMerge(&m_owner->m_state, task->m_state);
+    SuWidgetsHelpers::kahanResult(
           &m_owner->m_mean,
           &m_owner->m_rms,
-          m_owner->m_data + i,
-          length,
-          &m_owner->m_state);
+          m_owner->m_state);
+    i = task->m_end + 1;
+
+    if (first) {
+      m_owner->m_oMin = task->m_min;
+      m_owner->m_oMax = task->m_max;
+      first = false;
+    } else {
+      m_owner->m_oMin =
+          MIN(SU_C_REAL(m_owner->m_oMin), SU_C_REAL(task->m_min))
+          + SU_I * MIN(SU_C_IMAG(m_owner->m_oMin), SU_C_IMAG(task->m_min));
+      m_owner->m_oMax =
+          MAX(SU_C_REAL(m_owner->m_oMax), SU_C_REAL(task->m_max))
+          + SU_I * MAX(SU_C_IMAG(m_owner->m_oMax), SU_C_IMAG(task->m_max));
+    }
+
+    // Stitch the levels that are shared between spans
+    WaveViewTree::iterator last = m_owner->begin() + (depth - 1);
 
     try {
-      build(i, i + length - 1);
+      if (last->size() > 1)
+        buildNextView(
+            last,
+            task->m_start >> spanBits,
+            task->m_end   >> spanBits,
+            task->m_wEnd);
     } catch (std::bad_alloc &) {
       m_cancelFlag = true;
     }
 
-    gettimeofday(&tv, nullptr);
-    timersub(&tv, &otv, &diff);
+    // Spans are stitched in order: everything before this one is final
+    if (!m_cancelFlag) {
+      m_owner->m_built.store(i, std::memory_order_release);
 
-    time_ms = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+      gettimeofday(&tv, nullptr);
+      timersub(&tv, &otv, &diff);
 
-    if (time_ms > WAVE_VIEW_TREE_FEEDBACK_MS) {
-      otv = tv;
-      emit progress(i, m_owner->m_length - 1);
+      time_ms = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+
+      if (time_ms > WAVE_VIEW_TREE_FEEDBACK_MS) {
+        otv = tv;
+        emit progress(i, length - 1);
+      }
     }
+  }
 
-    i += length;
-    m_mutex.unlock();
+  if (m_cancelFlag) {
+    m_owner->m_state = state;
+    m_owner->m_mean  = mean;
+    m_owner->m_rms   = rms;
+    m_owner->m_built.store(since, std::memory_order_release);
+    return since;
   }
 
-  m_running = false;
-  m_finishedCondition.wakeAll();
+  m_owner->m_built.store(i, std::memory_order_release);
 
-  if (m_cancelFlag)
-    emit cancelled();
-  else
-    emit finished();
+  return i;
 }
 
+//
+// Lock-free: the flag is polled between pieces and blocks, so there is no
+// need to wait for the current piece to finish.
+//
 void
-WaveWorker::wait()
+WaveWorker::cancel()
 {
-  while (m_running) {
-    m_mutex.lock();
-    m_finishedCondition.wait(&m_mutex, 100);
-    m_mutex.unlock();
-  }
+  m_cancelFlag.store(true, std::memory_order_release);
 }
 
-///////////////////////////////// WaveViewTree /////////////////////////////////
-WaveViewTree::WaveViewTree(QObject *parent) : QObject(parent)
+void
+WaveWorker::restart(SUSCOUNT since)
 {
-  m_workerThread = new QThread(this);
+  QMutexLocker locker(&m_mutex);
 
-  m_workerThread->start();
+  m_since      = since;
+  m_running    = true;
+  m_cancelFlag = false;
+  m_cacheSaved = false;
 }
 
-WaveViewTree::~WaveViewTree()
+//
+// Streaming append. Moves the goal of a running worker further, without
+// the need of cancelling it. Data cannot be replaced while span tasks are
+// running, so the new goal is applied after the parallel phase. Returns
+// false if the worker is done (or about to be), and a new one is needed.
+//
+// This is called from the thread of the owner, which is the only one
+// allowed to allocate levels (readers may be around). The worker is
+// between pieces here, as it holds the mutex while building them.
+//
+bool
+WaveWorker::extendTo(WaveSamples const &data, SUSCOUNT length)
 {
-  if (m_currentWorker != nullptr) {
-    m_currentWorker->cancel();
-    m_currentWorker->wait();
+  QMutexLocker locker(&m_mutex);
+
+  if (!m_running || m_cancelFlag || m_cacheSaved)
+    return false;
+
+  if (m_parallel) {
+    m_pendingData   = data;
+    m_pendingLength = length;
+    m_havePending   = true;
+  } else {
+    try {
+      m_owner->allocateLevels(length);
+    } catch (std::bad_alloc &) {
+      return false;
+    }
+
+    m_owner->m_data   = data;
+    m_owner->m_length = length;
   }
 
-  m_workerThread->quit();
-  m_workerThread->wait();
+  return true;
+}
+
+void
+WaveWorker::run(void)
+{
+  SUSCOUNT i = m_since;
+  SUSCOUNT length;
+  struct timeval tv, otv, diff;
+  SUSDIFF time_ms;
+
+  if (m_owner->m_length - i >= WAVE_VIEW_TREE_SPAN_MIN_SIZE
+      && QThreadPool::globalInstance()->maxThreadCount() > 1) {
+    m_mutex.lock();
+    m_parallel = true;
+    m_mutex.unlock();
+
+    i = buildParallel(i);
+
+    // Goals beyond the allocated levels are left to the owner
+    m_mutex.lock();
+    m_parallel = false;
+    if (m_havePending) {
+      m_owner->m_data = m_pendingData;
+      if (m_pendingLength <= m_owner->allocatedLength()) {
+        m_owner->m_length = m_pendingLength;
+        m_havePending     = false;
+      }
+    }
+    m_mutex.unlock();
+  }
+
+  gettimeofday(&otv, nullptr);
+
+  for (;;) {
+    m_mutex.lock();
+
+    // Deciding to stop must be atomic with respect to extendTo()
+    if (m_cancelFlag || i >= m_owner->m_length) {
+      // Save the tree before leaving. Goals cannot move from now on.
+      if (!m_cancelFlag
+          && !m_cacheSaved
+          && !m_cachePath.isEmpty()
+          && i >= WAVE_VIEW_TREE_CACHE_MIN_SIZE) {
+        WaveSamples data = m_owner->m_data;
+        m_cacheSaved = true;
+        m_mutex.unlock();
+        m_owner->saveCache(m_cachePath, m_cacheSource, data, i, &m_cancelFlag);
+        continue;
+      }
+
+      m_running = false;
+      m_mutex.unlock();
+      break;
+    }
+
+    length = WAVE_VIEW_TREE_WORKER_PIECE_LENGTH;
+    if (i + length >= m_owner->m_length)
+      length = m_owner->m_length - i;
+
+    try {
+      WaveSampleSpan data(m_owner->m_data, i, length, buildHistory(i));
+
+      build(i, i + length - 1, data);
+
+      SuWidgetsHelpers::calcLimits(
+            &m_owner->m_oMin,
+            &m_owner->m_oMax,
+            data,
+            length,
+            i > 0);
+
+      SuWidgetsHelpers::kahanMeanAndRms(
+            &m_owner->m_mean,
+            &m_owner->m_rms,
+            data,
+            length,
+            &m_owner->m_state);
+
+      i += length;
+      m_owner->m_built.store(i, std::memory_order_release);
+    } catch (std::bad_alloc &) {
+      m_cancelFlag = true;
+    }
+
+    gettimeofday(&tv, nullptr);
+    timersub(&tv, &otv, &diff);
+
+    time_ms = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+
+    if (time_ms > WAVE_VIEW_TREE_FEEDBACK_MS) {
+      otv = tv;
+      emit progress(i, m_owner->m_length - 1);
+    }
+
+    m_mutex.unlock();
+  }
+
+  m_finishedCondition.wakeAll();
+
+  if (m_cancelFlag)
+    emit cancelled();
+  else
+    emit finished();
+}
+
+void
+WaveWorker::wait()
+{
+  while (m_running) {
+    m_mutex.lock();
+    m_finishedCondition.wait(&m_mutex, 100);
+    m_mutex.unlock();
+  }
+}
+
+///////////////////////////////// WaveViewTree /////////////////////////////////
+WaveViewTree::WaveViewTree(QObject *parent) : QObject(parent)
+{
+  m_workerThread = new QThread(this);
+  m_serialWorker = new WaveWorker(this, 0, this);
+
+  m_workerThread->start();
+}
+
+WaveViewTree::~WaveViewTree()
+{
+  if (m_currentWorker != nullptr) {
+    m_currentWorker->cancel();
+    m_currentWorker->wait();
+  }
+
+  m_workerThread->quit();
+  m_workerThread->wait();
 }
 
 void
@@ -241,53 +1048,51 @@ WaveViewTree::safeCancel(void)
   }
 }
 
-void
-WaveViewTree::calcLimitsBlock(
-    WaveLimits &thisLimit,
-    const WaveLimits *__restrict data,
-    size_t len,
-    SUFLOAT wEnd)
+//
+// Samples that fit in the levels as currently allocated. Level sizes only
+// depend on the size of the first one.
+//
+SUSCOUNT
+WaveViewTree::allocatedLength(void) const
 {
-  //
-  // wEnd is a last-block completeness factor (or weight). Can be
-  // from 1 / BLOCK_LENGTH to 1.
-  //
+  if (isEmpty())
+    return 0;
 
-  if (len > 0) {
-    SUFLOAT kInv   = 1.f / (SU_ASFLOAT(len) + wEnd - 1);
+  return SCAST(SUSCOUNT, at(0).size()) << m_blockBits;
+}
 
-    if (!thisLimit.isInitialized()) {
-      thisLimit.min = data[0].min;
-      thisLimit.max = data[0].max;
-    }
+void
+WaveViewTree::allocateLevels(SUSCOUNT length)
+{
+  SUSCOUNT levelLength = length;
+  int level = 0;
 
-    for (SUSCOUNT j = 0; j < len; ++j) {
-      if (data[j].max.real() > thisLimit.max.real())
-        thisLimit.max = data[j].max.real() + thisLimit.max.imag() * SU_I;
-      if (data[j].max.imag() > thisLimit.max.imag())
-        thisLimit.max = thisLimit.max.real() + data[j].max.imag() * SU_I;
+  do {
+    levelLength =
+        (levelLength + m_blockLength - 1) >> m_blockBits;
 
-      if (data[j].min.real() < thisLimit.min.real())
-        thisLimit.min = data[j].min.real() + thisLimit.min.imag() * SU_I;
-      if (data[j].min.imag() < thisLimit.min.imag())
-        thisLimit.min = thisLimit.min.real() + data[j].min.imag() * SU_I;
+    if (level == size())
+      append(WaveLimitVector());
 
-      if (thisLimit.envelope < data[j].envelope)
-        thisLimit.envelope = data[j].envelope;
+    if ((*this)[level].size() < levelLength)
+      (*this)[level].resize(levelLength);
 
-      if (j == len - 1) {
-        thisLimit.mean += wEnd * data[j].mean;
-        thisLimit.freq += wEnd * data[j].freq;
-      } else {
-        thisLimit.mean += data[j].mean;
-        thisLimit.freq += data[j].freq;
-      }
-    }
+    ++level;
+  } while (levelLength > 1);
+}
 
-    // Compute mean, mean frequency and finish
-    thisLimit.mean *= kInv;
-    thisLimit.freq *= kInv;
-  }
+void
+WaveViewTree::calcLimitsBlock(
+    WaveLimits &thisLimit,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len,
+    SUFLOAT wEnd)
+{
+  if (data.isCompact())
+    WaveKernels::calcLimitsBlockCompact(thisLimit, data, offset, len, wEnd);
+  else
+    WaveKernels::limitsBlock()(thisLimit, data, offset, len, wEnd);
 }
 
 void
@@ -297,44 +1102,52 @@ WaveViewTree::calcLimitsBuf(
     size_t len,
     bool first)
 {
-  if (len > 0) {
-    SUFLOAT env2  = 0;
-    SUFLOAT kInv  = 1.f / SU_ASFLOAT(len);
-
-    thisLimit.envelope *= thisLimit.envelope;
-
-    if (!thisLimit.isInitialized()) {
-      thisLimit.min = data[0];
-      thisLimit.max = data[0];
-    }
-
-    for (SUSCOUNT j = 0; j < len; ++j) {
-      if (data[j].real() > thisLimit.max.real())
-        thisLimit.max = data[j].real() + thisLimit.max.imag() * SU_I;
-      if (data[j].imag() > thisLimit.max.imag())
-        thisLimit.max = thisLimit.max.real() + data[j].imag() * SU_I;
-
-      if (data[j].real() < thisLimit.min.real())
-        thisLimit.min = data[j].real() + thisLimit.min.imag() * SU_I;
-      if (data[j].imag() < thisLimit.min.imag())
-        thisLimit.min = thisLimit.min.real() + data[j].imag() * SU_I;
+  WaveKernels::limitsBuf()(thisLimit, data, len, first);
+}
 
-      env2 = SU_C_REAL(data[j] * SU_C_CONJ(data[j]));
-      if (thisLimit.envelope < env2)
-        thisLimit.envelope = env2;
+//
+// Block sums are plain sums: errors only grow with the depth of the tree,
+// and range statistics merge them with compensation.
+//
+void
+WaveViewTree::calcSumsBuf(
+    WaveLimits &thisLimit,
+    const SUCOMPLEX *__restrict data,
+    size_t len)
+{
+  const SUFLOAT *x = RCAST(const SUFLOAT *, data);
+  SUFLOAT re = 0, im = 0, power = 0;
 
-      if (!first)
-        thisLimit.freq += SU_C_ARG(data[j] * SU_C_CONJ(data[j - 1]));
+  for (size_t i = 0; i < len; ++i) {
+    re    += x[2 * i];
+    im    += x[2 * i + 1];
+    power += x[2 * i] * x[2 * i] + x[2 * i + 1] * x[2 * i + 1];
+  }
 
-      thisLimit.mean += data[j];
-    }
+  thisLimit.sum   = re + im * SU_I;
+  thisLimit.power = power;
+}
 
-    thisLimit.freq *= kInv;
-    thisLimit.mean *= kInv;
-    thisLimit.envelope = sqrt(thisLimit.envelope);
+void
+WaveViewTree::calcSumsBlock(
+    WaveLimits &thisLimit,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len)
+{
+  const SUCOMPLEX *sum = data.sumData() + offset;
+  const SUFLOAT *power = data.powerData() + offset;
+  SUCOMPLEX sumAcc = 0;
+  SUFLOAT powerAcc = 0;
+
+  for (size_t i = 0; i < len; ++i) {
+    sumAcc   += sum[i];
+    powerAcc += power[i];
   }
-}
 
+  thisLimit.sum   = sumAcc;
+  thisLimit.power = powerAcc;
+}
 
 void
 WaveViewTree::computeLimitsFar(
@@ -343,8 +1156,8 @@ WaveViewTree::computeLimitsFar(
     qint64 end,
     WaveLimits &limits) const
 {
-  qint64 blockStart = (start + WAVEFORM_BLOCK_LENGTH - 1) >> WAVEFORM_BLOCK_BITS;
-  qint64 blockEnd   = (end >> WAVEFORM_BLOCK_BITS) - 1;
+  qint64 blockStart = (start + m_blockLength - 1) >> m_blockBits;
+  qint64 blockEnd   = (end >> m_blockBits) - 1;
   WaveLimits newLimits;
   int prefixBlocks;
   int suffixBlocks;
@@ -361,15 +1174,16 @@ WaveViewTree::computeLimitsFar(
   if (end >= SCAST(qint64, p->size()))
     end = SCAST(qint64, p->size()) - 1;
 
-  prefixBlocks = SCAST(int, (blockStart << WAVEFORM_BLOCK_BITS) - start);
-  suffixBlocks = SCAST(int, end - (blockEnd << WAVEFORM_BLOCK_BITS) - 1);
-  centerBlocks = ((blockEnd - blockStart + 1) << WAVEFORM_BLOCK_BITS);
+  prefixBlocks = SCAST(int, (blockStart << m_blockBits) - start);
+  suffixBlocks = SCAST(int, end - (blockEnd << m_blockBits) - 1);
+  centerBlocks = ((blockEnd - blockStart + 1) << m_blockBits);
 
   if (blockStart < blockEnd) {
     if (prefixBlocks > 0) {
       calcLimitsBlock(
             limits,
-            p->data() + start,
+            *p,
+            SCAST(size_t, start),
             SCAST(size_t, prefixBlocks));
       mean_p = limits.mean;
       limits.mean = 0;
@@ -378,7 +1192,8 @@ WaveViewTree::computeLimitsFar(
     if (suffixBlocks > 0) {
       calcLimitsBlock(
             limits,
-            p->data() + end + 1 - suffixBlocks,
+            *p,
+            SCAST(size_t, end + 1 - suffixBlocks),
             SCAST(size_t, suffixBlocks));
       mean_s = limits.mean;
       limits.mean = 0;
@@ -398,7 +1213,8 @@ WaveViewTree::computeLimitsFar(
   } else {
     calcLimitsBlock(
           limits,
-          p->data() + start,
+          *p,
+          SCAST(size_t, start),
           SCAST(size_t, end - start + 1));
   }
 }
@@ -406,8 +1222,9 @@ WaveViewTree::computeLimitsFar(
 void
 WaveViewTree::computeLimits(qint64 start, qint64 end, WaveLimits &limits) const
 {
-  qint64 blockStart = (start + WAVEFORM_BLOCK_LENGTH - 1) >> WAVEFORM_BLOCK_BITS;
-  qint64 blockEnd   = (end >> WAVEFORM_BLOCK_BITS) - 1;
+  qint64 blockStart, blockEnd;
+  qint64 built = SCAST(qint64, getBuilt());
+  int bits = baseBits();
   WaveLimits newLimits;
   int prefixSamples;
   int suffixSamples;
@@ -430,15 +1247,29 @@ WaveViewTree::computeLimits(qint64 start, qint64 end, WaveLimits &limits) const
   if (end >= SCAST(qint64, m_length))
     end = SCAST(qint64, m_length) - 1;
 
-  prefixSamples = SCAST(int, (blockStart << WAVEFORM_BLOCK_BITS) - start);
-  suffixSamples = SCAST(int, end - (blockEnd << WAVEFORM_BLOCK_BITS) - 1);
-  centerSamples = ((blockEnd - blockStart + 1) << WAVEFORM_BLOCK_BITS);
+  // While building, only the summarized prefix can be read
+  if (end >= built)
+    end = built - 1;
+
+  if (start > end)
+    return;
+
+  blockStart = (start + (SCAST(qint64, 1) << bits) - 1) >> bits;
+  blockEnd   = (end >> bits) - 1;
+
+  prefixSamples = SCAST(int, (blockStart << bits) - start);
+  suffixSamples = SCAST(int, end - (blockEnd << bits) - 1);
+  centerSamples = ((blockEnd - blockStart + 1) << bits);
 
   if (blockStart < blockEnd) {
     if (prefixSamples > 0) {
       calcLimitsBuf(
             limits,
-            m_data + start,
+            WaveSampleSpan(
+              m_data,
+              start,
+              SCAST(size_t, prefixSamples),
+              start == 0 ? 0 : 1),
             SCAST(size_t, prefixSamples),
             start == 0);
       mean_p = limits.mean;
@@ -447,15 +1278,19 @@ WaveViewTree::computeLimits(qint64 start, qint64 end, WaveLimits &limits) const
     if (suffixSamples > 0) {
       calcLimitsBuf(
             limits,
-            m_data + end + 1 - suffixSamples,
+            WaveSampleSpan(
+              m_data,
+              end + 1 - suffixSamples,
+              SCAST(size_t, suffixSamples),
+              start == 0 ? 0 : 1),
             SCAST(size_t, suffixSamples),
             start == 0);
       mean_s = limits.mean;
       limits.mean = 0;
     }
 
-    if (cbegin() != cend()) {
-      computeLimitsFar(cbegin(), blockStart, blockEnd, limits);
+    if (firstLevel() != cend()) {
+      computeLimitsFar(firstLevel(), blockStart, blockEnd, limits);
       mean_c = limits.mean;
       limits.mean = 0;
     }
@@ -468,12 +1303,490 @@ WaveViewTree::computeLimits(qint64 start, qint64 end, WaveLimits &limits) const
   } else {
     calcLimitsBuf(
           limits,
-          m_data + start,
+          WaveSampleSpan(
+            m_data,
+            start,
+            SCAST(size_t, end - start + 1),
+            start == 0 ? 0 : 1),
           SCAST(size_t, end - start + 1),
           start == 0);
   }
 }
 
+///////////////////////////// Range statistics /////////////////////////////////
+void
+WaveViewTree::accumulateStatsBuf(
+    WaveRangeStats &stats,
+    SuWidgetsHelpers::KahanState &state,
+    const SUCOMPLEX *data,
+    size_t len)
+{
+  SUFLOAT peak = stats.peak * stats.peak;
+
+  SuWidgetsHelpers::kahanAccumulate(data, len, &state);
+  SuWidgetsHelpers::calcLimits(&stats.min, &stats.max, data, len, true);
+
+  for (size_t i = 0; i < len; ++i)
+    peak = MAX(peak, SU_C_REAL(data[i] * SU_C_CONJ(data[i])));
+
+  stats.peak = SU_SQRT(peak);
+}
+
+void
+WaveViewTree::accumulateStatsBlock(
+    WaveRangeStats &stats,
+    SuWidgetsHelpers::KahanState &state,
+    const WaveLimitVector &data,
+    size_t offset,
+    size_t len)
+{
+  SuWidgetsHelpers::KahanState partial;
+  SUCOMPLEX min, max;
+
+  for (size_t i = offset; i < offset + len; ++i) {
+    partial.meanSum = data.sumAt(i);
+    partial.rmsSum  = data.powerAt(i);
+    SuWidgetsHelpers::kahanMerge(&state, partial);
+
+    min = data.minAt(i);
+    max = data.maxAt(i);
+
+    stats.min = MIN(SU_C_REAL(stats.min), SU_C_REAL(min))
+        + MIN(SU_C_IMAG(stats.min), SU_C_IMAG(min)) * SU_I;
+    stats.max = MAX(SU_C_REAL(stats.max), SU_C_REAL(max))
+        + MAX(SU_C_IMAG(stats.max), SU_C_IMAG(max)) * SU_I;
+    stats.peak = MAX(stats.peak, data.envelopeAt(i));
+  }
+}
+
+//
+// Entries in [start, end] of level p. Only the ragged ends are read from
+// this level, the fully covered blocks in between are taken from the next.
+//
+void
+WaveViewTree::computeRangeStatsFar(
+    WaveViewTree::const_iterator p,
+    qint64 start,
+    qint64 end,
+    WaveRangeStats &stats,
+    SuWidgetsHelpers::KahanState &state) const
+{
+  qint64 blockStart = (start + m_blockLength - 1) >> m_blockBits;
+  qint64 blockEnd   = ((end + 1) >> m_blockBits) - 1;
+  qint64 centerStart, centerEnd;
+
+  if (start > end)
+    return;
+
+  if ((p + 1) == cend() || blockStart > blockEnd) {
+    accumulateStatsBlock(
+          stats,
+          state,
+          *p,
+          SCAST(size_t, start),
+          SCAST(size_t, end - start + 1));
+    return;
+  }
+
+  centerStart = blockStart << m_blockBits;
+  centerEnd   = ((blockEnd + 1) << m_blockBits) - 1;
+
+  if (centerStart > start)
+    accumulateStatsBlock(
+          stats,
+          state,
+          *p,
+          SCAST(size_t, start),
+          SCAST(size_t, centerStart - start));
+
+  computeRangeStatsFar(p + 1, blockStart, blockEnd, stats, state);
+
+  if (centerEnd < end)
+    accumulateStatsBlock(
+          stats,
+          state,
+          *p,
+          SCAST(size_t, centerEnd + 1),
+          SCAST(size_t, end - centerEnd));
+}
+
+//
+// Exact statistics of the samples in [start, end], in O(log n) time. Ranges
+// are clipped to the summarized part of the waveform. Returns false if no
+// sample was left.
+//
+bool
+WaveViewTree::computeRangeStats(
+    qint64 start,
+    qint64 end,
+    WaveRangeStats &stats) const
+{
+  SuWidgetsHelpers::KahanState state;
+  qint64 built = SCAST(qint64, getBuilt());
+  qint64 blockStart, blockEnd;
+  qint64 centerStart, centerEnd;
+  int bits = baseBits();
+
+  stats = WaveRangeStats();
+
+  if (start < 0)
+    start = 0;
+
+  if (end >= SCAST(qint64, m_length))
+    end = SCAST(qint64, m_length) - 1;
+
+  if (end >= built)
+    end = built - 1;
+
+  if (start > end)
+    return false;
+
+  blockStart = (start + (SCAST(qint64, 1) << bits) - 1) >> bits;
+  blockEnd   = ((end + 1) >> bits) - 1;
+
+  if (firstLevel() == cend() || blockStart > blockEnd) {
+    accumulateStatsBuf(
+          stats,
+          state,
+          WaveSampleSpan(m_data, start, SCAST(size_t, end - start + 1)),
+          SCAST(size_t, end - start + 1));
+  } else {
+    centerStart = blockStart << bits;
+    centerEnd   = ((blockEnd + 1) << bits) - 1;
+
+    if (centerStart > start)
+      accumulateStatsBuf(
+            stats,
+            state,
+            WaveSampleSpan(m_data, start, SCAST(size_t, centerStart - start)),
+            SCAST(size_t, centerStart - start));
+
+    computeRangeStatsFar(firstLevel(), blockStart, blockEnd, stats, state);
+
+    if (centerEnd < end)
+      accumulateStatsBuf(
+            stats,
+            state,
+            WaveSampleSpan(
+              m_data,
+              centerEnd + 1,
+              SCAST(size_t, end - centerEnd)),
+            SCAST(size_t, end - centerEnd));
+  }
+
+  state.count = SCAST(SUSCOUNT, end - start + 1);
+  SuWidgetsHelpers::kahanResult(&stats.mean, &stats.rms, state);
+
+  stats.count = state.count;
+  stats.power = stats.rms * stats.rms;
+
+  return true;
+}
+
+/////////////////////////////// Sample search //////////////////////////////////
+static inline SUFLOAT
+searchValue(SUCOMPLEX x, enum WaveSearchComponent component)
+{
+  switch (component) {
+    case WAVE_SEARCH_REAL:
+      return SU_C_REAL(x);
+
+    case WAVE_SEARCH_IMAG:
+      return SU_C_IMAG(x);
+
+    default:
+      return SU_C_ABS(x);
+  }
+}
+
+//
+// Whether entry i of a level may cover a sample that is at or above the
+// level of the query (or below it).
+//
+bool
+WaveViewTree::searchCandidate(
+    const WaveLimitVector &data,
+    size_t i,
+    const WaveSearchQuery &query,
+    bool above)
+{
+  SUCOMPLEX min = data.minAt(i);
+  SUCOMPLEX max = data.maxAt(i);
+  SUFLOAT lo, hi, dRe, dIm, slack;
+
+  switch (query.component) {
+    case WAVE_SEARCH_REAL:
+      lo = SU_C_REAL(min);
+      hi = SU_C_REAL(max);
+      break;
+
+    case WAVE_SEARCH_IMAG:
+      lo = SU_C_IMAG(min);
+      hi = SU_C_IMAG(max);
+      break;
+
+    default:
+      // Smallest magnitude: distance from the origin to the bounding box
+      dRe = MAX(MAX(SU_C_REAL(min), -SU_C_REAL(max)), 0);
+      dIm = MAX(MAX(SU_C_IMAG(min), -SU_C_IMAG(max)), 0);
+      lo  = SU_SQRT(dRe * dRe + dIm * dIm);
+      hi  = data.envelopeAt(i);
+      break;
+  }
+
+  slack = WAVE_VIEW_TREE_SEARCH_SLACK
+      * (std::fabs(lo) + std::fabs(hi) + std::fabs(query.level));
+
+  return above ? hi + slack >= query.level : lo - slack < query.level;
+}
+
+qint64
+WaveViewTree::searchBuf(
+    qint64 start,
+    qint64 end,
+    const WaveSearchQuery &query,
+    bool above) const
+{
+  if (!query.backward) {
+    for (qint64 i = start; i <= end; ++i)
+      if ((searchValue(m_data[i], query.component) >= query.level) == above)
+        return i;
+  } else {
+    for (qint64 i = end; i >= start; --i)
+      if ((searchValue(m_data[i], query.component) >= query.level) == above)
+        return i;
+  }
+
+  return -1;
+}
+
+//
+// Looks for a hit in the samples of entry i of level p, which is known to
+// be a candidate. Bounds are not exact, so there may be none.
+//
+qint64
+WaveViewTree::searchEntry(
+    WaveViewTree::const_iterator p,
+    qint64 i,
+    const WaveSearchQuery &query,
+    bool above) const
+{
+  qint64 first, last;
+
+  if (p == firstLevel()) {
+    first = i << baseBits();
+    last  = first + (SCAST(qint64, 1) << baseBits()) - 1;
+
+    return searchBuf(
+          first,
+          MIN(last, SCAST(qint64, m_length) - 1),
+          query,
+          above);
+  }
+
+  first = i << m_blockBits;
+  last  = first + m_blockLength - 1;
+
+  --p;
+
+  return searchEntries(
+        p,
+        first,
+        MIN(last, SCAST(qint64, p->size()) - 1),
+        query,
+        above);
+}
+
+// Entries in [start, end] of level p, one by one
+qint64
+WaveViewTree::searchEntries(
+    WaveViewTree::const_iterator p,
+    qint64 start,
+    qint64 end,
+    const WaveSearchQuery &query,
+    bool above) const
+{
+  qint64 hit;
+
+  if (!query.backward) {
+    for (qint64 i = start; i <= end; ++i)
+      if (searchCandidate(*p, SCAST(size_t, i), query, above)
+          && (hit = searchEntry(p, i, query, above)) >= 0)
+        return hit;
+  } else {
+    for (qint64 i = end; i >= start; --i)
+      if (searchCandidate(*p, SCAST(size_t, i), query, above)
+          && (hit = searchEntry(p, i, query, above)) >= 0)
+        return hit;
+  }
+
+  return -1;
+}
+
+//
+// Entries in [start, end] of level p. As in computeRangeStatsFar, only the
+// ragged ends are visited in this level, and the fully covered blocks in
+// between are pruned from the next one.
+//
+qint64
+WaveViewTree::searchFar(
+    WaveViewTree::const_iterator p,
+    qint64 start,
+    qint64 end,
+    const WaveSearchQuery &query,
+    bool above) const
+{
+  qint64 blockStart = (start + m_blockLength - 1) >> m_blockBits;
+  qint64 blockEnd   = ((end + 1) >> m_blockBits) - 1;
+  qint64 centerStart, centerEnd;
+  qint64 hit = -1;
+
+  if (start > end)
+    return -1;
+
+  if ((p + 1) == cend() || blockStart > blockEnd)
+    return searchEntries(p, start, end, query, above);
+
+  centerStart = blockStart << m_blockBits;
+  centerEnd   = ((blockEnd + 1) << m_blockBits) - 1;
+
+  if (!query.backward) {
+    if (centerStart > start)
+      hit = searchEntries(p, start, centerStart - 1, query, above);
+
+    if (hit < 0)
+      hit = searchFar(p + 1, blockStart, blockEnd, query, above);
+
+    if (hit < 0 && centerEnd < end)
+      hit = searchEntries(p, centerEnd + 1, end, query, above);
+  } else {
+    if (centerEnd < end)
+      hit = searchEntries(p, centerEnd + 1, end, query, above);
+
+    if (hit < 0)
+      hit = searchFar(p + 1, blockStart, blockEnd, query, above);
+
+    if (hit < 0 && centerStart > start)
+      hit = searchEntries(p, start, centerStart - 1, query, above);
+  }
+
+  return hit;
+}
+
+//
+// First (or last, if searching backward) sample in [start, end] that is at
+// or above the level of the query (or below it).
+//
+qint64
+WaveViewTree::searchLevel(
+    qint64 start,
+    qint64 end,
+    const WaveSearchQuery &query,
+    bool above) const
+{
+  qint64 blockStart, blockEnd;
+  qint64 centerStart, centerEnd;
+  qint64 hit = -1;
+  int bits = baseBits();
+
+  if (start > end)
+    return -1;
+
+  blockStart = (start + (SCAST(qint64, 1) << bits) - 1) >> bits;
+  blockEnd   = ((end + 1) >> bits) - 1;
+
+  if (firstLevel() == cend() || blockStart > blockEnd)
+    return searchBuf(start, end, query, above);
+
+  centerStart = blockStart << bits;
+  centerEnd   = ((blockEnd + 1) << bits) - 1;
+
+  if (!query.backward) {
+    if (centerStart > start)
+      hit = searchBuf(start, centerStart - 1, query, above);
+
+    if (hit < 0)
+      hit = searchFar(firstLevel(), blockStart, blockEnd, query, above);
+
+    if (hit < 0 && centerEnd < end)
+      hit = searchBuf(centerEnd + 1, end, query, above);
+  } else {
+    if (centerEnd < end)
+      hit = searchBuf(centerEnd + 1, end, query, above);
+
+    if (hit < 0)
+      hit = searchFar(firstLevel(), blockStart, blockEnd, query, above);
+
+    if (hit < 0 && centerStart > start)
+      hit = searchBuf(start, centerStart - 1, query, above);
+  }
+
+  return hit;
+}
+
+//
+// Next sample (from the given one, included) that meets the query, or the
+// previous one if the query goes backward. Whole blocks whose bounds rule
+// out a hit are skipped at the highest level possible, so only a few raw
+// samples are read. Crossings are found as a sample on one side of the
+// level followed by the first one on the other side. Returns -1 if no
+// sample of the summarized part of the waveform meets it.
+//
+qint64
+WaveViewTree::search(qint64 from, const WaveSearchQuery &query) const
+{
+  qint64 last = MIN(SCAST(qint64, m_length), SCAST(qint64, getBuilt())) - 1;
+  qint64 hit;
+  bool above;
+
+  if (last < 0)
+    return -1;
+
+  if (from < 0) {
+    if (query.backward)
+      return -1;
+    from = 0;
+  }
+
+  if (from > last) {
+    if (!query.backward)
+      return -1;
+    from = last;
+  }
+
+  switch (query.condition) {
+    case WAVE_SEARCH_ABOVE:
+    case WAVE_SEARCH_BELOW:
+      above = query.condition == WAVE_SEARCH_ABOVE;
+
+      if (!query.backward)
+        return searchLevel(from, last, query, above);
+      else
+        return searchLevel(0, from, query, above);
+
+    default:
+      // The side the crossing ends in
+      above = query.condition == WAVE_SEARCH_RISING;
+
+      if (!query.backward) {
+        hit = searchLevel(MAX(from - 1, 0), last, query, !above);
+        if (hit < 0)
+          return -1;
+
+        return searchLevel(hit + 1, last, query, above);
+      } else {
+        hit = searchLevel(0, from, query, above);
+        if (hit < 1)
+          return -1;
+
+        hit = searchLevel(0, hit - 1, query, !above);
+        if (hit < 0)
+          return -1;
+
+        return hit + 1;
+      }
+  }
+}
 
 bool
 WaveViewTree::clear(void)
@@ -481,9 +1794,13 @@ WaveViewTree::clear(void)
   safeCancel();
 
   QList<WaveLimitVector>::clear();
+  ++m_generation;
+  m_cacheFile.reset();
   m_state = SuWidgetsHelpers::KahanState();
-  m_data = nullptr;
+  m_evictedLevels = 0;
+  m_data = WaveSamples();
   m_length = 0;
+  m_built = 0;
   m_complete = true;
 
   // This is a reprocessing too
@@ -492,56 +1809,625 @@ WaveViewTree::clear(void)
   return true;
 }
 
+//
+// Changing the fan-out invalidates all levels. If there is data, the tree
+// is rebuilt from scratch.
+//
+bool
+WaveViewTree::setBlockBits(int bits)
+{
+  WaveSamples data = m_data;
+  SUSCOUNT length = m_length;
+
+  if (bits < WAVEFORM_BLOCK_MIN_BITS || bits > WAVEFORM_BLOCK_MAX_BITS)
+    return false;
+
+  if (bits != m_blockBits) {
+    safeCancel();
+
+    QList<WaveLimitVector>::clear();
+    ++m_generation;
+    m_state       = SuWidgetsHelpers::KahanState();
+    m_length      = 0;
+    m_built       = 0;
+    m_evictedLevels = 0;
+    m_blockBits   = bits;
+    m_blockLength = 1 << bits;
+
+    if (length > 0)
+      reprocess(data, length);
+  }
+
+  return true;
+}
+
+//
+// Compact levels take 16 bits per field component (2x less memory in single
+// precision builds, 4x in double precision), and are precise enough to draw
+// on screen. They are meant for big, static captures: levels are compacted
+// once a background build is done, and expanded back before extending or
+// shifting the tree.
+//
+void
+WaveViewTree::setCompactLevels(bool compact)
+{
+  m_compactLevels = compact;
+
+  if (!compact)
+    expandLevels();
+  else if (m_complete && m_currentWorker == nullptr)
+    compactLevels();
+}
+
+void
+WaveViewTree::compactLevels(void)
+{
+  WaveLimitQuantizer q;
+  SUFLOAT envMax;
+
+  // Levels mapped from the cache are paged from disk, leave them alone
+  if (size() == 0 || !m_cacheFile.isNull())
+    return;
+
+  envMax = last().envelopeAt(0);
+
+  q.offset     = m_oMin;
+  q.reStep     = SU_C_REAL(m_oMax - m_oMin) / WAVEFORM_LIMIT_QUANT_MAX;
+  q.imStep     = SU_C_IMAG(m_oMax - m_oMin) / WAVEFORM_LIMIT_QUANT_MAX;
+  q.envStep    = envMax / WAVEFORM_LIMIT_QUANT_MAX;
+  q.freqOffset = -SU_ASFLOAT(PI);
+  q.freqStep   = SU_ASFLOAT(2 * PI) / WAVEFORM_LIMIT_QUANT_MAX;
+
+  try {
+    for (auto &level : *this)
+      level.compact(q);
+  } catch (std::bad_alloc &) {
+    // Leave the remaining levels as they are
+  }
+}
+
+void
+WaveViewTree::expandLevels(void)
+{
+  try {
+    for (auto &level : *this)
+      level.expand();
+  } catch (std::bad_alloc &) {
+    QList<WaveLimitVector>::clear();
+    ++m_generation;
+    m_cacheFile.reset();
+    m_state = SuWidgetsHelpers::KahanState();
+    m_built = 0;
+    m_evictedLevels = 0;
+  }
+}
+
+//
+// Frees the lowest level still in memory, for trees that are over budget
+// even when compacted. Queries take the first level left as the base of the
+// tree, reading the raw samples of its ragged ends instead of the levels
+// below. Levels are only evicted from complete trees built in memory, and
+// never if the first level left would summarize more than
+// 2^WAVE_VIEW_TREE_EVICT_MAX_BITS samples per block or be the top of the
+// tree. Extending or shifting the tree afterwards rebuilds it from scratch.
+//
+bool
+WaveViewTree::evictLevel(void)
+{
+  if (!m_complete || m_currentWorker != nullptr || !m_cacheFile.isNull())
+    return false;
+
+  if (m_evictedLevels + 1 >= size()
+      || (m_evictedLevels + 2) * m_blockBits > WAVE_VIEW_TREE_EVICT_MAX_BITS)
+    return false;
+
+  (*this)[m_evictedLevels] = WaveLimitVector();
+  ++m_evictedLevels;
+
+  return true;
+}
+
+size_t
+WaveViewTree::memoryUsage(void) const
+{
+  size_t usage = 0;
+
+  for (auto const &level : *this)
+    usage += level.memoryUsage();
+
+  return usage;
+}
+
+//
+// Discards must be multiples of this to keep the lower levels of the tree
+// (all those built independently by span tasks).
+//
+SUSCOUNT
+WaveViewTree::getDiscardAlignment(void) const
+{
+  int depth = WAVE_VIEW_TREE_SPAN_ALIGN_BITS / m_blockBits;
+
+  return SCAST(SUSCOUNT, 1) << (depth * m_blockBits);
+}
+
+//
+// Sliding window support: removes the first count samples from the tree.
+// This must be called before the samples are removed from the buffer, as
+// their contribution to the mean and RMS is subtracted. The next call to
+// reprocess() is expected to pass the remaining samples.
+//
+// Aligned discards drop the front of the lower levels and recompute the
+// few levels above them. Otherwise (or if the lower levels were evicted),
+// the tree is rebuilt from scratch.
+// Levels are not rings: dropping their front is amortized instead (see
+// WaveLimitVector::eraseFront), which makes the cost of a discard O(count)
+// for the samples and the lower levels, plus O(length / 2^16) for the
+// levels on top of them.
+//
+bool
+WaveViewTree::discard(SUSCOUNT count)
+{
+  int depth = WAVE_VIEW_TREE_SPAN_ALIGN_BITS / m_blockBits;
+  SUSCOUNT align = getDiscardAlignment();
+  SUSCOUNT levelLength, prevLength;
+  SUFLOAT wEnd;
+
+  if (count == 0)
+    return true;
+
+  if (count > m_length)
+    return false;
+
+  safeCancel();
+  expandLevels();
+
+  if (count % align != 0
+      || count >= m_built
+      || size() <= depth
+      || m_evictedLevels > 0) {
+    QList<WaveLimitVector>::clear();
+    ++m_generation;
+    m_state = SuWidgetsHelpers::KahanState();
+    m_built = 0;
+    m_evictedLevels = 0;
+  } else {
+    SuWidgetsHelpers::kahanDiscard(
+          &m_mean,
+          &m_rms,
+          WaveSampleSpan(m_data, 0, count),
+          count,
+          &m_state);
+
+    m_built -= count;
+
+    // Drop the front of the lower levels, trimming any preallocated excess
+    prevLength  = m_built;
+    levelLength = m_built;
+    for (int l = 0; l < depth; ++l) {
+      prevLength  = levelLength;
+      levelLength = (levelLength + m_blockLength - 1) >> m_blockBits;
+
+      (*this)[l].eraseFront(count >> ((l + 1) * m_blockBits));
+      (*this)[l].resize(levelLength);
+    }
+
+    // Recompute the rest of the tree from them
+    erase(begin() + depth, end());
+
+    try {
+      if (levelLength > 1) {
+        wEnd = SU_ASFLOAT(prevLength - ((levelLength - 1) << m_blockBits))
+            / SU_ASFLOAT(m_blockLength);
+        m_serialWorker->buildNextView(
+              begin() + (depth - 1),
+              0,
+              levelLength - 1,
+              wEnd);
+      }
+
+      m_oMin = last().minData()[0];
+      m_oMax = last().maxData()[0];
+    } catch (std::bad_alloc &) {
+      QList<WaveLimitVector>::clear();
+      ++m_generation;
+      m_state = SuWidgetsHelpers::KahanState();
+      m_built = 0;
+      m_evictedLevels = 0;
+    }
+  }
+
+  m_data   += count;
+  m_length -= count;
+
+  return true;
+}
+
+////////////////////////////////// LOD cache ///////////////////////////////////
+//
+// Cache files store the whole tree so that reopening a capture does not
+// require a rebuild. Levels are laid out exactly as in memory (see
+// WaveLimitVector::storageSize()), so they are used directly from a
+// private (copy-on-write) mapping of the file.
+//
+//
+// Trees are cached for captures stored in a file (source). An empty path
+// or source disables the cache.
+//
+void
+WaveViewTree::setCachePath(QString const &path, QString const &source)
+{
+  m_cachePath        = path;
+  m_cacheSource      = WaveViewTreeCacheSource();
+  m_cacheSource.path = source;
+}
+
+bool
+WaveViewTreeCacheSource::refresh(void)
+{
+  QFileInfo info(path);
+
+  valid = false;
+
+  if (path.isEmpty() || !info.exists())
+    return false;
+
+  size  = SCAST(uint64_t, info.size());
+  inode = 0;
+  mtime = SCAST(int64_t, info.lastModified().toMSecsSinceEpoch()) * 1000000;
+
+#ifdef Q_OS_UNIX
+  struct stat sbuf;
+
+  if (stat(QFile::encodeName(path).constData(), &sbuf) == 0) {
+    inode = SCAST(uint64_t, sbuf.st_ino);
+#  ifdef Q_OS_LINUX
+    mtime = SCAST(int64_t, sbuf.st_mtim.tv_sec) * 1000000000
+        + SCAST(int64_t, sbuf.st_mtim.tv_nsec);
+#  endif // Q_OS_LINUX
+  }
+#endif // Q_OS_UNIX
+
+  valid = true;
+
+  return true;
+}
+
+//
+// Hashing the whole capture would take as long as building the tree. Only
+// a fixed number of evenly spaced chunks (including both ends) are hashed,
+// which is why cache files are also tied to the identity of the capture
+// file. The registry uses it to tell idle buffers apart.
+//
+QByteArray
+WaveViewTree::contentHash(WaveSamples const &data, SUSCOUNT length)
+{
+  QCryptographicHash hash(QCryptographicHash::Sha256);
+  SUSCOUNT chunk  = WAVE_VIEW_TREE_CACHE_HASH_CHUNK;
+  SUSCOUNT chunks = WAVE_VIEW_TREE_CACHE_HASH_CHUNKS;
+  size_t   size   = data.sampleSize();
+  qint32   format = data.format();
+  SUFLOAT  scale  = data.scale();
+
+  // The same bytes make a different tree if read differently
+  hash.addData(
+        QByteArray::fromRawData(RCAST(const char *, &format), sizeof(format)));
+  hash.addData(
+        QByteArray::fromRawData(RCAST(const char *, &scale), sizeof(scale)));
+
+  if (length <= chunk * chunks) {
+    hash.addData(
+          QByteArray::fromRawData(
+            SCAST(const char *, data.bytes()),
+            SCAST(int, length * size)));
+  } else {
+    for (SUSCOUNT k = 0; k < chunks; ++k) {
+      SUSCOUNT offset = k * (length - chunk) / (chunks - 1);
+      hash.addData(
+            QByteArray::fromRawData(
+              SCAST(const char *, (data + offset).bytes()),
+              SCAST(int, chunk * size)));
+    }
+  }
+
+  return hash.result();
+}
+
+static bool
+writeCacheArray(QSaveFile &file, const void *data, size_t size)
+{
+  static const char padding[WAVEFORM_LIMIT_VECTOR_ALIGN] = {0};
+  size_t padSize = alignLimitArray(size) - size;
+
+  if (file.write(RCAST(const char *, data), SCAST(qint64, size))
+      != SCAST(qint64, size))
+    return false;
+
+  if (padSize > 0 && file.write(padding, SCAST(qint64, padSize))
+      != SCAST(qint64, padSize))
+    return false;
+
+  return true;
+}
+
+//
+// The source is the identity of the capture file when the build started.
+// If the file changed in the meantime, the tree is not saved.
+//
 bool
-WaveViewTree::reprocess(const SUCOMPLEX *data, SUSCOUNT newLength)
+WaveViewTree::saveCache(
+    QString const &path,
+    WaveViewTreeCacheSource const &source,
+    WaveSamples const &data,
+    SUSCOUNT length,
+    const std::atomic<bool> *cancel) const
+{
+  QSaveFile file(path);
+  WaveViewTreeCacheSource current = source;
+  WaveViewTreeCacheHeader header;
+  std::vector<WaveViewTreeCacheLevel> levels(SCAST(size_t, size()));
+  QByteArray head;
+  QByteArray hash;
+  uint64_t offset;
+  bool ok;
+
+  if (!current.refresh() || !current.isSameFile(source))
+    return false;
+
+  hash = contentHash(data, length);
+
+  std::memset(RCAST(void *, &header), 0, sizeof(header));
+  std::memcpy(header.magic, WAVE_VIEW_TREE_CACHE_MAGIC, sizeof(header.magic));
+  header.version     = WAVE_VIEW_TREE_CACHE_VERSION;
+  header.endianness  = WAVE_VIEW_TREE_CACHE_ENDIANNESS;
+  header.sampleSize  = sizeof(SUCOMPLEX);
+  header.blockBits   = SCAST(uint32_t, m_blockBits);
+  header.length      = length;
+  header.levels      = levels.size();
+  header.sourceSize  = source.size;
+  header.sourceInode = source.inode;
+  header.sourceMtime = source.mtime;
+  header.oMin        = m_oMin;
+  header.oMax        = m_oMax;
+  header.mean        = m_mean;
+  header.rms         = m_rms;
+  header.state       = m_state;
+  std::memcpy(
+        header.hash,
+        hash.constData(),
+        MIN(sizeof(header.hash), SCAST(size_t, hash.size())));
+
+  offset = alignLimitArray(
+        sizeof(header) + levels.size() * sizeof(WaveViewTreeCacheLevel));
+  for (size_t l = 0; l < levels.size(); ++l) {
+    levels[l].size   = (*this)[SCAST(int, l)].size();
+    levels[l].offset = offset;
+    offset += WaveLimitVector::storageSize(levels[l].size);
+  }
+
+  head.append(RCAST(const char *, &header), sizeof(header));
+  head.append(
+        RCAST(const char *, levels.data()),
+        SCAST(int, levels.size() * sizeof(WaveViewTreeCacheLevel)));
+
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+
+  ok = writeCacheArray(file, head.constData(), SCAST(size_t, head.size()));
+
+  for (auto p = begin(); ok && p != end(); ++p) {
+    size_t n = p->size();
+
+    ok = !*cancel
+        && writeCacheArray(file, p->minData(), n * sizeof(SUCOMPLEX))
+        && writeCacheArray(file, p->maxData(), n * sizeof(SUCOMPLEX))
+        && writeCacheArray(file, p->meanData(), n * sizeof(SUCOMPLEX))
+        && writeCacheArray(file, p->sumData(), n * sizeof(SUCOMPLEX))
+        && writeCacheArray(file, p->envelopeData(), n * sizeof(SUFLOAT))
+        && writeCacheArray(file, p->freqData(), n * sizeof(SUFLOAT))
+        && writeCacheArray(file, p->powerData(), n * sizeof(SUFLOAT));
+  }
+
+  if (!ok) {
+    file.cancelWriting();
+    return false;
+  }
+
+  return file.commit();
+}
+
+bool
+WaveViewTree::loadCache(WaveSamples const &data, SUSCOUNT length)
+{
+  QSharedPointer<QFile> file(new QFile(m_cachePath));
+  WaveViewTreeCacheHeader header;
+  const WaveViewTreeCacheLevel *levels;
+  QByteArray hash;
+  uint64_t fileSize, dirSize;
+  SUSCOUNT levelLength = length;
+  uchar *map;
+
+  if (length < WAVE_VIEW_TREE_CACHE_MIN_SIZE
+      || !m_cacheSource.valid
+      || !file->exists())
+    return false;
+
+  if (!file->open(QIODevice::ReadOnly))
+    return false;
+
+  fileSize = SCAST(uint64_t, file->size());
+  if (fileSize < sizeof(header))
+    return false;
+
+  map = file->map(0, file->size(), QFileDevice::MapPrivateOption);
+  if (map == nullptr)
+    return false;
+
+  std::memcpy(RCAST(void *, &header), map, sizeof(header));
+
+  if (std::memcmp(
+        header.magic,
+        WAVE_VIEW_TREE_CACHE_MAGIC,
+        sizeof(header.magic)) != 0
+      || header.version != WAVE_VIEW_TREE_CACHE_VERSION
+      || header.endianness != WAVE_VIEW_TREE_CACHE_ENDIANNESS
+      || header.sampleSize != sizeof(SUCOMPLEX)
+      || header.blockBits != SCAST(uint32_t, m_blockBits)
+      || header.length != length
+      || header.levels == 0
+      || header.sourceSize != m_cacheSource.size
+      || header.sourceInode != m_cacheSource.inode
+      || header.sourceMtime != m_cacheSource.mtime)
+    return false;
+
+  dirSize = sizeof(header) + header.levels * sizeof(WaveViewTreeCacheLevel);
+  if (header.levels > fileSize || dirSize > fileSize)
+    return false;
+
+  hash = contentHash(data, length);
+  if (std::memcmp(
+        header.hash,
+        hash.constData(),
+        MIN(sizeof(header.hash), SCAST(size_t, hash.size()))) != 0)
+    return false;
+
+  // The geometry of the levels must be the one allocateLevels() gives
+  levels = RCAST(const WaveViewTreeCacheLevel *, map + sizeof(header));
+  for (uint64_t l = 0; l < header.levels; ++l) {
+    levelLength = (levelLength + m_blockLength - 1) >> m_blockBits;
+
+    if (levels[l].size != levelLength
+        || (levelLength > 1) != (l + 1 < header.levels))
+      return false;
+
+    if (levels[l].offset % WAVEFORM_LIMIT_VECTOR_ALIGN != 0
+        || levels[l].size > fileSize
+        || levels[l].offset > fileSize
+        || WaveLimitVector::storageSize(levels[l].size)
+           > fileSize - levels[l].offset)
+      return false;
+  }
+
+  // All good. Use the levels in the file.
+  QList<WaveLimitVector>::clear();
+  ++m_generation;
+  m_evictedLevels = 0;
+
+  for (uint64_t l = 0; l < header.levels; ++l) {
+    append(WaveLimitVector());
+    last().attach(map + levels[l].offset, levels[l].size);
+  }
+
+  m_oMin      = header.oMin;
+  m_oMax      = header.oMax;
+  m_mean      = header.mean;
+  m_rms       = header.rms;
+  m_state     = header.state;
+  m_built     = length;
+  m_cacheFile = file;
+
+  return true;
+}
+
+//
+// Appending samples never discards the work already done: the tree is
+// extended in place from the last summarized sample. If a worker is still
+// running, it is simply asked to go further.
+//
+bool
+WaveViewTree::reprocess(WaveSamples const &data, SUSCOUNT newLength)
 {
   WaveWorker *worker = nullptr;
-  SUSCOUNT lastLength = m_length;
   SUSCOUNT processLength = 0;
 
+  if (m_currentWorker != nullptr
+      && newLength >= m_length
+      && m_currentWorker->extendTo(data, newLength))
+    return true;
+
   safeCancel();
 
+  if (newLength == 0) {
+    if (m_length != 0)
+      clear();
+    else
+      m_data = data;
+
+    return true;
+  }
+
+  if (newLength < m_length) {
+    QList<WaveLimitVector>::clear();
+    ++m_generation;
+    m_cacheFile.reset();
+    m_state = SuWidgetsHelpers::KahanState();
+    m_built = 0;
+    m_evictedLevels = 0;
+  } else if (newLength > m_built) {
+    // Levels are extended from the ones below them
+    if (m_evictedLevels > 0) {
+      QList<WaveLimitVector>::clear();
+      ++m_generation;
+      m_state = SuWidgetsHelpers::KahanState();
+      m_built = 0;
+      m_evictedLevels = 0;
+    }
+
+    expandLevels();
+  }
+
   m_data   = data;
   m_length = newLength;
 
+  // Reopening a known capture: no need to build anything
+  if (m_built == 0 && !m_cachePath.isEmpty())
+    m_cacheSource.refresh();
+
+  if (m_built == 0 && !m_cachePath.isEmpty() && loadCache(data, newLength)) {
+    m_complete = true;
+    emit ready();
+    return true;
+  }
+
+  processLength = newLength - m_built;
+
+  if (processLength == 0) {
+    m_complete = true;
+    return true;
+  }
+
   m_complete = false;
 
-  if (lastLength != newLength) {
-    if (newLength == 0) {
-      clear();
-    } else if (newLength < lastLength) {
-      m_state = SuWidgetsHelpers::KahanState();
-      worker = new WaveWorker(this, 0);
-      processLength = newLength;
-    } else {
-      worker = new WaveWorker(this, lastLength);
-      processLength = newLength - lastLength;
+  if (processLength >= WAVE_VIEW_TREE_MIN_PARALLEL_SIZE) {
+    // Readers may access the tree while it is being built (see getBuilt()),
+    // so workers never allocate levels. Do it for them.
+    try {
+      allocateLevels(newLength);
+    } catch (std::bad_alloc &) {
+      return false;
     }
 
-    if (worker != nullptr) {
-      if (processLength >= WAVE_VIEW_TREE_MIN_PARALLEL_SIZE) {
-        // Too many samples, process in parallel mode
-        m_currentWorker = worker;
-        m_currentWorker->moveToThread(m_workerThread);
-
-        connect(this,   SIGNAL(triggerWorker()), worker, SLOT(run()));
-        connect(worker, SIGNAL(cancelled()), this, SLOT(onWorkerCancelled(void)));
-        connect(worker, SIGNAL(finished()), this, SLOT(onWorkerFinished(void)));
-        connect(
-              worker,
-              SIGNAL(progress(quint64, quint64)),
-              this,
-              SIGNAL(progress(quint64, quint64)));
-
-        emit triggerWorker();
-      } else {
-        // Only a few samples, process in serial mode
-        worker->run();
-        m_complete = true;
-        delete worker;
-        emit ready();
-      }
-    }
+    // Too many samples, process in parallel mode
+    worker = new WaveWorker(this, m_built);
+
+    m_currentWorker = worker;
+    m_currentWorker->moveToThread(m_workerThread);
+
+    connect(this,   SIGNAL(triggerWorker()), worker, SLOT(run()));
+    connect(worker, SIGNAL(cancelled()), this, SLOT(onWorkerCancelled(void)));
+    connect(worker, SIGNAL(finished()), this, SLOT(onWorkerFinished(void)));
+    connect(
+          worker,
+          SIGNAL(progress(quint64, quint64)),
+          this,
+          SIGNAL(progress(quint64, quint64)));
+
+    emit triggerWorker();
+  } else {
+    // Only a few samples, extend the tree in place from this thread
+    m_serialWorker->restart(m_built);
+    m_serialWorker->run();
+    m_complete = true;
+    emit ready();
   }
 
   return true;
@@ -550,19 +2436,43 @@ WaveViewTree::reprocess(const SUCOMPLEX *data, SUSCOUNT newLength)
 void
 WaveViewTree::onWorkerFinished(void)
 {
+  WaveSamples pendingData;
+  SUSCOUNT pendingLength = 0;
+
+  // Late notification from a worker that has already been replaced
+  if (sender() != m_currentWorker)
+    return;
+
   m_complete = true;
 
   if (m_currentWorker != nullptr && !m_currentWorker->running()) {
+    // Extensions that did not fit in the levels allocated for the worker
+    if (m_currentWorker->m_havePending) {
+      pendingData   = m_currentWorker->m_pendingData;
+      pendingLength = m_currentWorker->m_pendingLength;
+    }
+
     m_currentWorker->deleteLater();
     m_currentWorker = nullptr;
   }
 
+  if (pendingLength > 0) {
+    reprocess(pendingData, pendingLength);
+    return;
+  }
+
+  if (m_compactLevels && m_currentWorker == nullptr)
+    compactLevels();
+
   emit ready();
 }
 
 void
 WaveViewTree::onWorkerCancelled(void)
 {
+  if (sender() != m_currentWorker)
+    return;
+
   m_complete = false;
 
   if (m_currentWorker != nullptr && m_currentWorker->isCancelled()) {
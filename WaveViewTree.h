@@ -24,19 +24,32 @@
 #include <QList>
 
 #include <vector>
+#include <atomic>
 #include <QThread>
+#include <QSharedPointer>
 #include "SuWidgetsHelpers.h"
+#include "WaveSamples.h"
 
-#define WAVEFORM_BLOCK_BITS   2
-#define WAVEFORM_BLOCK_LENGTH (1 << WAVEFORM_BLOCK_BITS)
+//
+// Default fan-out of the tree. Each tree can be configured to use blocks of
+// 2^WAVEFORM_BLOCK_MIN_BITS up to 2^WAVEFORM_BLOCK_MAX_BITS elements: bigger
+// blocks mean less memory and fewer levels, at the cost of a coarser
+// transition between levels.
+//
+#define WAVEFORM_BLOCK_BITS     2
+#define WAVEFORM_BLOCK_LENGTH   (1 << WAVEFORM_BLOCK_BITS)
+#define WAVEFORM_BLOCK_MIN_BITS 1
+#define WAVEFORM_BLOCK_MAX_BITS 5
 #define WAVEFORM_CIRCLE_DIM   4
 
 struct WaveLimits {
   SUCOMPLEX min = +INFINITY + +INFINITY * SU_I;
   SUCOMPLEX max = -INFINITY + -INFINITY * SU_I;
   SUCOMPLEX mean = 0;
+  SUCOMPLEX sum = 0;   // Sum of the samples in the block
   SUFLOAT   envelope = 0;
   SUFLOAT   freq = 0;
+  SUFLOAT   power = 0; // Sum of their squared magnitudes
 
   inline bool
   isInitialized(void) const
@@ -49,17 +62,304 @@ struct WaveLimits {
   }
 };
 
-typedef std::vector<WaveLimits> WaveLimitVector;
+//
+// Statistics of an arbitrary range of samples. Sums are exact up to
+// floating point rounding in any storage mode, while min, max and peak
+// are rounded outwards to the quantization step in compact levels.
+//
+struct WaveRangeStats {
+  SUSCOUNT  count = 0;
+  SUCOMPLEX min = SUCOMPLEX(+INFINITY, +INFINITY); // INFINITY * I is NaN
+  SUCOMPLEX max = SUCOMPLEX(-INFINITY, -INFINITY);
+  SUCOMPLEX mean = 0;
+  SUFLOAT   power = 0; // Mean squared magnitude
+  SUFLOAT   rms = 0;
+  SUFLOAT   peak = 0;  // Maximum magnitude
+};
+
+//
+// Sample searches. Samples are compared through one of their components
+// (or their magnitude) against a level. Crossings are reported at the first
+// sample past the level.
+//
+enum WaveSearchComponent {
+  WAVE_SEARCH_REAL,
+  WAVE_SEARCH_IMAG,
+  WAVE_SEARCH_MAGNITUDE
+};
+
+enum WaveSearchCondition {
+  WAVE_SEARCH_ABOVE,   // x[n] >= level
+  WAVE_SEARCH_BELOW,   // x[n] <  level
+  WAVE_SEARCH_RISING,  // x[n - 1] <  level <= x[n]
+  WAVE_SEARCH_FALLING  // x[n - 1] >= level >  x[n]
+};
+
+struct WaveSearchQuery {
+  enum WaveSearchComponent component = WAVE_SEARCH_REAL;
+  enum WaveSearchCondition condition = WAVE_SEARCH_ABOVE;
+  SUFLOAT level = 0;
+  bool    backward = false;
+};
+
+//
+// Tree levels are stored as structures of arrays. Every field lives in its
+// own cache-line aligned array, so that readers only pull from memory the
+// fields they actually need (e.g. min / max when drawing the waveform, or
+// envelope / mean when drawing the envelope).
+//
+#define WAVEFORM_LIMIT_VECTOR_ALIGN 64
+
+//
+// Compact levels store each field as 16-bit codes, relative to the range
+// of the whole waveform. Min and max are rounded outwards, so limits
+// computed from them always contain the actual ones.
+//
+#define WAVEFORM_LIMIT_QUANT_MAX    65535
+
+struct WaveLimitQuantizer {
+  SUCOMPLEX offset     = 0; // Value of code 0 for min, max and mean
+  SUFLOAT   reStep     = 0;
+  SUFLOAT   imStep     = 0;
+  SUFLOAT   envStep    = 0;
+  SUFLOAT   freqOffset = 0;
+  SUFLOAT   freqStep   = 0;
+
+  inline SUCOMPLEX
+  complex(const uint16_t *codes, size_t i) const
+  {
+    return SU_C_REAL(offset) + reStep * codes[2 * i]
+        + (SU_C_IMAG(offset) + imStep * codes[2 * i + 1]) * SU_I;
+  }
+};
+
+class WaveLimitVector {
+  void      *m_alloc    = nullptr; // Null if not owned (e.g. mapped)
+  SUCOMPLEX *m_min      = nullptr;
+  SUCOMPLEX *m_max      = nullptr;
+  SUCOMPLEX *m_mean     = nullptr;
+  SUCOMPLEX *m_sum      = nullptr; // Always full precision
+  SUFLOAT   *m_envelope = nullptr;
+  SUFLOAT   *m_freq     = nullptr;
+  SUFLOAT   *m_power    = nullptr; // Always full precision
+  size_t     m_size     = 0;
+  size_t     m_capacity = 0; // From m_min on, not counting m_front
+  size_t     m_front    = 0; // Erased elements still before the arrays
+
+  // Compact representation (field arrays above are null, but sums)
+  bool       m_compact   = false;
+  uint16_t  *m_qMin      = nullptr;
+  uint16_t  *m_qMax      = nullptr;
+  uint16_t  *m_qMean     = nullptr;
+  uint16_t  *m_qEnvelope = nullptr;
+  uint16_t  *m_qFreq     = nullptr;
+  WaveLimitQuantizer m_quant;
+
+  void layout(void *storage, size_t capacity);
+  void reallocate(size_t capacity);
+  void rewind(void);
+  void allocateCompact(size_t size);
+
+public:
+  WaveLimitVector() = default;
+  WaveLimitVector(const WaveLimitVector &);
+  WaveLimitVector(WaveLimitVector &&) noexcept;
+  WaveLimitVector &operator=(const WaveLimitVector &);
+  WaveLimitVector &operator=(WaveLimitVector &&) noexcept;
+  ~WaveLimitVector();
+
+  static size_t storageSize(size_t capacity);
+  static size_t compactStorageSize(size_t capacity);
+  size_t memoryUsage(void) const;
+
+  void attach(void *storage, size_t size);
+  void compact(const WaveLimitQuantizer &);
+  void expand(void);
+  void swap(WaveLimitVector &) noexcept;
+  void reserve(size_t capacity);
+  void resize(size_t size);
+  void eraseFront(size_t count);
+  void clear(void);
+
+  inline size_t
+  size(void) const
+  {
+    return m_size;
+  }
+
+  inline size_t
+  capacity(void) const
+  {
+    return m_capacity;
+  }
+
+  inline bool
+  empty(void) const
+  {
+    return m_size == 0;
+  }
+
+  inline bool
+  isCompact(void) const
+  {
+    return m_compact;
+  }
+
+  inline SUCOMPLEX
+  minAt(size_t i) const
+  {
+    return m_compact ? m_quant.complex(m_qMin, i) : m_min[i];
+  }
+
+  inline SUCOMPLEX
+  maxAt(size_t i) const
+  {
+    return m_compact ? m_quant.complex(m_qMax, i) : m_max[i];
+  }
+
+  inline SUCOMPLEX
+  meanAt(size_t i) const
+  {
+    return m_compact ? m_quant.complex(m_qMean, i) : m_mean[i];
+  }
+
+  inline SUFLOAT
+  envelopeAt(size_t i) const
+  {
+    return m_compact ? m_quant.envStep * m_qEnvelope[i] : m_envelope[i];
+  }
+
+  inline SUFLOAT
+  freqAt(size_t i) const
+  {
+    return m_compact
+        ? m_quant.freqOffset + m_quant.freqStep * m_qFreq[i]
+        : m_freq[i];
+  }
+
+  inline SUCOMPLEX
+  sumAt(size_t i) const
+  {
+    return m_sum[i];
+  }
+
+  inline SUFLOAT
+  powerAt(size_t i) const
+  {
+    return m_power[i];
+  }
+
+  // Raw field arrays. Not available (null) in compact vectors.
+
+  inline const SUCOMPLEX *
+  minData(void) const
+  {
+    return m_min;
+  }
+
+  inline const SUCOMPLEX *
+  maxData(void) const
+  {
+    return m_max;
+  }
+
+  inline const SUCOMPLEX *
+  meanData(void) const
+  {
+    return m_mean;
+  }
+
+  inline const SUFLOAT *
+  envelopeData(void) const
+  {
+    return m_envelope;
+  }
+
+  inline const SUFLOAT *
+  freqData(void) const
+  {
+    return m_freq;
+  }
+
+  // Sums are never quantized, these are always available
+  inline const SUCOMPLEX *
+  sumData(void) const
+  {
+    return m_sum;
+  }
+
+  inline const SUFLOAT *
+  powerData(void) const
+  {
+    return m_power;
+  }
+
+  inline WaveLimits
+  operator[](size_t i) const
+  {
+    WaveLimits limits;
+
+    limits.min      = minAt(i);
+    limits.max      = maxAt(i);
+    limits.mean     = meanAt(i);
+    limits.sum      = m_sum[i];
+    limits.envelope = envelopeAt(i);
+    limits.freq     = freqAt(i);
+    limits.power    = m_power[i];
+
+    return limits;
+  }
+
+  // Compact vectors must be expanded first
+  inline void
+  set(size_t i, const WaveLimits &limits)
+  {
+    m_min[i]      = limits.min;
+    m_max[i]      = limits.max;
+    m_mean[i]     = limits.mean;
+    m_sum[i]      = limits.sum;
+    m_envelope[i] = limits.envelope;
+    m_freq[i]     = limits.freq;
+    m_power[i]    = limits.power;
+  }
+};
+
+//
+// Capture file a cached tree belongs to. Files are taken as the same one
+// if their size, modification time and inode (if there are inodes) match.
+//
+struct WaveViewTreeCacheSource {
+  QString  path;
+  bool     valid = false;
+  uint64_t size  = 0;
+  uint64_t inode = 0;
+  int64_t  mtime = 0; // Nanoseconds since the epoch
+
+  bool refresh(void);
+
+  inline bool
+  isSameFile(WaveViewTreeCacheSource const &other) const
+  {
+    return valid
+        && other.valid
+        && size == other.size
+        && inode == other.inode
+        && mtime == other.mtime;
+  }
+};
 
 class WaveWorker;
+class QFile;
 
 class WaveViewTree : public QObject, public QList<WaveLimitVector> {
   Q_OBJECT
 
   QThread         *m_workerThread;
   WaveWorker      *m_currentWorker = nullptr;
-  const SUCOMPLEX *m_data = nullptr;
+  WaveWorker      *m_serialWorker = nullptr;
+  WaveSamples      m_data;
   SUSCOUNT         m_length = 0;
+  std::atomic<SUSCOUNT> m_built{0}; // Watermark: samples summarized so far
 
   SUCOMPLEX        m_oMin, m_oMax;
   SUCOMPLEX        m_mean;
@@ -67,8 +367,47 @@ class WaveViewTree : public QObject, public QList<WaveLimitVector> {
   SuWidgetsHelpers::KahanState m_state;
 
   bool             m_complete = true;
+  int              m_blockBits = WAVEFORM_BLOCK_BITS;
+  int              m_blockLength = WAVEFORM_BLOCK_LENGTH;
+  bool             m_compactLevels = false;
+  int              m_evictedLevels = 0; // See evictLevel()
+  unsigned int     m_generation = 0; // Bumped whenever levels are dropped
+
+  // On-disk cache of the tree
+  QString          m_cachePath;
+  WaveViewTreeCacheSource m_cacheSource;
+  QSharedPointer<QFile> m_cacheFile; // Keeps cached levels mapped
 
   friend class WaveWorker;
+  friend class WaveSpanTask;
+  friend class WaveTreeRegistry;
+
+  void allocateLevels(SUSCOUNT length);
+  SUSCOUNT allocatedLength(void) const;
+  void compactLevels(void);
+  void expandLevels(void);
+
+  // Levels [0, m_evictedLevels) are gone: raw samples are read instead
+  inline int
+  baseBits(void) const
+  {
+    return (m_evictedLevels + 1) * m_blockBits;
+  }
+
+  inline WaveViewTree::const_iterator
+  firstLevel(void) const
+  {
+    return cbegin() + m_evictedLevels;
+  }
+
+  static QByteArray contentHash(WaveSamples const &data, SUSCOUNT length);
+  bool loadCache(WaveSamples const &data, SUSCOUNT length);
+  bool saveCache(
+      QString const &path,
+      WaveViewTreeCacheSource const &source,
+      WaveSamples const &data,
+      SUSCOUNT length,
+      const std::atomic<bool> *cancel) const;
 
   static void calcLimitsBuf(
       WaveLimits &limit,
@@ -78,10 +417,80 @@ class WaveViewTree : public QObject, public QList<WaveLimitVector> {
 
   static void calcLimitsBlock(
       WaveLimits &limit,
-      const WaveLimits *__restrict data,
+      const WaveLimitVector &data,
+      size_t offset,
       size_t len,
       SUFLOAT wEnd = 1);
 
+  static void calcSumsBuf(
+      WaveLimits &limit,
+      const SUCOMPLEX *__restrict buf,
+      size_t len);
+
+  static void calcSumsBlock(
+      WaveLimits &limit,
+      const WaveLimitVector &data,
+      size_t offset,
+      size_t len);
+
+  static void accumulateStatsBuf(
+      WaveRangeStats &stats,
+      SuWidgetsHelpers::KahanState &state,
+      const SUCOMPLEX *buf,
+      size_t len);
+
+  static void accumulateStatsBlock(
+      WaveRangeStats &stats,
+      SuWidgetsHelpers::KahanState &state,
+      const WaveLimitVector &data,
+      size_t offset,
+      size_t len);
+
+  void computeRangeStatsFar(
+      WaveViewTree::const_iterator p,
+      qint64 start,
+      qint64 end,
+      WaveRangeStats &stats,
+      SuWidgetsHelpers::KahanState &state) const;
+
+  static bool searchCandidate(
+      const WaveLimitVector &data,
+      size_t i,
+      const WaveSearchQuery &query,
+      bool above);
+
+  qint64 searchBuf(
+      qint64 start,
+      qint64 end,
+      const WaveSearchQuery &query,
+      bool above) const;
+
+  qint64 searchEntry(
+      WaveViewTree::const_iterator p,
+      qint64 i,
+      const WaveSearchQuery &query,
+      bool above) const;
+
+  qint64 searchEntries(
+      WaveViewTree::const_iterator p,
+      qint64 start,
+      qint64 end,
+      const WaveSearchQuery &query,
+      bool above) const;
+
+  qint64 searchFar(
+      WaveViewTree::const_iterator p,
+      qint64 start,
+      qint64 end,
+      const WaveSearchQuery &query,
+      bool above) const;
+
+  qint64 searchLevel(
+      qint64 start,
+      qint64 end,
+      const WaveSearchQuery &query,
+      bool above) const;
+
 public:
   inline bool
   isComplete(void) const
@@ -119,8 +528,65 @@ public:
     return this->m_complete ? m_rms : 0;
   }
 
+  inline int
+  getBlockBits(void) const
+  {
+    return this->m_blockBits;
+  }
+
+  inline int
+  getBlockLength(void) const
+  {
+    return this->m_blockLength;
+  }
+
+  inline bool
+  getCompactLevels(void) const
+  {
+    return this->m_compactLevels;
+  }
+
+  // Lowest level that can be read (see evictLevel())
+  inline int
+  getFirstLevel(void) const
+  {
+    return this->m_evictedLevels;
+  }
+
+  // Changes whenever the levels are dropped and built again. Anything
+  // derived from the levels (e.g. painted columns) is stale after it.
+  inline unsigned int
+  getGeneration(void) const
+  {
+    return this->m_generation;
+  }
+
+  inline QString
+  getCachePath(void) const
+  {
+    return this->m_cachePath;
+  }
+
+  //
+  // Build watermark. Blocks that only cover samples below it are final, and
+  // can be read from the thread of the tree even while a worker is still
+  // building the rest (levels are never reallocated by workers).
+  //
+  inline SUSCOUNT
+  getBuilt(void) const
+  {
+    return this->m_built.load(std::memory_order_acquire);
+  }
+
+  // Null if samples are not SUCOMPLEX (see getSamples())
   inline const SUCOMPLEX *
   getData(void) const
+  {
+    return this->m_data.native();
+  }
+
+  inline WaveSamples const &
+  getSamples(void) const
   {
     return this->m_data;
   }
@@ -134,8 +600,15 @@ public:
   WaveViewTree(QObject *parent = nullptr);
   ~WaveViewTree() override;
 
-  bool reprocess(const SUCOMPLEX *, SUSCOUNT newLength);
+  bool reprocess(WaveSamples const &, SUSCOUNT newLength);
   bool clear(void);
+  bool setBlockBits(int bits);
+  void setCompactLevels(bool compact);
+  bool evictLevel(void);
+  size_t memoryUsage(void) const;
+  void setCachePath(QString const &path, QString const &source);
+  bool discard(SUSCOUNT count);
+  SUSCOUNT getDiscardAlignment(void) const;
   void safeCancel(void);
   void computeLimitsFar(
       WaveViewTree::const_iterator p,
@@ -143,6 +616,8 @@ public:
       qint64 end,
       WaveLimits &limits) const;
   void computeLimits(qint64 start, qint64 end, WaveLimits &limits) const;
+  bool computeRangeStats(qint64 start, qint64 end, WaveRangeStats &stats) const;
+  qint64 search(qint64 from, const WaveSearchQuery &query) const;
 
 signals:
   void ready(void);
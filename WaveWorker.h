@@ -21,28 +21,91 @@
 
 #include <QMutex>
 #include <QWaitCondition>
+#include <QRunnable>
+#include <QSemaphore>
+#include <atomic>
 
 #include "WaveViewTree.h"
 
+class WaveWorker;
+
+//
+// A span task builds the lower levels of the tree (and the sample limits)
+// for a contiguous, aligned span of the waveform. Spans never share entries
+// in the levels they build, so several of them can run at the same time
+// in the global thread pool. The upper levels are stitched afterwards by
+// the worker.
+//
+class WaveSpanTask : public QRunnable {
+  WaveWorker *m_worker = nullptr;
+  SUSCOUNT    m_start  = 0;
+  SUSCOUNT    m_end    = 0;
+  int         m_depth  = 0;
+  SUFLOAT     m_wEnd   = 1;
+  SUCOMPLEX   m_min    = 0;
+  SUCOMPLEX   m_max    = 0;
+  SuWidgetsHelpers::KahanState m_state; // Partial sums, merged in order
+  QSemaphore  m_done;
+
+  friend class WaveWorker;
+
+public:
+  WaveSpanTask(WaveWorker *, SUSCOUNT start, SUSCOUNT end, int depth);
+
+  void run(void) override;
+  void waitForDone(void);
+};
+
 class WaveWorker : public QObject {
   Q_OBJECT
 
   SUSCOUNT m_since = 0;
   WaveViewTree *m_owner = nullptr;
-  bool m_cancelFlag = false;
+  std::atomic<bool> m_cancelFlag;
   bool m_running = true;
 
+  // Where to save the tree once done (if not empty)
+  QString m_cachePath;
+  WaveViewTreeCacheSource m_cacheSource; // As when the build started
+  bool m_cacheSaved = false;
+
+  // Extensions requested while span tasks are running
+  bool m_parallel = false;
+  bool m_havePending = false;
+  WaveSamples m_pendingData;
+  SUSCOUNT m_pendingLength = 0;
+
   // Used to wait for completion
   QMutex m_mutex;
   QWaitCondition m_finishedCondition;
 
+  friend class WaveSpanTask;
+  friend class WaveViewTree;
+
   // Private methods
-  void buildNextView(
+  SUFLOAT buildNextView(
       WaveViewTree::iterator,
       SUSCOUNT start,
       SUSCOUNT end,
-      SUFLOAT wEnd);
-  void build(SUSCOUNT start, SUSCOUNT end);
+      SUFLOAT wEnd,
+      int depth = -1);
+  SUFLOAT build(
+      SUSCOUNT start,
+      SUSCOUNT end,
+      const SUCOMPLEX *data,
+      int depth = -1);
+  SUSCOUNT buildParallel(SUSCOUNT since);
+
+  // Samples before `start` that build() reads: the ones of its first block
+  // and, unless that block is the first one, the sample right before it.
+  inline size_t
+  buildHistory(SUSCOUNT start) const
+  {
+    SUSCOUNT mask = SCAST(SUSCOUNT, m_owner->m_blockLength - 1);
+    SUSCOUNT first = start & ~mask;
+
+    return SCAST(size_t, start - first) + (first > 0 ? 1 : 0);
+  }
 
 public:
   WaveWorker(WaveViewTree *, SUSCOUNT since, QObject *parent = nullptr);
@@ -51,6 +114,9 @@ public:
   inline bool running() const { return m_running; }
   inline bool isCancelled() const { return m_cancelFlag; }
 
+  void restart(SUSCOUNT since);
+  bool extendTo(WaveSamples const &data, SUSCOUNT length);
+
 public slots:
   void run(void);
   void cancel(void);
@@ -23,7 +23,13 @@
 #include <QColormap>
 #include <QApplication>
 #include <SuWidgetsHelpers.h>
+#include <QFile>
 #include <assert.h>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#  include <sys/mman.h>
+#endif // Q_OS_UNIX
 
 ////////////////////////// WaveBuffer methods //////////////////////////////////
 void
@@ -33,9 +39,17 @@ WaveBuffer::operator=(const WaveBuffer &prev)
   m_ownBuffer = prev.m_ownBuffer;
   m_loan      = prev.m_loan;
   m_ro        = prev.m_ro;
+  m_private   = prev.m_private;
+
+  m_ro_data     = prev.m_ro_data;
+  m_ro_size     = prev.m_ro_size;
+  m_file        = prev.m_file;
+  m_cachePath   = prev.m_cachePath;
+  m_cacheSource = prev.m_cacheSource;
 
-  m_ro_data   = prev.m_ro_data;
-  m_ro_size   = prev.m_ro_size;
+  m_window    = prev.m_window;
+  m_discarded = prev.m_discarded;
+  m_dirty     = prev.m_dirty;
 
   if (!isLoan())
     m_buffer = &m_ownBuffer;
@@ -46,29 +60,40 @@ WaveBuffer::operator=(const WaveBuffer &prev)
 // Constructor by allocation of new buffer
 WaveBuffer::WaveBuffer(WaveView *view)
 {
-  m_view   = view;
-  m_buffer = &m_ownBuffer;
-  m_loan   = false;
-  m_ro     = false;
+  m_view    = view;
+  m_buffer  = &m_ownBuffer;
+  m_loan    = false;
+  m_ro      = false;
+  m_private = true;
 
   assert(isLoan() || m_buffer == &m_ownBuffer);
 
   updateBuffer();
 }
 
-// Constructor by loan (read / write)
-WaveBuffer::WaveBuffer(WaveView *view, const std::vector<SUCOMPLEX> *vec)
+//
+// Constructor by loan (read / write). Vectors of the widget itself (e.g.
+// trigger windows) are private: they are refilled in place.
+//
+WaveBuffer::WaveBuffer(
+    WaveView *view,
+    const std::vector<SUCOMPLEX> *vec,
+    bool isPrivate)
 {
-  m_view   = view;
-  m_loan   = true;
-  m_ro     = false;
-  m_buffer = vec;
+  m_view    = view;
+  m_loan    = true;
+  m_ro      = false;
+  m_private = isPrivate;
+  m_buffer  = vec;
 
   updateBuffer();
 }
 
 // Constructor by loan (read only)
-WaveBuffer::WaveBuffer(WaveView *view, const SUCOMPLEX *data, size_t size)
+WaveBuffer::WaveBuffer(
+    WaveView *view,
+    WaveSamples const &data,
+    size_t size)
 {
   m_view    = view;
   m_buffer  = nullptr;
@@ -81,18 +106,70 @@ WaveBuffer::WaveBuffer(WaveView *view, const SUCOMPLEX *data, size_t size)
   updateBuffer();
 }
 
-bool
-WaveBuffer::feed(SUCOMPLEX val)
+// Constructor by file mapping (read only). The file keeps data mapped.
+WaveBuffer::WaveBuffer(
+    WaveView *view,
+    QSharedPointer<QFile> const &file,
+    WaveSamples const &data,
+    size_t size)
 {
-  if (m_loan)
-    return false;
+  m_view    = view;
+  m_buffer  = nullptr;
+  m_loan    = true;
+  m_ro      = true;
+  m_file    = file;
+
+  m_cacheSource = file->fileName();
+  m_cachePath   = m_cacheSource + WAVEFORM_LOD_CACHE_SUFFIX;
+
+  m_ro_data = data;
+  m_ro_size = size;
 
-  m_ownBuffer.push_back(val);
+  updateBuffer();
+}
+
+//
+// Sliding window. Samples are dropped in chunks (aligned to what the tree
+// can shift in place), and only once the buffer has grown past the window
+// by some slack. This keeps both memory and the cost per sample bounded.
+//
+void
+WaveBuffer::slide()
+{
+  size_t size = m_ownBuffer.size();
+  size_t align, slack, drop;
+
+  if (m_loan || m_window == 0 || size <= m_window)
+    return;
+
+  align = m_view != nullptr ? m_view->getDiscardAlignment() : 1;
+  slack = MAX(m_window / WAVEFORM_WINDOW_SLACK_DIVISOR, align);
 
+  if (size < m_window + slack)
+    return;
+
+  drop = size - m_window;
+  if (drop >= align)
+    drop -= drop % align;
+
+  // The view needs the samples to be discarded
   if (m_view != nullptr)
-    m_view->refreshBuffer(&m_ownBuffer);
+    m_view->discardBuffer(drop);
 
-  return true;
+  m_ownBuffer.erase(m_ownBuffer.begin(), m_ownBuffer.begin() + drop);
+  m_discarded += drop;
+}
+
+void
+WaveBuffer::setWindow(size_t window)
+{
+  m_window = window;
+}
+
+bool
+WaveBuffer::feed(SUCOMPLEX val)
+{
+  return feed(&val, 1);
 }
 
 void
@@ -106,11 +183,58 @@ WaveBuffer::rebuildViews()
 
 bool
 WaveBuffer::feed(std::vector<SUCOMPLEX> const &vec)
+{
+  return feed(vec.data(), vec.size());
+}
+
+bool
+WaveBuffer::feed(const SUCOMPLEX *data, size_t size)
+{
+  if (!append(data, size))
+    return false;
+
+  flush();
+
+  return true;
+}
+
+//
+// Appends samples without telling the view. Producers pushing many small
+// chunks call flush() once in a while (e.g. once per frame), so that the
+// tree is extended once for all of them.
+//
+bool
+WaveBuffer::append(const SUCOMPLEX *data, size_t size)
 {
   if (m_loan)
     return false;
 
-  m_ownBuffer.insert(m_ownBuffer.end(), vec.begin(), vec.end());
+  // The buffer is about to move: trees being built from it must stop
+  // reading it first. They resume from where they were on refresh. Trees
+  // of private buffers are never shared, so the view can stop them all.
+  if (m_view != nullptr
+      && m_ownBuffer.size() + size > m_ownBuffer.capacity())
+    m_view->safeCancel();
+
+  m_ownBuffer.insert(m_ownBuffer.end(), data, data + size);
+  m_dirty = true;
+
+  return true;
+}
+
+//
+// Slides the window and refreshes the view after appending samples.
+// Returns false if there was nothing to do.
+//
+bool
+WaveBuffer::flush()
+{
+  if (!m_dirty)
+    return false;
+
+  m_dirty = false;
+
+  slide();
   refreshBufferCache();
 
   if (m_view != nullptr)
@@ -132,7 +256,15 @@ WaveBuffer::data() const
 {
   assert(isLoan() || m_buffer == &m_ownBuffer);
 
-  return m_ro ? m_ro_data : m_buffer->data();
+  return m_ro ? m_ro_data.native() : m_buffer->data();
+}
+
+WaveSamples
+WaveBuffer::samples() const
+{
+  assert(isLoan() || m_buffer == &m_ownBuffer);
+
+  return m_ro ? m_ro_data : WaveSamples(m_buffer->data());
 }
 
 const std::vector<SUCOMPLEX> *
@@ -262,6 +394,29 @@ Waveform::zoomHorizontal(qint64 start, qint64 end)
   }
 }
 
+//
+// Next (or previous) sample that meets the query, or -1 if none does. If
+// asked to, the view is centered on it, keeping the zoom level.
+//
+qint64
+Waveform::search(qint64 from, const WaveSearchQuery &query, bool show)
+{
+  qint64 hit, span;
+
+  if (m_data.isDirty())
+    flushFeed();
+
+  hit = m_view.search(from, query);
+
+  if (hit >= 0 && show) {
+    span = m_view.getViewSampleInterval();
+    zoomHorizontal(hit - span / 2, hit - span / 2 + span);
+    invalidate();
+  }
+
+  return hit;
+}
+
 void
 Waveform::saveHorizontal()
 {
@@ -685,15 +840,9 @@ Waveform::overlayPoints(QPainter &p)
         m_pointMap.upperBound(samp2t(getSampleEnd()));
 
     for (auto m = begin; m != end; ++m) {
-      int tw;
+      int tw = textWidth(metrics, m->string);
       qint64 xpx = SCAST(qint64, t2px(m->t));
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
-      tw = metrics.horizontalAdvance(m->string);
-#else
-      tw = metrics.width(m->string);
-#endif // QT_VERSION_CHECK
-
       if (xpx >= 0 && xpx < m_geometry.width() - tw / 2) {
         qreal y = m_view.isRealComponent()
             ? SU_C_REAL(m->point)
@@ -761,28 +910,56 @@ Waveform::overlayMarkers(QPainter &p)
     QFontMetrics metrics(font);
     QPen pen(m_text);
     QRect rect;
+    qreal first, last;
+
+    // Markers are sorted by sample once, so that only those on screen
+    // are visited
+    if (!m_markerIndexValid) {
+      m_markerIndex.resize(SCAST(size_t, m_markerList.size()));
+
+      for (int i = 0; i < m_markerList.size(); ++i)
+        m_markerIndex[SCAST(size_t, i)] = i;
+
+      std::stable_sort(
+            m_markerIndex.begin(),
+            m_markerIndex.end(),
+            [this] (int a, int b) {
+              return m_markerList.at(a).x < m_markerList.at(b).x;
+            });
+
+      m_markerIndexValid = true;
+    }
+
+    first = px2samp(0);
+    last  = px2samp(m_geometry.width());
+
+    auto begin = std::lower_bound(
+          m_markerIndex.begin(),
+          m_markerIndex.end(),
+          first,
+          [this] (int index, qreal samp) {
+            return SCAST(qreal, m_markerList.at(index).x) < samp;
+          });
 
     p.setPen(pen);
 
-    for (auto m = m_markerList.begin();
-         m != m_markerList.end();
-         ++m)
-    {
+    for (auto i = begin; i != m_markerIndex.end(); ++i) {
+      WaveMarker const &m = m_markerList.at(*i);
       int tw;
-      qint64 px = SCAST(qint64, samp2px(m->x));
+      qint64 px;
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
-      tw = metrics.horizontalAdvance(m->string);
-#else
-      tw = metrics.width(m->string);
-#endif // QT_VERSION_CHECK
+      if (SCAST(qreal, m.x) > last)
+        break;
+
+      tw = textWidth(metrics, m.string);
+      px = SCAST(qint64, samp2px(m.x));
 
       if (px >= 0 && px < m_geometry.width() - tw / 2) {
-        qreal y = m->x < getDataLength()
-            ? cast(getData()[m->x])
+        qreal y = m.x < getDataLength()
+            ? cast(getSamples()[m.x])
             : 0;
         int ypx = value2px(y) +
-            (m->below ? 2 : - metrics.height() - 2);
+            (m.below ? 2 : - metrics.height() - 2);
 
         ypx = qBound(0, ypx, m_geometry.height() - metrics.height());
 
@@ -792,7 +969,7 @@ Waveform::overlayMarkers(QPainter &p)
               tw,
               metrics.height());
         p.setOpacity(1);
-        p.drawText(rect, Qt::AlignHCenter | Qt::AlignBottom,m->string);
+        p.drawText(rect, Qt::AlignHCenter | Qt::AlignBottom, m.string);
       }
     }
   }
@@ -877,10 +1054,60 @@ Waveform::drawWave()
 
   overlayACursors(p);
   m_view.drawWave(p);
+
+  if (!m_markerList.empty()
+      || !m_vCursorList.empty()
+      || !m_pointMap.empty()) {
+    if (!m_overlayDrawn || !(overlayState() == m_overlayState))
+      drawOverlay();
+
+    p.drawImage(0, 0, m_overlay);
+  }
+
+  p.end();
+}
+
+WaveOverlayState
+Waveform::overlayState(void) const
+{
+  WaveOverlayState state;
+
+  state.start         = getSampleStart();
+  state.end           = getSampleEnd();
+  state.min           = getMin();
+  state.max           = getMax();
+  state.size          = m_waveform.size();
+  state.realComponent = m_view.isRealComponent();
+  state.text          = m_text.rgba();
+
+  return state;
+}
+
+//
+// Annotations are painted on a layer of their own, which is only repainted
+// if they or the zoom change. Markers follow the data, so new samples
+// repaint it too if there are any.
+//
+void
+Waveform::drawOverlay(void)
+{
+  if (m_overlay.size() != m_waveform.size())
+    m_overlay = QImage(
+          m_waveform.size(),
+          QImage::Format_ARGB32_Premultiplied);
+
+  m_overlay.fill(Qt::transparent);
+
+  QPainter p(&m_overlay);
+
   overlayMarkers(p);
   overlayVCursors(p);
   overlayPoints(p);
+
   p.end();
+
+  m_overlayState = overlayState();
+  m_overlayDrawn = true;
 }
 
 static inline int
@@ -895,6 +1122,29 @@ estimateTextWidth(QFontMetrics &metrics, QString label)
   return tw;
 }
 
+int
+Waveform::textWidth(QFontMetrics const &metrics, QString const &label)
+{
+  auto it = m_textWidths.constFind(label);
+  int tw;
+
+  if (it != m_textWidths.constEnd())
+    return *it;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+  tw = metrics.horizontalAdvance(label);
+#else
+  tw = metrics.width(label);
+#endif // QT_VERSION_CHECK
+
+  if (m_textWidths.size() >= WAVEFORM_TEXT_WIDTH_CACHE_SIZE)
+    m_textWidths.clear();
+
+  m_textWidths.insert(label, tw);
+
+  return tw;
+}
+
 void
 Waveform::drawVerticalAxes()
 {
@@ -1135,9 +1385,41 @@ Waveform::overlaySelectionMarkes(QPainter &p)
   }
 }
 
+//
+// The eye diagram follows the periodic selection: traces start at the
+// beginning of the selection and are as long as all its divisions.
+//
+void
+Waveform::updateEye()
+{
+  bool show = m_persistence && m_periodicSelection && m_hSelection;
+
+  if (show != m_view.isEyeVisible()) {
+    m_view.setShowEye(show);
+    m_waveDrawn = false;
+  }
+
+  if (show) {
+    qreal period = (m_hSelEnd - m_hSelStart) / m_divsPerSelection;
+
+    if (m_hSelStart != m_view.getEyeOrigin()
+        || period != m_view.getEyePeriod()
+        || m_divsPerSelection != m_view.getEyeSpan()) {
+      m_view.setEyePeriod(m_hSelStart, period, m_divsPerSelection);
+      m_waveDrawn = false;
+    }
+  }
+}
+
 void
 Waveform::draw()
 { 
+  // Samples (or trigger windows) fed since the last frame
+  if (m_data.isDirty() || m_trigger.isReady())
+    flushFeed();
+
+  updateEye();
+
   if (!size().isValid())
     return;
 
@@ -1170,7 +1452,7 @@ Waveform::draw()
     m_waveform      = QImage(
           m_view.width(),
           m_view.height(),
-          QImage::Format_ARGB32);
+          QImage::Format_ARGB32_Premultiplied);
 
     recalculateDisplayData();
     m_selUpdated = false;
@@ -1268,7 +1550,7 @@ Waveform::setData(
 
   } else {
     if (data != nullptr)
-      m_data = WaveBuffer(&m_view, data);
+      m_data = WaveBuffer(&m_view, data, data == &m_triggerWindow);
     else
       m_data = WaveBuffer(&m_view);
   }
@@ -1276,7 +1558,7 @@ Waveform::setData(
 
 void
 Waveform::setData(
-    const SUCOMPLEX *data,
+    WaveSamples const &data,
     size_t size,
     bool keepView,
     bool flush,
@@ -1297,13 +1579,227 @@ Waveform::setData(
     }
 
   } else {
-    if (data != nullptr)
+    if (!data.isNull())
       m_data = WaveBuffer(&m_view, data, size);
     else
       m_data = WaveBuffer(&m_view);
   }
 }
 
+//
+// Streaming interface. Samples are appended to a buffer owned by the
+// waveform (a loaned buffer is replaced by an empty one). If a window
+// length is set, old samples are dropped as new ones arrive.
+//
+bool
+Waveform::feed(const SUCOMPLEX *data, size_t size)
+{
+  // Triggered feed: chunks are scanned as they arrive, and the view is
+  // only refreshed when a window is complete
+  if (m_triggerEnabled) {
+    if (m_trigger.feed(data, size)) {
+      if (m_coalesceFeed)
+        invalidate();
+      else
+        flushFeed();
+    }
+
+    return true;
+  }
+
+  if (m_data.isLoan())
+    m_data = WaveBuffer(&m_view);
+
+  m_data.setWindow(m_windowLength);
+
+  if (!m_data.append(data, size))
+    return false;
+
+  // Coalesced feed: the view catches up once per frame, from draw()
+  if (m_coalesceFeed)
+    invalidate();
+  else
+    flushFeed();
+
+  return true;
+}
+
+//
+// Hands the samples fed so far to the view (and slides the window)
+//
+void
+Waveform::flushFeed()
+{
+  quint64 discarded = m_data.discarded();
+  qreal shift;
+
+  if (m_triggerEnabled) {
+    publishTrigger();
+    return;
+  }
+
+  if (!m_data.flush())
+    return;
+
+  discarded = m_data.discarded() - discarded;
+
+  // Keep sample-based state pointing to the same samples
+  if (discarded > 0) {
+    shift = SCAST(qreal, discarded);
+
+    if (m_hSelection) {
+      m_hSelStart -= shift;
+      m_hSelEnd   -= shift;
+
+      if (m_hSelStart < 0)
+        m_hSelStart = 0;
+
+      if (m_hSelEnd < 0)
+        m_hSelection = false;
+      else
+        emit horizontalSelectionChanged(m_hSelStart, m_hSelEnd);
+
+      m_selUpdated = false;
+    }
+
+    if (!m_markerList.empty()) {
+      for (auto p = m_markerList.begin(); p != m_markerList.end(); ) {
+        if (p->x < discarded) {
+          p = m_markerList.erase(p);
+        } else {
+          p->x -= discarded;
+          ++p;
+        }
+      }
+
+      m_markerIndexValid = false;
+    }
+  }
+
+  refreshData();
+}
+
+//
+// Shows the last complete window of the trigger. It replaces the whole
+// buffer, whose storage is recycled from one window to the next. The
+// trigger point is always at the same position of the window, so the
+// horizontal zoom is kept once the first one is in.
+//
+void
+Waveform::publishTrigger()
+{
+  bool keepView = m_data.loanedBuffer() == &m_triggerWindow;
+
+  if (!m_trigger.isReady())
+    return;
+
+  // The tree may still be reading the previous window. Trigger windows are
+  // private buffers, so it is never a shared tree that the view cannot stop.
+  m_view.safeCancel();
+  m_trigger.takeWindow(m_triggerWindow);
+
+  setData(&m_triggerWindow, keepView, true);
+}
+
+void
+Waveform::setWindowLength(size_t length)
+{
+  m_windowLength = length;
+}
+
+//
+// In coalesced mode, feed() only appends samples to the buffer. The tree
+// is extended once per frame (i.e. per tick of the throttle control, if
+// any) no matter how many chunks arrived in between.
+//
+void
+Waveform::setCoalesceFeed(bool coalesce)
+{
+  m_coalesceFeed = coalesce;
+
+  if (!coalesce)
+    flushFeed();
+}
+
+//
+// Trigger of the streaming interface. Changing it restarts the search for
+// trigger points. Returns false if the parameters make no sense (e.g. the
+// pre-trigger part does not fit in the window).
+//
+bool
+Waveform::setTrigger(WaveTriggerParams const &params)
+{
+  return m_trigger.setParams(params);
+}
+
+void
+Waveform::setTriggerEnabled(bool enabled)
+{
+  if (enabled == m_triggerEnabled)
+    return;
+
+  m_triggerEnabled = enabled;
+  m_trigger.reset();
+
+  // Plain streaming starts over from an empty buffer of its own
+  if (!enabled && m_data.loanedBuffer() == &m_triggerWindow)
+    m_data = WaveBuffer(&m_view);
+}
+
+//
+// Displays a raw capture file without loading it in memory. The file is
+// mapped read-only and the tree is built directly from the page cache.
+// Float captures are interleaved 32-bit float I/Q samples, i.e. SUCOMPLEX
+// in single precision builds. Integer captures (sc16, sc8) are mapped as
+// they are, and converted to full scale [-1, 1) as the tree reads them.
+//
+bool
+Waveform::setDataFromFile(
+    QString const &path,
+    bool keepView,
+    WaveSampleFormat format)
+{
+  QSharedPointer<QFile> file;
+  qint64 sampleSize = SCAST(qint64, WaveSamples::sampleSize(format));
+  qint64 size;
+  uchar *map;
+
+#ifndef _SU_SINGLE_PRECISION
+  if (format == WAVE_SAMPLE_COMPLEX)
+    return false;
+#endif // _SU_SINGLE_PRECISION
+
+  file = QSharedPointer<QFile>(new QFile(path));
+
+  if (!file->open(QIODevice::ReadOnly))
+    return false;
+
+  size = file->size() / sampleSize;
+  if (size == 0)
+    return false;
+
+  map = file->map(0, size * sampleSize);
+  if (map == nullptr)
+    return false;
+
+#ifdef Q_OS_UNIX
+  // The tree is built front to back: let the kernel read ahead
+  posix_madvise(
+        map,
+        SCAST(size_t, size * sampleSize),
+        POSIX_MADV_SEQUENTIAL);
+#endif // Q_OS_UNIX
+
+  m_askedToKeepView = keepView;
+  m_data = WaveBuffer(
+        &m_view,
+        file,
+        WaveSamples(map, format),
+        SCAST(size_t, size));
+
+  return true;
+}
+
 void
 Waveform::setRealComponent(bool real)
 {
@@ -1382,6 +1878,45 @@ Waveform::setShowWaveform(bool show)
   invalidate();
 }
 
+bool
+Waveform::setBlockBits(int bits)
+{
+  if (!m_view.setBlockBits(bits))
+    return false;
+
+  m_waveDrawn = false;
+  invalidate();
+
+  return true;
+}
+
+void
+Waveform::setCompactLevels(bool compact)
+{
+  m_view.setCompactLevels(compact);
+
+  m_waveDrawn = false;
+  invalidate();
+}
+
+void
+Waveform::setShareTrees(bool share)
+{
+  m_view.setShareTrees(share);
+
+  m_waveDrawn = false;
+  invalidate();
+}
+
+void
+Waveform::setPersistence(bool persistence)
+{
+  m_persistence = persistence;
+
+  m_waveDrawn = false;
+  invalidate();
+}
+
 void
 Waveform::triggerMouseMoveHere()
 {
@@ -1416,6 +1951,10 @@ Waveform::refreshData()
       triggerMouseMoveHere();
   }
 
+  // Markers follow the data
+  if (!m_markerList.empty())
+    m_overlayDrawn = false;
+
   m_waveDrawn = false;
 
   recalculateDisplayData();
@@ -1480,12 +2019,20 @@ Waveform::Waveform(QWidget *parent) :
         this,
         SLOT(onWaveViewChanges()));
 
+  connect(
+        &m_view,
+        SIGNAL(eyeProgress()),
+        this,
+        SLOT(onEyeProgress()));
+
   setMouseTracking(true);
   invalidate();
 }
 
 Waveform::~Waveform()
 {
+  // m_data (possibly a file mapping) goes away before m_view does
+  safeCancel();
 }
 
 void
@@ -1497,6 +2044,9 @@ Waveform::onWaveViewChanges()
   m_waveDrawn = false;
   m_axesDrawn = false;
 
+  if (!m_markerList.empty())
+    m_overlayDrawn = false;
+
   if (!m_askedToKeepView) {
     resetSelection();
 
@@ -1514,3 +2064,13 @@ Waveform::onWaveViewChanges()
   invalidate();
   emit waveViewChanged();
 }
+
+void
+Waveform::onEyeProgress()
+{
+  if (!m_persistence)
+    return;
+
+  m_waveDrawn = false;
+  invalidate();
+}
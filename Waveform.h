@@ -24,10 +24,13 @@
 #include <QWheelEvent>
 #include <QList>
 #include <QMap>
+#include <QHash>
+#include <QSharedPointer>
 
 #include <sigutils/types.h>
 #include "ThrottleableWidget.h"
 #include "WaveView.h"
+#include "WaveTrigger.h"
 
 #define WAVEFORM_DEFAULT_BACKGROUND_COLOR QColor(0x1d, 0x1d, 0x1f)
 #define WAVEFORM_DEFAULT_FOREGROUND_COLOR QColor(0xff, 0xff, 0x00)
@@ -41,6 +44,17 @@
 #define WAVEFORM_POINT_RADIUS             5
 #define WAVEFORM_POINT_SPACING            3
 
+// In sliding window mode, samples are dropped once the buffer exceeds the
+// window by at least 1 / WAVEFORM_WINDOW_SLACK_DIVISOR of its length
+#define WAVEFORM_WINDOW_SLACK_DIVISOR     4
+
+// Trees of mapped captures are cached next to them, with this suffix
+#define WAVEFORM_LOD_CACHE_SUFFIX         ".lod"
+
+// Annotation labels whose width is remembered (the cache is emptied once
+// it holds more than this)
+#define WAVEFORM_TEXT_WIDTH_CACHE_SIZE    4096
+
 struct WavePoint {
   QString string;
   QColor color = WAVEFORM_DEFAULT_TEXT_COLOR;
@@ -68,18 +82,59 @@ struct WaveACursor {
   SUFLOAT amplitude;
 };
 
+//
+// Everything but the annotations themselves that affects the overlay layer.
+// The layer is only repainted if it changed (or annotations did).
+//
+struct WaveOverlayState {
+  qint64 start = 0;
+  qint64 end = 0;
+  qreal  min = 0;
+  qreal  max = 0;
+  QSize  size;
+  bool   realComponent = false;
+  QRgb   text = 0;
+
+  inline bool
+  operator==(WaveOverlayState const &other) const
+  {
+    return start == other.start
+        && end == other.end
+        && min == other.min
+        && max == other.max
+        && size == other.size
+        && realComponent == other.realComponent
+        && text == other.text;
+  }
+};
+
+class QFile;
+
 class WaveBuffer {
   WaveView *m_view = nullptr;
 
   std::vector<SUCOMPLEX> m_ownBuffer; // Only if !m_loan
   const std::vector<SUCOMPLEX> *m_buffer = nullptr; // Only if !m_ro
 
-  const SUCOMPLEX *m_ro_data = nullptr;
-  size_t           m_ro_size = 0;
+  WaveSamples m_ro_data;
+  size_t      m_ro_size = 0;
 
   bool m_loan = false; // m_ownBuffer must be ignored
   bool m_ro   = false; // m_buffer must be ignored. Implies m_loan
 
+  // Storage belongs to the widget, which changes it in place (never shared)
+  bool m_private = false;
+
+  QSharedPointer<QFile> m_file; // Keeps m_ro_data mapped. Implies m_ro
+  QString m_cachePath;          // Sidecar of m_file (empty if none)
+  QString m_cacheSource;        // Name of m_file
+
+  size_t  m_window    = 0; // Sliding window length (0: grow forever)
+  quint64 m_discarded = 0; // Samples dropped from the front so far
+  bool    m_dirty     = false; // Appended samples not seen by the view yet
+
+  void slide();
+
   inline void
   refreshBufferCache()
   {
@@ -93,6 +148,9 @@ class WaveBuffer {
   updateBuffer()
   {
     if (m_view != nullptr) {
+      m_view->setPrivateBuffer(m_private);
+      m_view->setCachePath(m_cachePath, m_cacheSource);
+
       if (m_buffer != nullptr)
         m_view->setBuffer(m_buffer);
       else
@@ -113,18 +171,56 @@ public:
     return m_ro;
   }
 
+  inline bool
+  isFileBacked() const
+  {
+    return !m_file.isNull();
+  }
+
   void operator = (const WaveBuffer &);
 
   WaveBuffer(WaveView *view);
-  WaveBuffer(WaveView *view, const std::vector<SUCOMPLEX> *);
-  WaveBuffer(WaveView *view, const SUCOMPLEX *, size_t size);
+  WaveBuffer(
+      WaveView *view,
+      const std::vector<SUCOMPLEX> *,
+      bool isPrivate = false);
+  WaveBuffer(WaveView *view, WaveSamples const &, size_t size);
+  WaveBuffer(
+      WaveView *view,
+      QSharedPointer<QFile> const &,
+      WaveSamples const &,
+      size_t size);
 
   void rebuildViews();
 
   bool feed(SUCOMPLEX val);
   bool feed(std::vector<SUCOMPLEX> const &);
+  bool feed(const SUCOMPLEX *, size_t size);
+  bool append(const SUCOMPLEX *, size_t size);
+  bool flush();
+  void setWindow(size_t);
+
+  inline bool
+  isDirty() const
+  {
+    return m_dirty;
+  }
+
+  inline size_t
+  window() const
+  {
+    return m_window;
+  }
+
+  inline quint64
+  discarded() const
+  {
+    return m_discarded;
+  }
+
   size_t length() const;
   const SUCOMPLEX *data() const;
+  WaveSamples samples() const;
   const std::vector<SUCOMPLEX> *loanedBuffer() const;
 };
 
@@ -216,9 +312,15 @@ class Waveform : public ThrottleableWidget
   QList<WaveACursor>     m_aCursorList;
   QMap<qreal, WavePoint> m_pointMap;
 
+  // Positions of m_markerList, sorted by sample
+  std::vector<int>       m_markerIndex;
+  bool                   m_markerIndexValid = false;
+  QHash<QString, int>    m_textWidths;
+
   qreal m_oX = 0;
 
   bool m_periodicSelection = false;
+  bool m_persistence = false; // Eye diagram of the periodic selection
 
   int m_divsPerSelection = 1;
 
@@ -231,6 +333,9 @@ class Waveform : public ThrottleableWidget
   bool m_enableFeedback = true;
 
   QImage  m_waveform;
+  QImage  m_overlay;       // Markers, vertical cursors and points
+  WaveOverlayState m_overlayState;
+  bool    m_overlayDrawn = false;
   QPixmap m_contentPixmap; // Data and vertical axes
   QPixmap m_axesPixmap;    // Only horizontal axes
 
@@ -285,6 +390,13 @@ class Waveform : public ThrottleableWidget
   // Behavioral properties
   bool m_autoScroll = false;
   bool m_autoFitToEnvelope = true;
+  bool m_coalesceFeed = false;
+  size_t m_windowLength = 0;
+
+  // Triggered feed: the view only gets complete windows
+  WaveTrigger            m_trigger;
+  std::vector<SUCOMPLEX> m_triggerWindow; // Published (loaned to m_data)
+  bool                   m_triggerEnabled = false;
 
   void drawHorizontalAxes();
   void drawVerticalAxes();
@@ -293,7 +405,12 @@ class Waveform : public ThrottleableWidget
   void overlayACursors(QPainter &);
   void overlayVCursors(QPainter &);
   void overlayPoints(QPainter &);
+  void drawOverlay(void);
+  WaveOverlayState overlayState(void) const;
+  int textWidth(QFontMetrics const &, QString const &);
   void drawWave();
+  void updateEye(void);
+  void publishTrigger(void);
   void overlaySelection(QPainter &);
   void overlaySelectionMarkes(QPainter &);
   void recalculateDisplayData();
@@ -332,6 +449,30 @@ public:
       return m_view.isRunning();
     }
 
+    inline int
+    getBlockBits() const
+    {
+      return m_view.getBlockBits();
+    }
+
+    inline bool
+    getCompactLevels() const
+    {
+      return m_view.getCompactLevels();
+    }
+
+    inline bool
+    getShareTrees() const
+    {
+      return m_view.getShareTrees();
+    }
+
+    inline bool
+    getPersistence() const
+    {
+      return m_persistence;
+    }
+
     inline SUCOMPLEX
     getDataMax() const
     {
@@ -392,6 +533,7 @@ public:
       if (!m_pointMap.empty() || !map.empty()) {
         m_pointMap = map;
         m_waveDrawn = false;
+        m_overlayDrawn = false;
         this->invalidate();
       }
     }
@@ -405,10 +547,12 @@ public:
         prev.saved_t = prev.t;
         auto ret = m_pointMap.insert(prev.t, prev);
         m_waveDrawn = false;
+        m_overlayDrawn = false;
         this->invalidate();
         return ret;
       } else {
         m_waveDrawn = false;
+        m_overlayDrawn = false;
         this->invalidate();
         return it;
       }
@@ -419,6 +563,7 @@ public:
     {
       m_pointMap.erase(it);
       m_waveDrawn = false;
+      m_overlayDrawn = false;
       this->invalidate();
     }
 
@@ -435,6 +580,7 @@ public:
 
       auto ret = m_pointMap.insert(p.t, p);
       m_waveDrawn = false;
+      m_overlayDrawn = false;
       this->invalidate();
       return ret;
     }
@@ -444,7 +590,9 @@ public:
     {
       if (!m_markerList.empty() || !list.empty()) {
         m_markerList = list;
+        m_markerIndexValid = false;
         m_waveDrawn = false;
+        m_overlayDrawn = false;
         this->invalidate();
       }
     }
@@ -455,6 +603,7 @@ public:
       if (!m_vCursorList.empty() || !list.empty()) {
         m_vCursorList = list;
         m_waveDrawn = false;
+        m_overlayDrawn = false;
         this->invalidate();
       }
     }
@@ -516,13 +665,27 @@ public:
       return false;
     }
 
+    // Also available while building, restricted to the built samples
+    inline bool
+    computeRangeStats(qint64 start, qint64 end, WaveRangeStats &stats) const
+    {
+      return m_view.computeRangeStats(start, end, stats);
+    }
+
 
+  // Null if samples are not SUCOMPLEX (see getSamples)
   const inline SUCOMPLEX *
   getData() const
   {
     return m_data.data();
   }
 
+  inline WaveSamples
+  getSamples() const
+  {
+    return m_data.samples();
+  }
+
   size_t
   getDataLength() const
   {
@@ -793,12 +956,17 @@ public:
       bool flush = false);
 
   void setData(
-      const SUCOMPLEX *,
+      WaveSamples const &,
       size_t,
       bool keepView = false,
       bool flush = false,
       bool appending = false);
 
+  bool setDataFromFile(
+      QString const &path,
+      bool keepView = false,
+      WaveSampleFormat format = WAVE_SAMPLE_COMPLEX);
+
   void reuseDisplayData(Waveform *);
   void draw() override;
   void paint() override;  
@@ -810,6 +978,7 @@ public:
   void saveHorizontal();
   void scrollHorizontal(qint64 orig, qint64 to);
   void scrollHorizontal(qint64 delta);
+  qint64 search(qint64 from, const WaveSearchQuery &query, bool show = true);
   void selectHorizontal(qreal orig, qreal to);
   bool getHorizontalSelectionPresent() const;
   qreal getHorizontalSelectionStart() const;
@@ -819,6 +988,10 @@ public:
   void setShowPhase(bool);
   void setShowPhaseDiff(bool);
   void setShowWaveform(bool);
+  bool setBlockBits(int);
+  void setCompactLevels(bool);
+  void setShareTrees(bool);
+  void setPersistence(bool);
   void zoomVerticalReset();
   void zoomVertical(qint64 y, qreal amount);
   void zoomVertical(qreal start, qreal end);
@@ -841,6 +1014,43 @@ public:
   void setRealComponent(bool real);
   void refreshData();
 
+  bool feed(const SUCOMPLEX *, size_t);
+  void flushFeed();
+  void setWindowLength(size_t);
+  void setCoalesceFeed(bool);
+  bool setTrigger(WaveTriggerParams const &);
+  void setTriggerEnabled(bool);
+
+  inline size_t
+  getWindowLength() const
+  {
+    return m_windowLength;
+  }
+
+  inline bool
+  getCoalesceFeed() const
+  {
+    return m_coalesceFeed;
+  }
+
+  inline WaveTriggerParams const &
+  getTrigger() const
+  {
+    return m_trigger.params();
+  }
+
+  inline bool
+  isTriggerEnabled() const
+  {
+    return m_triggerEnabled;
+  }
+
+  inline quint64
+  getTriggerCount() const
+  {
+    return m_trigger.count();
+  }
+
 signals:
   void backgroundColorChanged();
   void foregroundColorChanged();
@@ -868,6 +1078,7 @@ signals:
 
 public slots:
   void onWaveViewChanges();
+  void onEyeProgress();
 };
 
 #endif
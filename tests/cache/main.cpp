@@ -0,0 +1,260 @@
+//
+//    main.cpp: Check the on-disk cache of waveform trees
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveViewTree.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+//
+// A tree built from a capture file is saved to the cache once complete.
+// Trees of the same capture load it back as soon as they are given the
+// samples (they are complete right away), and must be identical to the
+// one that was built. Trees of a capture whose file, samples or cache
+// version changed must build themselves again instead.
+//
+
+// Only captures of at least 2^22 samples are cached. Not a multiple of
+// the block length, so that every level has a ragged end.
+#define CACHE_TEST_LENGTH         ((1 << 22) + 1001)
+
+// Offset of the version in the cache file, right after its 8-byte magic
+#define CACHE_TEST_VERSION_OFFSET 8
+
+static std::mt19937 g_rng(0x5754);
+static unsigned     g_checks   = 0;
+static unsigned     g_failures = 0;
+
+static SUFLOAT
+uniform(SUFLOAT min, SUFLOAT max)
+{
+  return std::uniform_real_distribution<SUFLOAT>(min, max)(g_rng);
+}
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+{
+  va_list ap;
+
+  ++g_checks;
+
+  if (!ok) {
+    ++g_failures;
+    fprintf(stderr, "FAIL: %s: ", what);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+  }
+}
+
+static void
+waitFor(WaveViewTree &tree)
+{
+  // Trees of this size are built by the worker thread, which reports back
+  // through the event loop
+  while (!tree.isComplete())
+    QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+}
+
+template <typename T>
+static bool
+sameArray(const T *a, const T *b, size_t n)
+{
+  return std::equal(a, a + n, b);
+}
+
+static bool
+sameLevels(WaveViewTree const &a, WaveViewTree const &b)
+{
+  if (a.size() != b.size())
+    return false;
+
+  for (int l = 0; l < a.size(); ++l) {
+    WaveLimitVector const &p = a[l];
+    WaveLimitVector const &q = b[l];
+    size_t n = p.size();
+
+    if (q.size() != n
+        || !sameArray(p.minData(), q.minData(), n)
+        || !sameArray(p.maxData(), q.maxData(), n)
+        || !sameArray(p.meanData(), q.meanData(), n)
+        || !sameArray(p.sumData(), q.sumData(), n)
+        || !sameArray(p.envelopeData(), q.envelopeData(), n)
+        || !sameArray(p.freqData(), q.freqData(), n)
+        || !sameArray(p.powerData(), q.powerData(), n))
+      return false;
+  }
+
+  return a.getMin() == b.getMin()
+      && a.getMax() == b.getMax()
+      && a.getMean() == b.getMean()
+      && a.getRMS() == b.getRMS();
+}
+
+// Gives the samples to a new tree, and tells whether it took the cache
+static bool
+loadsCache(
+    QString const &cache,
+    QString const &source,
+    std::vector<SUCOMPLEX> const &x,
+    WaveViewTree *built = nullptr)
+{
+  WaveViewTree tree;
+  bool loaded;
+
+  tree.setCachePath(cache, source);
+  tree.reprocess(WaveSamples(x.data()), x.size());
+
+  loaded = tree.isComplete();
+
+  if (loaded && built != nullptr)
+    check(
+          sameLevels(tree, *built),
+          "round trip",
+          "the cached tree differs from the one that was built");
+
+  // Let any rebuild finish (and save its own cache) before moving on
+  waitFor(tree);
+
+  return loaded;
+}
+
+static bool
+patchFile(QString const &path, qint64 offset, QByteArray const &bytes)
+{
+  QFile file(path);
+
+  return file.open(QIODevice::ReadWrite)
+      && file.seek(offset)
+      && file.write(bytes) == bytes.size();
+}
+
+int
+main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QTemporaryDir dir;
+  QString source = dir.path() + "/capture.raw";
+  QString cache  = dir.path() + "/capture.tree";
+  std::vector<SUCOMPLEX> x(CACHE_TEST_LENGTH);
+  WaveViewTree built;
+  QFile file(source);
+  uint32_t version;
+  SUCOMPLEX first;
+
+  for (auto &s : x)
+    s = SUCOMPLEX(uniform(-1, 1), uniform(-1, 1));
+
+  check(dir.isValid(), "setup", "no temporary directory");
+
+  // The capture file holds the samples themselves, as it would
+  check(
+        file.open(QIODevice::WriteOnly)
+        && file.write(
+          RCAST(const char *, x.data()),
+          SCAST(qint64, x.size() * sizeof(SUCOMPLEX)))
+           == SCAST(qint64, x.size() * sizeof(SUCOMPLEX)),
+        "setup",
+        "cannot write the capture file");
+  file.close();
+
+  // Save
+  built.setCachePath(cache, source);
+  built.reprocess(WaveSamples(x.data()), x.size());
+  check(!built.isComplete(), "save", "the tree was not built");
+  waitFor(built);
+  check(QFile::exists(cache), "save", "the tree was not saved");
+
+  // Load
+  check(
+        loadsCache(cache, source, x, &built),
+        "round trip",
+        "the cache of the same capture was rejected");
+
+  // Another version of the format
+  {
+    QFile cacheFile(cache);
+
+    check(
+          cacheFile.open(QIODevice::ReadOnly)
+          && cacheFile.seek(CACHE_TEST_VERSION_OFFSET)
+          && cacheFile.read(RCAST(char *, &version), sizeof(version))
+             == sizeof(version),
+          "version",
+          "cannot read the version of the cache");
+  }
+
+  ++version;
+  check(
+        patchFile(
+          cache,
+          CACHE_TEST_VERSION_OFFSET,
+          QByteArray(RCAST(const char *, &version), sizeof(version))),
+        "version",
+        "cannot change the version of the cache");
+  check(
+        !loadsCache(cache, source, x),
+        "version",
+        "the cache of another version was accepted");
+
+  // Same file, other samples. Every tree that rejects the cache saves its
+  // own once built, so the original samples are rejected again after that.
+  first = x[0];
+  x[0] = -x[0] + SUCOMPLEX(.5, .5);
+  check(
+        !loadsCache(cache, source, x),
+        "samples",
+        "the cache of other samples was accepted");
+
+  x[0] = first;
+  check(
+        !loadsCache(cache, source, x),
+        "samples",
+        "the cache of other samples was accepted");
+  check(
+        loadsCache(cache, source, x),
+        "samples",
+        "the rebuilt cache was rejected");
+
+  // Another capture file (or the same one, changed)
+  check(
+        file.open(QIODevice::Append) && file.write("\0", 1) == 1,
+        "identity",
+        "cannot change the capture file");
+  file.close();
+
+  check(
+        !loadsCache(cache, source, x),
+        "identity",
+        "the cache of another capture file was accepted");
+
+  printf("%u checks, %u failures\n", g_checks, g_failures);
+
+  return g_failures == 0 ? 0 : 1;
+}
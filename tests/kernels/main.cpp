@@ -0,0 +1,356 @@
+//
+//    main.cpp: Check the vectorized waveform kernels against the scalar ones
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveKernels.h"
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+//
+// Min, max, envelopes and search results must be bit-exact. Means and
+// frequencies are summed in a different order, and frequencies use an
+// approximation of atan2 (see WaveKernels.h), so they are compared with
+// a tolerance. NaN samples must be skipped by min / max / envelope and
+// propagate to the sums, as in the scalar kernels. The only exception is
+// a NaN in the first sample of non-initialized limits, which the scalar
+// kernels take as the initial min / max: the tests never place one there.
+//
+
+#define KERNELS_TEST_MAX_LEN     67 // Covers every tail of 2, 4 and 8 lanes
+#define KERNELS_TEST_MEAN_TOL    1e-5f
+#define KERNELS_TEST_FREQ_TOL    1e-4f
+#define KERNELS_TEST_ROUNDS      8
+
+static std::mt19937 g_rng(0x5754);
+static unsigned     g_checks   = 0;
+static unsigned     g_failures = 0;
+
+static const char *
+isaName(enum WaveKernels::Isa isa)
+{
+  switch (isa) {
+    case WaveKernels::ISA_SCALAR:
+      return "scalar";
+
+    case WaveKernels::ISA_SSE2:
+      return "sse2";
+
+    case WaveKernels::ISA_AVX2:
+      return "avx2";
+  }
+
+  return "unknown";
+}
+
+static SUFLOAT
+uniform(SUFLOAT min, SUFLOAT max)
+{
+  return std::uniform_real_distribution<SUFLOAT>(min, max)(g_rng);
+}
+
+// Multiples of 1 / 64: exact squares, and exact ties with grid levels
+static SUFLOAT
+grid(void)
+{
+  return SU_ASFLOAT(std::uniform_int_distribution<int>(-64, 64)(g_rng)) / 64;
+}
+
+static size_t
+pick(size_t min, size_t max)
+{
+  return std::uniform_int_distribution<size_t>(min, max)(g_rng);
+}
+
+static SUCOMPLEX
+withNaN(SUCOMPLEX x)
+{
+  switch (pick(0, 2)) {
+    case 0:
+      return SUCOMPLEX(NAN, SU_C_IMAG(x));
+
+    case 1:
+      return SUCOMPLEX(SU_C_REAL(x), NAN);
+
+    default:
+      return SUCOMPLEX(NAN, NAN);
+  }
+}
+
+static bool
+same(SUFLOAT a, SUFLOAT b)
+{
+  return (std::isnan(a) && std::isnan(b)) || a == b;
+}
+
+static bool
+close(SUFLOAT a, SUFLOAT b, SUFLOAT tol)
+{
+  return (std::isnan(a) && std::isnan(b)) || std::fabs(a - b) <= tol;
+}
+
+static void
+check(bool ok, const char *what, const char *isa, const char *fmt, ...)
+  __attribute__((format(printf, 4, 5)));
+
+static void
+check(bool ok, const char *what, const char *isa, const char *fmt, ...)
+{
+  va_list ap;
+
+  ++g_checks;
+
+  if (!ok) {
+    ++g_failures;
+    fprintf(stderr, "FAIL: %s (%s): ", what, isa);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+  }
+}
+
+static bool
+sameLimits(const WaveLimits &a, const WaveLimits &b)
+{
+  return same(SU_C_REAL(a.min), SU_C_REAL(b.min))
+      && same(SU_C_IMAG(a.min), SU_C_IMAG(b.min))
+      && same(SU_C_REAL(a.max), SU_C_REAL(b.max))
+      && same(SU_C_IMAG(a.max), SU_C_IMAG(b.max))
+      && same(a.envelope, b.envelope)
+      && close(SU_C_REAL(a.mean), SU_C_REAL(b.mean), KERNELS_TEST_MEAN_TOL)
+      && close(SU_C_IMAG(a.mean), SU_C_IMAG(b.mean), KERNELS_TEST_MEAN_TOL)
+      && close(a.freq, b.freq, KERNELS_TEST_FREQ_TOL);
+}
+
+// Limits left by a previous call, as when a block is computed in pieces
+static WaveLimits
+seedLimits(bool initialized)
+{
+  WaveLimits limits;
+
+  if (initialized) {
+    limits.min      = SUCOMPLEX(uniform(-1, 0), uniform(-1, 0));
+    limits.max      = SUCOMPLEX(uniform(0, 1), uniform(0, 1));
+    limits.mean     = SUCOMPLEX(uniform(-1, 1), uniform(-1, 1));
+    limits.envelope = uniform(0, 1.5);
+    limits.freq     = uniform(-1, 1);
+  }
+
+  return limits;
+}
+
+////////////////////////////////// Buffers /////////////////////////////////////
+static void
+testLimitsBuf(enum WaveKernels::Isa isa, bool nans)
+{
+  WaveKernels::LimitsBufKernel kernel = WaveKernels::limitsBuf(isa);
+  std::vector<SUCOMPLEX> storage(KERNELS_TEST_MAX_LEN + 1);
+
+  for (size_t len = 1; len <= KERNELS_TEST_MAX_LEN; ++len) {
+    for (unsigned mode = 0; mode < 4; ++mode) {
+      bool first       = mode & 1;
+      bool initialized = mode & 2;
+      // The sample before the buffer is read when it is not the first one
+      SUCOMPLEX *data  = storage.data() + 1;
+      WaveLimits ref, vec;
+
+      for (auto &x : storage)
+        x = SUCOMPLEX(uniform(-1, 1), uniform(-1, 1));
+
+      if (nans && (initialized || len > 1))
+        for (size_t n = pick(1, 3); n > 0; --n) {
+          size_t j = pick(initialized ? 0 : 1, len - 1);
+          data[j] = withNaN(data[j]);
+        }
+
+      ref = vec = seedLimits(initialized);
+
+      WaveKernels::calcLimitsBufScalar(ref, data, len, first);
+      kernel(vec, data, len, first);
+
+      check(
+            sameLimits(ref, vec),
+            "calcLimitsBuf",
+            isaName(isa),
+            "len = %zu, first = %d, initialized = %d, nans = %d",
+            len,
+            first,
+            initialized,
+            nans);
+    }
+  }
+}
+
+/////////////////////////////////// Blocks /////////////////////////////////////
+static void
+testLimitsBlock(enum WaveKernels::Isa isa, bool nans)
+{
+  WaveKernels::LimitsBlockKernel kernel = WaveKernels::limitsBlock(isa);
+  const SUFLOAT weights[] = {1, .25f};
+  const size_t  offsets[] = {0, 1, 3};
+  WaveLimitVector vector;
+
+  for (size_t offset : offsets) {
+    for (size_t len = 1; len <= KERNELS_TEST_MAX_LEN; ++len) {
+      vector.resize(offset + len);
+
+      for (SUFLOAT wEnd : weights) {
+        for (unsigned initialized = 0; initialized < 2; ++initialized) {
+          WaveLimits ref, vec;
+
+          for (size_t j = 0; j < offset + len; ++j) {
+            WaveLimits limits;
+            SUFLOAT a = uniform(-1, 1), b = uniform(-1, 1);
+            SUFLOAT c = uniform(-1, 1), d = uniform(-1, 1);
+
+            limits.min      = SUCOMPLEX(MIN(a, b), MIN(c, d));
+            limits.max      = SUCOMPLEX(MAX(a, b), MAX(c, d));
+            limits.mean     = SUCOMPLEX(.5f * (a + b), .5f * (c + d));
+            limits.envelope = uniform(0, 1.5);
+            limits.freq     = uniform(-1, 1);
+
+            if (nans && j >= offset + !initialized && pick(0, 7) == 0) {
+              limits.min  = withNaN(limits.min);
+              limits.max  = withNaN(limits.max);
+              limits.mean = withNaN(limits.mean);
+              if (pick(0, 1))
+                limits.envelope = NAN;
+              if (pick(0, 1))
+                limits.freq = NAN;
+            }
+
+            vector.set(j, limits);
+          }
+
+          ref = vec = seedLimits(initialized);
+
+          WaveKernels::calcLimitsBlockScalar(ref, vector, offset, len, wEnd);
+          kernel(vec, vector, offset, len, wEnd);
+
+          check(
+                sameLimits(ref, vec),
+                "calcLimitsBlock",
+                isaName(isa),
+                "offset = %zu, len = %zu, wEnd = %g, initialized = %u, "
+                "nans = %d",
+                offset,
+                len,
+                wEnd,
+                initialized,
+                nans);
+        }
+      }
+    }
+  }
+}
+
+/////////////////////////////////// Levels /////////////////////////////////////
+static void
+testFindLevel(enum WaveKernels::Isa isa, bool nans)
+{
+  WaveKernels::LevelKernel kernel = WaveKernels::findLevel(isa);
+  const enum WaveSearchComponent components[] = {
+    WAVE_SEARCH_REAL,
+    WAVE_SEARCH_IMAG,
+    WAVE_SEARCH_MAGNITUDE
+  };
+  std::vector<SUCOMPLEX> data(KERNELS_TEST_MAX_LEN);
+
+  for (size_t len = 0; len <= KERNELS_TEST_MAX_LEN; ++len) {
+    for (auto &x : data)
+      x = SUCOMPLEX(grid(), grid());
+
+    if (nans && len > 0)
+      for (size_t n = pick(1, 3); n > 0; --n) {
+        size_t j = pick(0, len - 1);
+        data[j] = withNaN(data[j]);
+      }
+
+    for (auto component : components) {
+      for (unsigned mode = 0; mode < 4; ++mode) {
+        bool slope = mode & 1;
+        bool above = mode & 2;
+        // Levels that few samples meet, so that searches run long
+        SUFLOAT level = grid() * .25f + (slope ? 1.5f : .85f);
+        size_t ref, vec;
+
+        if (!above)
+          level = component == WAVE_SEARCH_MAGNITUDE && !slope
+              ? 1.1f - level
+              : -level;
+
+        ref = WaveKernels::findLevelScalar(
+              data.data(),
+              len,
+              component,
+              slope,
+              above,
+              level);
+        vec = kernel(data.data(), len, component, slope, above, level);
+
+        check(
+              ref == vec,
+              "findLevel",
+              isaName(isa),
+              "len = %zu, component = %d, slope = %d, above = %d, "
+              "level = %g, nans = %d: %zu != %zu",
+              len,
+              component,
+              slope,
+              above,
+              level,
+              nans,
+              ref,
+              vec);
+      }
+    }
+  }
+}
+
+int
+main(void)
+{
+  const enum WaveKernels::Isa isas[] = {
+    WaveKernels::ISA_SSE2,
+    WaveKernels::ISA_AVX2
+  };
+
+  for (auto isa : isas) {
+    if (!WaveKernels::supports(isa)) {
+      printf("%s: not available, skipped\n", isaName(isa));
+      continue;
+    }
+
+    for (unsigned i = 0; i < KERNELS_TEST_ROUNDS; ++i) {
+      for (unsigned nans = 0; nans < 2; ++nans) {
+        testLimitsBuf(isa, nans);
+        testLimitsBlock(isa, nans);
+        testFindLevel(isa, nans);
+      }
+    }
+
+    printf("%s: checked against the scalar kernels\n", isaName(isa));
+  }
+
+  printf("%u checks, %u failures\n", g_checks, g_failures);
+
+  return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+//
+//    main.cpp: Check the range statistics of the waveform tree
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveViewTree.h"
+#include <QCoreApplication>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+//
+// computeRangeStats() must give the statistics of a compensated pass over
+// the samples of the range. Ranges start and end in the middle of a block,
+// so that both ragged ends are read from the samples and every level of
+// the tree takes part. Sums are added in a different order, and are
+// compared with a tolerance. Min and max are exact, but in compact levels,
+// where they may be rounded outwards up to the quantization step.
+//
+
+#define STATS_TEST_SERIAL_LENGTH   3000  // Built in place
+#define STATS_TEST_PARALLEL_LENGTH 50000 // Built by the worker thread
+#define STATS_TEST_RANGES          200
+#define STATS_TEST_MEAN_TOL        1e-5f
+#define STATS_TEST_PEAK_TOL        1e-6f
+#define STATS_TEST_ROUND_TOL       1e-6f
+
+// Samples are in [-1, 1]: steps are at most 2 / WAVEFORM_LIMIT_QUANT_MAX
+#define STATS_TEST_QUANT_TOL       (4.f / WAVEFORM_LIMIT_QUANT_MAX)
+
+static std::mt19937 g_rng(0x5754);
+static unsigned     g_checks   = 0;
+static unsigned     g_failures = 0;
+
+static SUFLOAT
+uniform(SUFLOAT min, SUFLOAT max)
+{
+  return std::uniform_real_distribution<SUFLOAT>(min, max)(g_rng);
+}
+
+static qint64
+pick(qint64 min, qint64 max)
+{
+  return std::uniform_int_distribution<qint64>(min, max)(g_rng);
+}
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+{
+  va_list ap;
+
+  ++g_checks;
+
+  if (!ok) {
+    ++g_failures;
+    fprintf(stderr, "FAIL: %s: ", what);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+  }
+}
+
+static WaveRangeStats
+bruteForce(std::vector<SUCOMPLEX> const &x, qint64 start, qint64 end)
+{
+  WaveRangeStats stats;
+  const SUCOMPLEX *data = x.data() + start;
+  SUSCOUNT len = SCAST(SUSCOUNT, end - start + 1);
+
+  SuWidgetsHelpers::kahanMeanAndRms(&stats.mean, &stats.rms, data, len);
+
+  for (SUSCOUNT i = 0; i < len; ++i) {
+    stats.min = MIN(SU_C_REAL(stats.min), SU_C_REAL(data[i]))
+        + MIN(SU_C_IMAG(stats.min), SU_C_IMAG(data[i])) * SU_I;
+    stats.max = MAX(SU_C_REAL(stats.max), SU_C_REAL(data[i]))
+        + MAX(SU_C_IMAG(stats.max), SU_C_IMAG(data[i])) * SU_I;
+    stats.peak = MAX(stats.peak, SU_C_ABS(data[i]));
+  }
+
+  stats.count = len;
+  stats.power = stats.rms * stats.rms;
+
+  return stats;
+}
+
+//
+// How far `bound` is outside `actual` (e.g. a min below the actual one).
+// Exact levels must give the actual bound, compact ones may round it
+// outwards up to the quantization step.
+//
+static bool
+outwards(SUFLOAT bound, SUFLOAT actual, SUFLOAT sign, bool compact)
+{
+  SUFLOAT excess = sign * (bound - actual);
+
+  if (!compact)
+    return excess == 0;
+
+  return excess >= -STATS_TEST_ROUND_TOL && excess <= STATS_TEST_QUANT_TOL;
+}
+
+// Both ends in the middle of a block, which is then true for every level
+static void
+pickRange(qint64 length, qint64 blockLength, qint64 &start, qint64 &end)
+{
+  do {
+    start = pick(0, length - 1);
+
+    if (pick(0, 1) == 0)
+      end = pick(start, length - 1);
+    else
+      end = MIN(length - 1, start + pick(0, 4 * blockLength));
+  } while (start % blockLength == 0 || (end + 1) % blockLength == 0);
+}
+
+static void
+testTree(int bits, bool compact, SUSCOUNT length)
+{
+  WaveViewTree tree;
+  std::vector<SUCOMPLEX> x(length);
+  WaveRangeStats stats, ref;
+  qint64 blockLength = SCAST(qint64, 1) << bits;
+  qint64 start, end;
+  char what[64];
+
+  snprintf(
+        what,
+        sizeof(what),
+        "%d bits, %s, %lu samples",
+        bits,
+        compact ? "compact" : "full",
+        SCAST(unsigned long, length));
+
+  for (auto &s : x)
+    s = SUCOMPLEX(uniform(-1, 1), uniform(-1, 1));
+
+  check(tree.setBlockBits(bits), what, "block bits rejected");
+  check(
+        tree.reprocess(WaveSamples(x.data()), length),
+        what,
+        "the tree was not built");
+
+  // Big trees are built by the worker thread, which reports back through
+  // the event loop
+  while (!tree.isComplete())
+    QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+
+  tree.setCompactLevels(compact);
+  check(
+        tree.size() > 0 && tree.first().isCompact() == compact,
+        what,
+        "levels are not in the requested mode");
+
+  for (unsigned i = 0; i < STATS_TEST_RANGES; ++i) {
+    pickRange(SCAST(qint64, length), blockLength, start, end);
+
+    ref = bruteForce(x, start, end);
+
+    if (!tree.computeRangeStats(start, end, stats)) {
+      check(false, what, "no stats for [%lld, %lld]", start, end);
+      continue;
+    }
+
+    check(
+          stats.count == ref.count,
+          what,
+          "[%lld, %lld]: %lu samples, %lu expected",
+          start,
+          end,
+          SCAST(unsigned long, stats.count),
+          SCAST(unsigned long, ref.count));
+
+    check(
+          std::fabs(SU_C_REAL(stats.mean - ref.mean)) <= STATS_TEST_MEAN_TOL
+          && std::fabs(SU_C_IMAG(stats.mean - ref.mean)) <= STATS_TEST_MEAN_TOL,
+          what,
+          "[%lld, %lld]: mean (%g, %g), (%g, %g) expected",
+          start,
+          end,
+          SU_C_REAL(stats.mean),
+          SU_C_IMAG(stats.mean),
+          SU_C_REAL(ref.mean),
+          SU_C_IMAG(ref.mean));
+
+    check(
+          std::fabs(stats.rms - ref.rms) <= STATS_TEST_MEAN_TOL,
+          what,
+          "[%lld, %lld]: RMS %g, %g expected",
+          start,
+          end,
+          stats.rms,
+          ref.rms);
+
+    check(
+          outwards(SU_C_REAL(stats.min), SU_C_REAL(ref.min), -1, compact)
+          && outwards(SU_C_IMAG(stats.min), SU_C_IMAG(ref.min), -1, compact)
+          && outwards(SU_C_REAL(stats.max), SU_C_REAL(ref.max), +1, compact)
+          && outwards(SU_C_IMAG(stats.max), SU_C_IMAG(ref.max), +1, compact),
+          what,
+          "[%lld, %lld]: limits (%g, %g) - (%g, %g), "
+          "(%g, %g) - (%g, %g) expected",
+          start,
+          end,
+          SU_C_REAL(stats.min),
+          SU_C_IMAG(stats.min),
+          SU_C_REAL(stats.max),
+          SU_C_IMAG(stats.max),
+          SU_C_REAL(ref.min),
+          SU_C_IMAG(ref.min),
+          SU_C_REAL(ref.max),
+          SU_C_IMAG(ref.max));
+
+    check(
+          compact
+          ? stats.peak >= ref.peak - STATS_TEST_ROUND_TOL
+            && stats.peak <= ref.peak + STATS_TEST_QUANT_TOL
+          : std::fabs(stats.peak - ref.peak) <= STATS_TEST_PEAK_TOL,
+          what,
+          "[%lld, %lld]: peak %g, %g expected",
+          start,
+          end,
+          stats.peak,
+          ref.peak);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  for (int bits = WAVEFORM_BLOCK_MIN_BITS;
+       bits <= WAVEFORM_BLOCK_MAX_BITS;
+       ++bits) {
+    for (int compact = 0; compact < 2; ++compact) {
+      testTree(bits, compact != 0, STATS_TEST_SERIAL_LENGTH);
+      testTree(bits, compact != 0, STATS_TEST_PARALLEL_LENGTH);
+    }
+  }
+
+  printf("%u checks, %u failures\n", g_checks, g_failures);
+
+  return g_failures == 0 ? 0 : 1;
+}
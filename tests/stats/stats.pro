@@ -0,0 +1,26 @@
+#
+# Checks the statistics of ranges of samples computed from the waveform tree
+# against a brute-force pass over the samples. Run it with "make check"
+# after building the library.
+#
+
+TEMPLATE = app
+TARGET   = stats
+CONFIG  += console testcase
+CONFIG  -= app_bundle
+QT      -= gui
+
+equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 9) {
+  QMAKE_CXXFLAGS += -std=gnu++11
+} else {
+  CONFIG += c++14
+}
+
+INCLUDEPATH += $$PWD/../..
+LIBS        += -L$$OUT_PWD/../.. -l$$qtLibraryTarget(suwidgets)
+unix: QMAKE_RPATHDIR += $$OUT_PWD/../..
+
+CONFIG    += link_pkgconfig
+PKGCONFIG += sigutils
+
+SOURCES += main.cpp
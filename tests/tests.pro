@@ -0,0 +1,3 @@
+TEMPLATE = subdirs
+
+SUBDIRS += kernels trigger stats cache
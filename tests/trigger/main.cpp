@@ -0,0 +1,404 @@
+//
+//    main.cpp: Check the trigger of streamed waveforms
+//    Copyright (C) 2025 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WaveTrigger.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+//
+// The trigger sees the stream in chunks, and must find the same trigger
+// points as a reference that scans the whole stream at once. Every window
+// it completes is compared against the samples around the corresponding
+// trigger point of the reference.
+//
+
+#define TRIGGER_TEST_ROUNDS 400
+
+static std::mt19937 g_rng(0x5754);
+static unsigned     g_checks   = 0;
+static unsigned     g_failures = 0;
+
+static size_t
+pick(size_t min, size_t max)
+{
+  return std::uniform_int_distribution<size_t>(min, max)(g_rng);
+}
+
+// Multiples of 1 / 4: exact differences, and frequent ties with the level
+static SUFLOAT
+grid(void)
+{
+  return SU_ASFLOAT(std::uniform_int_distribution<int>(-4, 4)(g_rng)) / 4;
+}
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+static void
+check(bool ok, const char *what, const char *fmt, ...)
+{
+  va_list ap;
+
+  ++g_checks;
+
+  if (!ok) {
+    ++g_failures;
+    fprintf(stderr, "FAIL: %s: ", what);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+  }
+}
+
+//////////////////////////////// Reference /////////////////////////////////////
+static SUFLOAT
+levelValue(SUCOMPLEX x, enum WaveSearchComponent component)
+{
+  switch (component) {
+    case WAVE_SEARCH_REAL:
+      return SU_C_REAL(x);
+
+    case WAVE_SEARCH_IMAG:
+      return SU_C_IMAG(x);
+
+    default:
+      return SU_C_ABS(x);
+  }
+}
+
+// Whether x[t] (or x[t] - x[t - 1], in slope mode) is above the level
+static bool
+meets(
+    std::vector<SUCOMPLEX> const &x,
+    WaveTriggerParams const &p,
+    size_t t,
+    bool above)
+{
+  SUFLOAT value = levelValue(x[t], p.component);
+
+  if (p.slope) {
+    if (t == 0)
+      return false;
+
+    value -= levelValue(x[t - 1], p.component);
+  }
+
+  return (value >= p.level) == above;
+}
+
+// Trigger points of complete windows, looked for in the whole stream
+static std::vector<size_t>
+referencePoints(std::vector<SUCOMPLEX> const &x, WaveTriggerParams const &p)
+{
+  enum WaveSearchCondition cond = p.condition;
+  bool above = cond == WAVE_SEARCH_ABOVE || cond == WAVE_SEARCH_RISING;
+  bool edge  = cond == WAVE_SEARCH_RISING || cond == WAVE_SEARCH_FALLING;
+  size_t post = p.length - p.preTrigger;
+  size_t hold = p.holdoff > post ? p.holdoff - post : 0;
+  size_t n = x.size();
+  size_t t = p.preTrigger;
+  std::vector<size_t> points;
+
+  for (;;) {
+    if (edge) {
+      while (t < n && !meets(x, p, t, !above))
+        ++t;
+      ++t;
+    }
+
+    while (t < n && !meets(x, p, t, above))
+      ++t;
+
+    if (t >= n || t + post > n)
+      break;
+
+    points.push_back(t);
+    t += post + hold;
+  }
+
+  return points;
+}
+
+////////////////////////////////// Tests ///////////////////////////////////////
+//
+// Feeds the stream in chunks of the given lengths (repeated as needed).
+// Chunks may complete more than one window, of which only the last one is
+// kept: it must be the one of the last trigger point so far.
+//
+static void
+feedStream(
+    const char *what,
+    WaveTriggerParams const &p,
+    std::vector<SUCOMPLEX> const &x,
+    std::vector<size_t> const &chunks)
+{
+  WaveTrigger trigger;
+  std::vector<size_t> points = referencePoints(x, p);
+  std::vector<SUCOMPLEX> window;
+  size_t pos = 0, c = 0, len, start;
+  quint64 n;
+  bool ok;
+
+  check(trigger.setParams(p), what, "valid parameters were rejected");
+
+  while (pos < x.size()) {
+    len = std::min(chunks[c++ % chunks.size()], x.size() - pos);
+
+    if (trigger.feed(x.data() + pos, len)) {
+      n  = trigger.count();
+      ok = n > 0 && n <= points.size() && trigger.takeWindow(window);
+
+      check(
+            ok,
+            what,
+            "window %llu completed at %zu, %zu expected",
+            SCAST(unsigned long long, n),
+            pos + len,
+            points.size());
+
+      if (ok) {
+        start = points[n - 1] - p.preTrigger;
+        check(
+              window.size() == p.length
+              && std::equal(window.begin(), window.end(), x.begin() + start),
+              what,
+              "window %llu does not start at sample %zu",
+              SCAST(unsigned long long, n),
+              start);
+      }
+    }
+
+    pos += len;
+  }
+
+  check(
+        trigger.count() == points.size(),
+        what,
+        "%llu windows, %zu expected",
+        SCAST(unsigned long long, trigger.count()),
+        points.size());
+}
+
+// Checks the reference itself before feeding the stream in chunks
+static void
+testStream(
+    const char *what,
+    WaveTriggerParams const &p,
+    std::vector<SUCOMPLEX> const &x,
+    std::vector<size_t> const &expected,
+    std::vector<std::vector<size_t>> const &chunkings)
+{
+  check(
+        referencePoints(x, p) == expected,
+        what,
+        "the reference missed the trigger points of the test");
+
+  for (auto const &chunks : chunkings)
+    feedStream(what, p, x, chunks);
+}
+
+// Edges armed by the last sample of a chunk, and fired many chunks later
+static void
+testChunkArming(void)
+{
+  WaveTriggerParams p;
+  std::vector<SUCOMPLEX> x(4, 1);
+
+  x.insert(x.end(), 1, 0);
+  x.insert(x.end(), 4, 1);
+  x.insert(x.end(), 15, 0);
+  x.insert(x.end(), 12, 1);
+
+  p.condition = WAVE_SEARCH_RISING;
+  p.level     = .5;
+  p.length    = 4;
+
+  // Armed at 4, fired at 5 (first of the next chunk). Rearmed at 9, which
+  // is the last sample of a chunk, and fired at 24, three chunks later.
+  testStream("chunk arming", p, x, {5, 24}, {{5, 5}, {1}, {10, 3, 7}});
+
+  for (auto &s : x)
+    s = SU_ASFLOAT(1) - s;
+
+  p.condition = WAVE_SEARCH_FALLING;
+  testStream("chunk arming (falling)", p, x, {5, 24}, {{5, 5}, {1}});
+}
+
+// Differences between the last sample of a chunk and the first of the next
+static void
+testChunkSlope(void)
+{
+  WaveTriggerParams p;
+  std::vector<SUCOMPLEX> x(10, 0);
+
+  x.insert(x.end(), 10, 1);
+  x.insert(x.end(), 10, 3);
+
+  p.slope      = true;
+  p.condition  = WAVE_SEARCH_ABOVE;
+  p.level      = .5;
+  p.length     = 6;
+  p.preTrigger = 2;
+
+  testStream("chunk slope", p, x, {10, 20}, {{10}, {5, 5}, {1}, {30}});
+
+  p.condition = WAVE_SEARCH_RISING;
+  p.level     = 1.5;
+  testStream("chunk slope (rising)", p, x, {20}, {{10}, {20, 1}, {1}});
+}
+
+// Pre-trigger parts much longer than the chunks, taken from the history
+static void
+testPreTrigger(void)
+{
+  WaveTriggerParams p;
+  std::vector<SUCOMPLEX> x;
+  std::vector<size_t> expected;
+
+  for (unsigned i = 0; i < 100; ++i)
+    x.push_back(SUCOMPLEX(SU_ASFLOAT(i), -SU_ASFLOAT(i)));
+
+  for (size_t t = 40; t + 4 <= x.size(); t += 4)
+    expected.push_back(t);
+
+  p.condition  = WAVE_SEARCH_ABOVE;
+  p.level      = 40;
+  p.length     = 34;
+  p.preTrigger = 30;
+
+  testStream("pre-trigger", p, x, expected, {{3}, {1}, {7, 29, 2}, {100}});
+}
+
+// Holdoffs longer than the part of the window after the trigger point
+static void
+testHoldoff(void)
+{
+  WaveTriggerParams p;
+  std::vector<SUCOMPLEX> x(60, 1);
+
+  p.condition  = WAVE_SEARCH_ABOVE;
+  p.level      = .5;
+  p.length     = 6;
+  p.preTrigger = 2;
+  p.holdoff    = 10;
+
+  testStream(
+        "holdoff",
+        p,
+        x,
+        {2, 12, 22, 32, 42, 52},
+        {{4}, {1}, {9, 2}, {60}});
+
+  // Shorter holdoffs change nothing: windows never overlap
+  p.holdoff = 3;
+  testStream(
+        "short holdoff",
+        p,
+        x,
+        {2, 6, 10, 14, 18, 22, 26, 30, 34, 38, 42, 46, 50, 54},
+        {{4}, {1}, {60}});
+}
+
+static void
+testSetParams(void)
+{
+  WaveTrigger trigger;
+  WaveTriggerParams p, bad;
+
+  p.length     = 16;
+  p.preTrigger = 15;
+  check(trigger.setParams(p), "setParams", "preTrigger < length rejected");
+
+  bad = p;
+  bad.preTrigger = 16;
+  check(!trigger.setParams(bad), "setParams", "preTrigger = length accepted");
+
+  bad.preTrigger = 17;
+  check(!trigger.setParams(bad), "setParams", "preTrigger > length accepted");
+
+  bad.length     = 0;
+  bad.preTrigger = 0;
+  check(!trigger.setParams(bad), "setParams", "empty window accepted");
+
+  check(
+        trigger.params().length == 16 && trigger.params().preTrigger == 15,
+        "setParams",
+        "rejected parameters were kept");
+}
+
+// Random streams, parameters and chunks
+static void
+testRandom(void)
+{
+  const enum WaveSearchComponent components[] = {
+    WAVE_SEARCH_REAL,
+    WAVE_SEARCH_IMAG,
+    WAVE_SEARCH_MAGNITUDE
+  };
+  const enum WaveSearchCondition conditions[] = {
+    WAVE_SEARCH_ABOVE,
+    WAVE_SEARCH_BELOW,
+    WAVE_SEARCH_RISING,
+    WAVE_SEARCH_FALLING
+  };
+  const size_t maxChunks[] = {1, 7, 100, 3000};
+
+  for (unsigned i = 0; i < TRIGGER_TEST_ROUNDS; ++i) {
+    WaveTriggerParams p;
+    std::vector<SUCOMPLEX> x(pick(200, 2000));
+    std::vector<size_t> chunks(pick(1, 8));
+    size_t maxChunk = maxChunks[pick(0, 3)];
+
+    for (auto &s : x)
+      s = SUCOMPLEX(grid(), grid());
+
+    for (auto &c : chunks)
+      c = pick(1, maxChunk);
+
+    p.component  = components[pick(0, 2)];
+    p.condition  = conditions[pick(0, 3)];
+    p.slope      = pick(0, 1) == 1;
+    p.level      = grid();
+    p.length     = pick(1, 64);
+    p.preTrigger = pick(0, p.length - 1);
+    p.holdoff    = pick(0, 96);
+
+    feedStream("random", p, x, chunks);
+  }
+}
+
+int
+main(void)
+{
+  testSetParams();
+  testChunkArming();
+  testChunkSlope();
+  testPreTrigger();
+  testHoldoff();
+  testRandom();
+
+  printf("%u checks, %u failures\n", g_checks, g_failures);
+
+  return g_failures == 0 ? 0 : 1;
+}
@@ -1,7 +1,20 @@
-WIDGET_HEADERS += Waveform.h WaveView.h WaveViewTree.h
+WIDGET_HEADERS += Waveform.h WaveView.h WaveViewTree.h WaveTreeRegistry.h \
+  WaveEyeDiagram.h WaveSamples.h WaveTrigger.h
 
 HEADERS += Waveform.h WaveView.h YIQ.h \
   WaveWorker.h \
+  WaveEyeDiagram.h \
+  WaveKernels.h \
+  WaveRasterizer.h \
+  WaveSamples.h \
+  WaveTreeRegistry.h \
+  WaveTrigger.h \
   WaveViewTree.h
 SOURCES += Waveform.cpp WaveView.cpp \
+  WaveEyeDiagram.cpp \
+  WaveKernels.cpp \
+  WaveRasterizer.cpp \
+  WaveSamples.cpp \
+  WaveTreeRegistry.cpp \
+  WaveTrigger.cpp \
   WaveViewTree.cpp